@@ -0,0 +1,379 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zck.h>
+
+#include "zck_private.h"
+
+/* Largest gap between chunks that we'd rather read through than seek over */
+#define COALESCE_GAP 65536
+/* Compressed data to read before decompressing what we have so far */
+#define BATCH_SIZE 8388608
+/* Most compressed data and chunks a worker checks together */
+#define VERIFY_GROUP_SIZE 1048576
+#define VERIFY_GROUP_CHUNKS 256
+
+typedef struct batchItem {
+    zckChunk *chunk;
+    const char *src;
+    char *dst;
+} batchItem;
+
+/* A run of items whose chunks are hashed together before decompressing */
+typedef struct verifyGroup {
+    size_t first;
+    size_t count;
+} verifyGroup;
+
+typedef struct batchJob {
+    zckCtx *zck;
+    zckReader **readers;
+    batchItem *items;
+    zckChunk *skip;
+    verifyGroup *groups;
+} batchJob;
+
+static int chunk_cmp(const void *a, const void *b) {
+    const zckChunk *ca = *(const zckChunk **)a;
+    const zckChunk *cb = *(const zckChunk **)b;
+
+    if(ca->start != cb->start)
+        return ca->start < cb->start ? -1 : 1;
+    return 0;
+}
+
+static bool verify_group(void *arg, size_t item, int worker) {
+    batchJob *job = arg;
+    verifyGroup *g = &(job->groups[item]);
+    batchItem *items = job->items + g->first;
+    zckCtx *zck = job->zck;
+    if(job->readers)
+        zck = &(job->readers[worker]->zck);
+
+    bool ret = false;
+    int digest_size = zck->chunk_hash_type.digest_size;
+    const char **ptrs = zmalloc(g->count * sizeof(char *));
+    size_t *sizes = zmalloc(g->count * sizeof(size_t));
+    char *digests = zmalloc(g->count * digest_size);
+    if(!ptrs || !sizes || !digests) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        goto end;
+    }
+    for(size_t i=0; i<g->count; i++) {
+        ptrs[i] = items[i].src;
+        sizes[i] = items[i].chunk->comp_length;
+    }
+    if(!hash_many(zck, &(zck->chunk_hash_type), ptrs, sizes, g->count,
+                  digests))
+        goto end;
+
+    /* Skip the same chunks decompress_item() does */
+    for(size_t i=0; i<g->count; i++) {
+        zckChunk *chunk = items[i].chunk;
+        if(chunk->length == 0 || chunk->comp_length == 0 ||
+           chunk == job->skip)
+            continue;
+        int valid = validate_chunk_digest(zck, chunk, digests + i * digest_size,
+                                          ZCK_LOG_ERROR);
+        if(valid < 1) {
+            if(valid == -1)
+                set_error(zck, "Chunk %llu's checksum doesn't match",
+                          (long long unsigned) chunk->number);
+            goto end;
+        }
+    }
+    ret = true;
+
+end:
+    free(ptrs);
+    free(sizes);
+    free(digests);
+    return ret;
+}
+
+static bool decompress_item(void *arg, size_t item, int worker) {
+    batchJob *job = arg;
+    batchItem *bi = &(job->items[item]);
+    zckCtx *zck = job->zck;
+    if(job->readers)
+        zck = &(job->readers[worker]->zck);
+
+    if(bi->chunk->length == 0 || bi->chunk == job->skip)
+        return true;
+    bi->dst = zmalloc(bi->chunk->length);
+    if(!bi->dst) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    /* The chunk has already been checked by verify_group() */
+    return comp_decompress_chunk(zck, bi->chunk, bi->src, bi->dst, false) >= 0;
+}
+
+/* Read length bytes at offset, either pointing at them in memory or reading
+ * them into buf */
+static bool read_span(zckCtx *zck, size_t offset, size_t length,
+                      const char **data, char *buf) {
+    if(!seek_data(zck, offset, SEEK_SET))
+        return false;
+
+    if(zck->src_buf) {
+        if(read_data_ptr(zck, data, NULL, length) != length) {
+            set_error(zck, "Short read at %llu", (long long unsigned) offset);
+            return false;
+        }
+        return true;
+    }
+
+    *data = buf;
+    size_t rb = 0;
+    while(rb < length) {
+        ssize_t r = read_data(zck, buf + rb, length - rb);
+        if(r < 0)
+            return false;
+        if(r == 0) {
+            set_error(zck, "Short read at %llu", (long long unsigned) offset);
+            return false;
+        }
+        rb += r;
+    }
+    return true;
+}
+
+/* If data_hash is set, the compressed data of every chunk is also added to
+ * the data checksum in file order, and the dictionary chunk is only hashed.
+ * If chunks is NULL, the count chunks in the index starting at first are
+ * used */
+static bool get_chunks_data(zckCtx *zck, zckChunk **chunks, zckChunk *first,
+                            size_t count, zck_chunk_cb cb, void *cb_data,
+                            bool data_hash) {
+    if(count == 0)
+        return true;
+
+    bool ret = false;
+    int threads = get_thread_count(zck);
+    zckReader **readers = NULL;
+    char *buf = NULL;
+    size_t buf_size = 0;
+    zckChunk **sorted = zmalloc(count * sizeof(zckChunk *));
+    batchItem *items = zmalloc(count * sizeof(batchItem));
+    verifyGroup *groups = zmalloc(count * sizeof(verifyGroup));
+    if(!sorted || !items || !groups) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        goto end;
+    }
+    for(size_t i=0; i<count; i++) {
+        sorted[i] = chunks ? chunks[i] : &(first[i]);
+        if(sorted[i] == NULL || sorted[i]->zck != zck) {
+            set_error(zck, "Chunk doesn't belong to this context");
+            goto end;
+        }
+    }
+    qsort(sorted, count, sizeof(zckChunk *), chunk_cmp);
+
+    /* Load the dictionary before creating readers so they get a copy */
+    if(!comp_load_dict(zck))
+        goto end;
+    /* parallel_for() never has more workers than items */
+    if(threads > count)
+        threads = count;
+    if(threads > 1) {
+        readers = zmalloc(threads * sizeof(zckReader *));
+        if(!readers) {
+            zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            goto end;
+        }
+        for(int i=0; i<threads; i++) {
+            readers[i] = zck_reader_create(zck);
+            if(readers[i] == NULL)
+                goto end;
+        }
+    }
+
+    size_t header_length = zck_get_header_length(zck);
+    size_t total = 0;
+    for(size_t i=0; i<count; i++)
+        total += sorted[i]->comp_length;
+    size_t next = 0;
+    while(next < count) {
+        /* Gather a batch of chunks, merging chunks that are close together
+         * into a single read */
+        size_t first = next;
+        size_t batch_size = 0;
+        while(next < count && batch_size < BATCH_SIZE) {
+            size_t span_first = next;
+            size_t span_start = sorted[next]->start;
+            size_t span_end = span_start + sorted[next]->comp_length;
+            for(next++; next < count; next++) {
+                size_t start = sorted[next]->start;
+                size_t end = start + sorted[next]->comp_length;
+                if(start > span_end + COALESCE_GAP ||
+                   batch_size + end - span_start > BATCH_SIZE)
+                    break;
+                if(end > span_end)
+                    span_end = end;
+            }
+
+            size_t span_size = span_end - span_start;
+            if(zck->src_buf == NULL && buf_size < batch_size + span_size) {
+                /* Earlier items point into buf, so finish this batch before
+                 * growing it */
+                if(batch_size > 0) {
+                    next = span_first;
+                    break;
+                }
+                free(buf);
+                buf_size = total < BATCH_SIZE ? total : BATCH_SIZE;
+                if(buf_size < span_size)
+                    buf_size = span_size;
+                buf = zmalloc(buf_size);
+                if(!buf) {
+                    zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+                    goto end;
+                }
+            }
+            const char *data = NULL;
+            if(!read_span(zck, header_length + span_start, span_size, &data,
+                          buf + batch_size))
+                goto end;
+            for(size_t i=span_first; i<next; i++) {
+                items[i].chunk = sorted[i];
+                items[i].src = data + (sorted[i]->start - span_start);
+                items[i].dst = NULL;
+            }
+            batch_size += span_size;
+        }
+
+        /* Check the batch's chunks, hashing small chunks side by side, then
+         * decompress them and hand them over in order */
+        batchJob job = {zck, readers, items + first,
+                        data_hash ? zck->index.first : NULL, groups};
+        size_t group_count = 0;
+        if(VERIFY_CHUNKS(zck)) {
+            verifyGroup *g = NULL;
+            size_t group_size = 0;
+            for(size_t i=first; i<next; i++) {
+                size_t size = items[i].chunk->comp_length;
+                if(g == NULL || g->count == VERIFY_GROUP_CHUNKS ||
+                   group_size + size > VERIFY_GROUP_SIZE) {
+                    g = &(groups[group_count++]);
+                    g->first = i - first;
+                    g->count = 0;
+                    group_size = 0;
+                }
+                g->count++;
+                group_size += size;
+            }
+        }
+        bool decompressed = parallel_for(group_count, threads, verify_group,
+                                         &job) &&
+                            parallel_for(next - first, threads,
+                                         decompress_item, &job);
+        if(!decompressed && readers) {
+            for(int i=0; i<threads; i++) {
+                if(zck_is_error(&(readers[i]->zck))) {
+                    copy_error(zck, &(readers[i]->zck));
+                    break;
+                }
+            }
+        }
+        for(size_t i=first; i<next; i++) {
+            if(decompressed && data_hash && items[i].chunk->comp_length > 0 &&
+               !hash_update(zck, &(zck->check_full_hash), items[i].src,
+                            items[i].chunk->comp_length))
+                decompressed = false;
+            if(decompressed && items[i].chunk != job.skip) {
+                if(VERIFY_CHUNKS(zck))
+                    items[i].chunk->valid = 1;
+                if(!cb(items[i].chunk, items[i].dst, items[i].chunk->length,
+                       cb_data)) {
+                    set_error(zck, "Chunk callback failed for chunk %llu",
+                              (long long unsigned) items[i].chunk->number);
+                    decompressed = false;
+                }
+            }
+            free(items[i].dst);
+            items[i].dst = NULL;
+        }
+        if(!decompressed)
+            goto end;
+    }
+    ret = true;
+
+end:
+    if(readers)
+        for(int i=0; i<threads; i++)
+            zck_reader_free(&(readers[i]));
+    free(readers);
+    free(buf);
+    free(items);
+    free(groups);
+    free(sorted);
+    return ret;
+}
+
+bool ZCK_PUBLIC_API zck_get_chunks_data(zckCtx *zck, zckChunk **chunks,
+                                        size_t count, zck_chunk_cb cb,
+                                        void *cb_data) {
+    VALIDATE_READ_BOOL(zck);
+    ALLOCD_BOOL(zck, chunks);
+    ALLOCD_BOOL(zck, cb);
+
+    return get_chunks_data(zck, chunks, NULL, count, cb, cb_data, false);
+}
+
+bool ZCK_PUBLIC_API zck_foreach_chunk(zckCtx *zck, zck_chunk_cb cb,
+                                      void *cb_data) {
+    VALIDATE_READ_BOOL(zck);
+    ALLOCD_BOOL(zck, cb);
+
+    if(!index_load(zck))
+        return false;
+    if(zck->index.chunks_count == 0) {
+        set_error(zck, "Index hasn't been read yet");
+        return false;
+    }
+    /* The first chunk is the dictionary, which isn't part of the data */
+    if(!HASH_DATA(zck)) {
+        if(zck->index.chunks_count < 2)
+            return true;
+        return get_chunks_data(zck, NULL, zck->index.chunks + 1,
+                               zck->index.chunks_count - 1, cb, cb_data,
+                               false);
+    }
+
+    /* Like zck_read(), build the data checksum as we go so zck_close() can
+     * check it.  Loading the dictionary touches the checksum, so do that
+     * first */
+    if(!comp_load_dict(zck) ||
+       !hash_init(zck, &(zck->check_full_hash), &(zck->hash_type)))
+        return false;
+    return get_chunks_data(zck, NULL, zck->index.chunks,
+                           zck->index.chunks_count, cb, cb_data, true);
+}
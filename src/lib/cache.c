@@ -0,0 +1,138 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zck.h>
+
+#include "zck_private.h"
+
+static void cache_remove(zckCache *cache, zckCacheItem *item) {
+    HASH_DEL(cache->ht, item);
+    cache->size -= item->length;
+    free(item->data);
+    free(item);
+}
+
+/* Drop least recently used chunks until size bytes fit in the cache */
+static void cache_evict(zckCache *cache, size_t size) {
+    while(cache->ht && cache->size + size > cache->max_size) {
+        zck_log(ZCK_LOG_DDEBUG, "Evicting chunk %llu from cache",
+                (long long unsigned) cache->ht->number);
+        cache_remove(cache, cache->ht);
+    }
+}
+
+bool cache_set_size(zckCtx *zck, size_t max_size) {
+    VALIDATE_BOOL(zck);
+
+    zck->cache.max_size = max_size;
+    cache_evict(&(zck->cache), 0);
+    return true;
+}
+
+ssize_t cache_get(zckCtx *zck, zckChunk *idx, char *dst, size_t dst_size) {
+    VALIDATE_INT(zck);
+    ALLOCD_INT(zck, idx);
+
+    zckCache *cache = &(zck->cache);
+    if(cache->max_size == 0)
+        return 0;
+
+    zckCacheItem *item = NULL;
+    HASH_FIND(hh, cache->ht, &(idx->number), sizeof(idx->number), item);
+    if(item == NULL || item->length > dst_size) {
+        cache->misses++;
+        return 0;
+    }
+
+    /* Move item to the end of the list, marking it most recently used */
+    HASH_DEL(cache->ht, item);
+    HASH_ADD(hh, cache->ht, number, sizeof(item->number), item);
+    cache->hits++;
+    memcpy(dst, item->data, item->length);
+    return item->length;
+}
+
+bool cache_add(zckCtx *zck, zckChunk *idx, const char *data) {
+    VALIDATE_BOOL(zck);
+    ALLOCD_BOOL(zck, idx);
+    ALLOCD_BOOL(zck, data);
+
+    zckCache *cache = &(zck->cache);
+    if(idx->length == 0 || idx->length > cache->max_size)
+        return true;
+
+    zckCacheItem *item = NULL;
+    HASH_FIND(hh, cache->ht, &(idx->number), sizeof(idx->number), item);
+    if(item)
+        return true;
+
+    cache_evict(cache, idx->length);
+    item = zmalloc(sizeof(zckCacheItem));
+    if(!item) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    item->data = zmalloc(idx->length);
+    if(!item->data) {
+        free(item);
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    memcpy(item->data, data, idx->length);
+    item->number = idx->number;
+    item->length = idx->length;
+    HASH_ADD(hh, cache->ht, number, sizeof(item->number), item);
+    cache->size += item->length;
+    return true;
+}
+
+ssize_t ZCK_PUBLIC_API zck_get_cache_hits(zckCtx *zck) {
+    VALIDATE_READ_INT(zck);
+
+    return zck->cache.hits;
+}
+
+ssize_t ZCK_PUBLIC_API zck_get_cache_misses(zckCtx *zck) {
+    VALIDATE_READ_INT(zck);
+
+    return zck->cache.misses;
+}
+
+void cache_clear(zckCtx *zck) {
+    if(zck == NULL)
+        return;
+
+    zckCacheItem *item = NULL;
+    zckCacheItem *tmp = NULL;
+    HASH_ITER(hh, zck->cache.ht, item, tmp)
+        cache_remove(&(zck->cache), item);
+    zck->cache.ht = NULL;
+    zck->cache.size = 0;
+}
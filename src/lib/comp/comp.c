@@ -71,10 +71,12 @@ static bool set_comp_type(zckCtx *zck, ssize_t type) {
     char *dc_data = comp->dc_data;
     size_t dc_data_loc = comp->dc_data_loc;
     size_t dc_data_size = comp->dc_data_size;
+    size_t dc_data_alloc = comp->dc_data_alloc;
     memset(comp, 0, sizeof(zckComp));
     comp->dc_data = dc_data;
     comp->dc_data_loc = dc_data_loc;
     comp->dc_data_size = dc_data_size;
+    comp->dc_data_alloc = dc_data_alloc;
 
     zck_log(ZCK_LOG_DEBUG, "Setting compression to %s",
             zck_comp_name_from_type(type));
@@ -109,40 +111,68 @@ static size_t comp_read_from_dc(zckCtx *zck, zckComp *comp, char *dst,
     return dl_size;
 }
 
+/* Make sure there's room for size more bytes at the end of buf, growing it
+ * if needed.  Buffers are only ever grown, so they can be reused from chunk
+ * to chunk without reallocating */
+static char *reserve(zckCtx *zck, char **buf, size_t *alloc, size_t used,
+                     size_t size) {
+    if(used + size < used) {
+        zck_log(ZCK_LOG_ERROR, "Integer overflow when reading data");
+        return NULL;
+    }
+    if(*buf == NULL)
+        *alloc = 0;
+    if(used + size > *alloc) {
+        size_t new_alloc = *alloc * 2;
+        if(new_alloc < used + size)
+            new_alloc = used + size;
+        *buf = zrealloc(*buf, new_alloc);
+        if (!*buf) {
+            zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            *alloc = 0;
+            return NULL;
+        }
+        *alloc = new_alloc;
+    }
+    return *buf + used;
+}
+
+static char *comp_reserve_data(zckCtx *zck, zckComp *comp, size_t size) {
+    return reserve(zck, &(comp->data), &(comp->data_alloc), comp->data_size,
+                   size);
+}
+
 static bool comp_add_to_data(zckCtx *zck, zckComp *comp, const char *src,
                              size_t src_size) {
     VALIDATE_BOOL(zck);
     ALLOCD_BOOL(zck, comp);
     ALLOCD_BOOL(zck, src);
 
-    if((comp->data_size > comp->data_size + src_size) ||
-       (src_size > comp->data_size + src_size)) {
-        zck_log(ZCK_LOG_ERROR, "Integer overflow when reading data");
+    char *dst = comp_reserve_data(zck, comp, src_size);
+    if(dst == NULL)
         return false;
-    }
-
-    comp->data = zrealloc(comp->data, comp->data_size + src_size);
-    if (!comp->data) {
-        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-        return false;
-    }
     zck_log(ZCK_LOG_DEBUG, "Adding %llu bytes to compressed buffer",
         (long long unsigned) src_size);
-    memcpy(comp->data + comp->data_size, src, src_size);
+    memcpy(dst, src, src_size);
     comp->data_size += src_size;
     comp->data_loc += src_size;
     return true;
 }
 
+/* Check the chunk that's just been decompressed and move on to the next */
+static bool comp_next_dchunk(zckCtx *zck) {
+    if(VERIFY_CHUNKS(zck) && validate_current_chunk(zck) < 1)
+        return false;
+    zck->comp.data_loc = 0;
+    zck->comp.data_idx = zck->comp.data_idx->next;
+    return hash_init(zck, &(zck->check_chunk_hash), &(zck->chunk_hash_type));
+}
+
 static ssize_t comp_end_dchunk(zckCtx *zck, bool use_dict, size_t fd_size) {
     VALIDATE_READ_INT(zck);
 
     ssize_t rb = zck->comp.end_dchunk(zck, &(zck->comp), use_dict, fd_size);
-    if(validate_current_chunk(zck) < 1)
-        return -1;
-    zck->comp.data_loc = 0;
-    zck->comp.data_idx = zck->comp.data_idx->next;
-    if(!hash_init(zck, &(zck->check_chunk_hash), &(zck->chunk_hash_type)))
+    if(!comp_next_dchunk(zck))
         return -1;
     return rb;
 }
@@ -164,13 +194,13 @@ static ssize_t comp_write(zckCtx *zck, const char *src, const size_t src_size) {
         free(dst);
         return -1;
     }
-    if(!index_add_to_chunk(zck, dst, dst_size, src_size)) {
+    if(!index_add_to_chunk(zck, &dst, dst_size, src_size)) {
         free(dst);
         return -1;
     }
-    if(zck->has_uncompressed_source && !hash_update(zck, &(zck->work_index_hash_uncomp), src, src_size))
-        return -1;
     free(dst);
+    if(zck->has_uncompressed_source && !index_add_uncompressed(zck, src, src_size))
+        return -1;
     return src_size;
 }
 
@@ -236,7 +266,7 @@ bool comp_init(zckCtx *zck) {
                 free(dst);
                 return false;
             }
-            if(!index_add_to_chunk(zck, dst, dst_size,
+            if(!index_add_to_chunk(zck, &dst, dst_size,
                                        zck->comp.dict_size)) {
                 free(dst);
                 return false;
@@ -252,7 +282,7 @@ bool comp_init(zckCtx *zck) {
                 free(dst);
                 return false;
             }
-            if(!index_add_to_chunk(zck, dst, dst_size, 0) ||
+            if(!index_add_to_chunk(zck, &dst, dst_size, 0) ||
                !index_finish_chunk(zck)) {
                 free(dst);
                 return false;
@@ -276,6 +306,7 @@ bool comp_reset(zckCtx *zck) {
         zck->comp.dc_data = NULL;
         zck->comp.dc_data_loc = 0;
         zck->comp.dc_data_size = 0;
+        zck->comp.dc_data_alloc = 0;
     }
     if(zck->comp.close == NULL)
         return true;
@@ -289,16 +320,42 @@ bool comp_reset_comp_data(zckCtx *zck) {
         free(zck->comp.data);
         zck->comp.data = NULL;
         zck->comp.data_size = 0;
+        zck->comp.data_alloc = 0;
         zck->comp.data_loc = 0;
         zck->comp.data_idx = NULL;
     }
     return true;
 }
 
+/* Throw away any partially read chunk while keeping the decompression
+ * contexts, dictionary and buffers, so they can be reused for the next
+ * chunk */
+static bool comp_reset_dchunk(zckCtx *zck) {
+    ALLOCD_BOOL(zck, zck);
+
+    if(!zck->comp.started)
+        return comp_init(zck);
+
+    prefetch_stop(zck);
+    zck->comp.data_size = 0;
+    zck->comp.data_loc = 0;
+    zck->comp.data_idx = NULL;
+    zck->comp.dc_data_size = 0;
+    zck->comp.dc_data_loc = 0;
+    zck->comp.data_eof = false;
+
+    /* Reading out of order makes the running data checksum meaningless, and
+     * it may already have been finalized by zck_close(), so restart it */
+    if(!hash_init(zck, &(zck->check_full_hash), &(zck->hash_type)))
+        return false;
+    return hash_init(zck, &(zck->check_chunk_hash), &(zck->chunk_hash_type));
+}
+
 bool comp_close(zckCtx *zck) {
     ALLOCD_BOOL(zck, zck);
 
     zck_log(ZCK_LOG_DEBUG, "Closing compression");
+    prefetch_stop(zck);
     comp_reset_comp_data(zck);
     if(zck->comp.dict)
         free(zck->comp.dict);
@@ -397,32 +454,38 @@ bool comp_soption(zckCtx *zck, zck_soption option, const void *value,
     return true;
 }
 
+/* Get rid of any already read data and return space for size more bytes at
+ * the end of the decompressed buffer.  The caller fills it and then adds size
+ * to dc_data_size */
+char *comp_reserve_dc(zckCtx *zck, zckComp *comp, size_t size) {
+    VALIDATE_PTR(zck);
+    ALLOCD_PTR(zck, comp);
+
+    if(comp->dc_data_loc != 0) {
+        zck_log(ZCK_LOG_DEBUG, "Freeing %llu bytes from decompressed buffer",
+                (long long unsigned) comp->dc_data_loc);
+        /* Normally everything has been read, so this rarely moves anything */
+        memmove(comp->dc_data, comp->dc_data + comp->dc_data_loc,
+                comp->dc_data_size - comp->dc_data_loc);
+        comp->dc_data_size -= comp->dc_data_loc;
+        comp->dc_data_loc = 0;
+    }
+    zck_log(ZCK_LOG_DEBUG, "Adding %llu bytes to decompressed buffer",
+            (long long unsigned) size);
+    return reserve(zck, &(comp->dc_data), &(comp->dc_data_alloc),
+                   comp->dc_data_size, size);
+}
+
 bool comp_add_to_dc(zckCtx *zck, zckComp *comp, const char *src,
                     size_t src_size) {
     VALIDATE_BOOL(zck);
     ALLOCD_BOOL(zck, comp);
     ALLOCD_BOOL(zck, src);
 
-    /* Get rid of any already read data and allocate space for new data */
-    char *temp = zmalloc(comp->dc_data_size - comp->dc_data_loc + src_size);
-    if (!temp) {
-        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+    char *dst = comp_reserve_dc(zck, comp, src_size);
+    if(dst == NULL)
         return false;
-    }
-    if(comp->dc_data_loc != 0)
-        zck_log(ZCK_LOG_DEBUG, "Freeing %llu bytes from decompressed buffer",
-                (long long unsigned) comp->dc_data_loc);
-    zck_log(ZCK_LOG_DEBUG, "Adding %llu bytes to decompressed buffer",
-            (long long unsigned) src_size);
-    memcpy(temp, comp->dc_data + comp->dc_data_loc,
-           comp->dc_data_size - comp->dc_data_loc);
-    free(comp->dc_data);
-    comp->dc_data_size -= comp->dc_data_loc;
-    comp->dc_data_loc = 0;
-    comp->dc_data = temp;
-
-    /* Copy new uncompressed data into comp */
-    memcpy(comp->dc_data + comp->dc_data_size, src, src_size);
+    memcpy(dst, src, src_size);
     comp->dc_data_size += src_size;
     return true;
 }
@@ -444,11 +507,6 @@ ssize_t comp_read(zckCtx *zck, char *dst, size_t dst_size, bool use_dict) {
         return -1;
 
     size_t dc = 0;
-    char *src = zmalloc(dst_size - dc);
-    if (!src) {
-        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-        return false;
-    }
     bool finished_rd = false;
     bool finished_dc = false;
     zck_log(ZCK_LOG_DEBUG, "Trying to read %llu bytes", (long long unsigned) dst_size);
@@ -487,25 +545,22 @@ ssize_t comp_read(zckCtx *zck, char *dst, size_t dst_size, bool use_dict) {
                           &(zck->chunk_hash_type)))
                 goto hash_error;
             if(zck->comp.data_loc > 0) {
-                if(!zck->has_uncompressed_source) {
+                if(HASH_DATA(zck)) {
                     if(!hash_update(zck, &(zck->check_full_hash), zck->comp.data,
                                     zck->comp.data_loc))
                         goto hash_error;
                 }
-                if(!hash_update(zck, &(zck->check_chunk_hash), zck->comp.data,
+                if(VERIFY_CHUNKS(zck) &&
+                   !hash_update(zck, &(zck->check_chunk_hash), zck->comp.data,
                                 zck->comp.data_loc))
                     goto hash_error;
             }
-            if(zck->comp.data_idx == NULL) {
-                free(src);
+            if(zck->comp.data_idx == NULL)
                 return 0;
-            }
         }
         if(zck->comp.data_loc == zck->comp.data_idx->comp_length) {
-            if(!comp_end_dchunk(zck, use_dict, zck->comp.data_idx->length)) {
-                free(src);
+            if(!comp_end_dchunk(zck, use_dict, zck->comp.data_idx->length))
                 return -1;
-            }
             if(zck->comp.data_idx == NULL)
                 zck->comp.data_eof = true;
             continue;
@@ -518,39 +573,62 @@ ssize_t comp_read(zckCtx *zck, char *dst, size_t dst_size, bool use_dict) {
             continue;
         }
 
-        /* Make sure we don't read beyond current chunk length */
-        size_t rs = dst_size;
-        if(zck->comp.data_loc + rs > zck->comp.data_idx->comp_length)
-            rs = zck->comp.data_idx->comp_length - zck->comp.data_loc;
-
-        /* Decompressed buffer is empty, so read data from file and fill
-         * compressed buffer */
-        rb = read_data(zck, src, rs);
+        /* Decompressed buffer is empty, so read the rest of the current
+         * chunk straight into the compressed buffer.  When reading from
+         * memory, a whole chunk is decompressed straight from the source
+         * instead */
+        size_t rs = zck->comp.data_idx->comp_length - zck->comp.data_loc;
+        char *buf = NULL;
+        if(!zck->src_buf) {
+            buf = comp_reserve_data(zck, &(zck->comp), rs);
+            if(buf == NULL)
+                return -1;
+        }
+        const char *data = NULL;
+        if(zck->comp.data_loc == 0)
+            prefetch_chunk(zck, zck->comp.data_idx);
+        rb = read_data_ptr(zck, &data, buf, rs);
         if(rb < 0)
             goto read_error;
         if(rb < rs) {
             zck_log(ZCK_LOG_DDEBUG, "EOF");
             finished_rd = true;
         }
-        if(zck->check_chunk_hash.ctx == NULL)
+        if(zck->check_chunk_hash.type == NULL)
             if(!hash_init(zck, &(zck->check_chunk_hash),
                           &(zck->chunk_hash_type)))
                 goto hash_error;
-        if(!zck->has_uncompressed_source) {
-            if(!hash_update(zck, &(zck->check_full_hash), src, rb))
+        if(HASH_DATA(zck)) {
+            if(!hash_update(zck, &(zck->check_full_hash), data, rb))
                 goto read_error;
         }
-        if(!hash_update(zck, &(zck->check_chunk_hash), src, rb) ||
-           !comp_add_to_data(zck, &(zck->comp), src, rb))
+        if(VERIFY_CHUNKS(zck) &&
+           !hash_update(zck, &(zck->check_chunk_hash), data, rb))
             goto read_error;
+        if(data != buf && rb == rs && zck->comp.data_loc == 0 &&
+           zck->comp.data_size == 0) {
+            size_t length = zck->comp.data_idx->length;
+            char *dst = comp_reserve_dc(zck, &(zck->comp), length);
+            if(dst == NULL ||
+               !zck->comp.decompress_chunk(zck, &(zck->comp), data, rb, dst,
+                                           length, use_dict))
+                goto read_error;
+            zck->comp.dc_data_size += length;
+            if(!comp_next_dchunk(zck))
+                return -1;
+            if(zck->comp.data_idx == NULL)
+                zck->comp.data_eof = true;
+        } else if(data == buf) {
+            zck->comp.data_size += rb;
+            zck->comp.data_loc += rb;
+        } else if(!comp_add_to_data(zck, &(zck->comp), data, rb)) {
+            goto read_error;
+        }
     }
-    free(src);
     return dc;
 read_error:
-    free(src);
     return -1;
 hash_error:
-    free(src);
     return -2;
 }
 
@@ -655,7 +733,7 @@ ssize_t ZCK_PUBLIC_API zck_end_chunk(zckCtx *zck) {
         free(dst);
         return -1;
     }
-    if(!index_add_to_chunk(zck, dst, dst_size, 0)) {
+    if(!index_add_to_chunk(zck, &dst, dst_size, 0)) {
         free(dst);
         return -1;
     }
@@ -672,16 +750,81 @@ ssize_t ZCK_PUBLIC_API zck_read(zckCtx *zck, char *dst, size_t dst_size) {
     VALIDATE_READ_INT(zck);
     ALLOCD_INT(zck, dst);
 
+    if(!index_load(zck) || !prefetch_start(zck))
+        return -1;
+    if(prefetch_decompressing(zck))
+        return prefetch_read(zck, dst, dst_size);
     return comp_read(zck, dst, dst_size, 1);
 }
 
-ssize_t ZCK_PUBLIC_API zck_get_chunk_comp_data(zckChunk *idx, char *dst,
-                                       size_t dst_size) {
-    zckCtx *zck = NULL;
-    if(idx && idx->zck) {
-        VALIDATE_INT(idx->zck);
-        zck = idx->zck;
+ssize_t ZCK_PUBLIC_API zck_pread(zckCtx *zck, void *buf, size_t len,
+                                 uint64_t uncompressed_offset) {
+    VALIDATE_READ_INT(zck);
+    ALLOCD_INT(zck, buf);
+
+    if(!index_load(zck))
+        return -1;
+    if(zck->index.dc_offset == NULL) {
+        set_error(zck, "Index hasn't been read yet");
+        return -1;
+    }
+    if(len == 0)
+        return 0;
+
+    zckChunk *idx = index_find_offset(&(zck->index), uncompressed_offset);
+    if(idx == NULL)
+        return 0;
+
+    char *tmp = NULL;
+    size_t tmp_size = 0;
+    size_t dc = 0;
+    size_t offset = uncompressed_offset -
+                    zck->index.dc_offset[idx->number];
+    for(; idx && dc < len; idx = idx->next, offset = 0) {
+        if(idx->length == 0)
+            continue;
+
+        size_t to_copy = idx->length - offset;
+        if(to_copy > len - dc)
+            to_copy = len - dc;
+
+        /* Decompress straight into buf if the whole chunk is wanted,
+         * otherwise decompress into a temporary buffer and copy the part
+         * that was requested */
+        if(offset == 0 && to_copy == idx->length) {
+            if(zck_get_chunk_data(idx, (char *)buf + dc,
+                                  idx->length) != idx->length)
+                goto error;
+        } else {
+            if(tmp_size < idx->length) {
+                tmp = zrealloc(tmp, idx->length);
+                if(!tmp) {
+                    zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+                    return -1;
+                }
+                tmp_size = idx->length;
+            }
+            if(zck_get_chunk_data(idx, tmp, idx->length) != idx->length)
+                goto error;
+            memcpy((char *)buf + dc, tmp + offset, to_copy);
+        }
+        dc += to_copy;
     }
+    free(tmp);
+    return dc;
+error:
+    if(!zck_is_error(zck))
+        set_error(zck, "Unable to read chunk %llu",
+                  (long long unsigned) idx->number);
+    free(tmp);
+    return -1;
+}
+
+/* Read compressed chunk idx using zck's file position, which may be a reader's
+ * private context rather than the one idx belongs to */
+ssize_t comp_get_chunk_comp_data(zckCtx *zck, zckChunk *idx, char *dst,
+                                 size_t dst_size) {
+    VALIDATE_INT(zck);
     ALLOCD_INT(zck, idx);
     ALLOCD_INT(zck, dst);
 
@@ -705,14 +848,82 @@ ssize_t ZCK_PUBLIC_API zck_get_chunk_comp_data(zckChunk *idx, char *dst,
     return read_data(zck, dst, dst_size);
 }
 
-ssize_t ZCK_PUBLIC_API zck_get_chunk_data(zckChunk *idx, char *dst,
-                                  size_t dst_size) {
+ssize_t ZCK_PUBLIC_API zck_get_chunk_comp_data(zckChunk *idx, char *dst,
+                                       size_t dst_size) {
     zckCtx *zck = NULL;
     if(idx && idx->zck) {
         VALIDATE_INT(idx->zck);
         zck = idx->zck;
     }
     ALLOCD_INT(zck, idx);
+
+    return comp_get_chunk_comp_data(zck, idx, dst, dst_size);
+}
+
+/* Make sure compression is initialized and the dictionary, if any, has been
+ * read */
+bool comp_load_dict(zckCtx *zck) {
+    VALIDATE_READ_BOOL(zck);
+
+    zckChunk *dict = zck_get_first_chunk(zck);
+    if(dict == NULL)
+        return false;
+    if(zck_get_chunk_size(dict) > 0 && zck->comp.dict == NULL) {
+        if(zck_get_chunk_start(dict) < 0)
+            return false;
+        if(!seek_data(zck, zck_get_chunk_start(dict), SEEK_SET))
+            return false;
+        if(!comp_reset(zck))
+            return false;
+        if(!comp_init(zck))
+            return false;
+        if(!import_dict(zck))
+            return false;
+    }
+    if(!zck->comp.started && !comp_init(zck))
+        return false;
+    return true;
+}
+
+/* Decompress chunk idx from its compressed data in src, validating it first
+ * if verify is set.  dst must have room for the whole decompressed chunk */
+ssize_t comp_decompress_chunk(zckCtx *zck, zckChunk *idx, const char *src,
+                              char *dst, bool verify) {
+    VALIDATE_READ_INT(zck);
+    ALLOCD_INT(zck, idx);
+
+    if(idx->comp_length == 0)
+        return 0;
+    if(!zck->comp.started && !comp_init(zck))
+        return -1;
+
+    if(verify) {
+        if(!hash_init(zck, &(zck->check_chunk_hash),
+                      &(zck->chunk_hash_type)) ||
+           !hash_update(zck, &(zck->check_chunk_hash), src, idx->comp_length))
+            return -1;
+        int valid = validate_chunk(zck, idx, ZCK_LOG_ERROR);
+        if(valid < 1) {
+            if(valid == -1)
+                set_error(zck, "Chunk %llu's checksum doesn't match",
+                          (long long unsigned) idx->number);
+            return -1;
+        }
+    }
+    /* The dictionary chunk itself is compressed without the dictionary */
+    if(!zck->comp.decompress_chunk(zck, &(zck->comp), src, idx->comp_length,
+                                   dst, idx->length,
+                                   idx != zck->index.first))
+        return -1;
+    return idx->length;
+}
+
+/* Decompress chunk idx using zck's compression state, which may be a reader's
+ * private context rather than the one idx belongs to */
+ssize_t comp_get_chunk_data(zckCtx *zck, zckChunk *idx, char *dst,
+                            size_t dst_size) {
+    VALIDATE_INT(zck);
+    ALLOCD_INT(zck, idx);
     ALLOCD_INT(zck, dst);
 
     /* Make sure chunk size is valid */
@@ -725,32 +936,38 @@ ssize_t ZCK_PUBLIC_API zck_get_chunk_data(zckChunk *idx, char *dst,
     if(zck_get_chunk_start(idx) < 0)
         return -1;
 
+    /* Use cached copy of chunk if we have one */
+    bool use_cache = zck->cache.max_size > 0 && dst_size >= idx->length;
+    if(use_cache) {
+        ssize_t cached = cache_get(zck, idx, dst, dst_size);
+        if(cached != 0)
+            return cached;
+    }
+
     /* Read dictionary if needed */
-    zckChunk *dict = zck_get_first_chunk(zck);
-    if(dict == NULL)
+    if(!comp_load_dict(zck))
         return -1;
-    if(zck_get_chunk_size(dict) > 0 && zck->comp.dict == NULL) {
-        if(zck_get_chunk_start(dict) < 0)
-            return -1;
-        if(!seek_data(zck, zck_get_chunk_start(dict), SEEK_SET))
-            return -1;
-        if(!comp_reset(zck))
-            return -1;
-        if(!comp_init(zck))
-            return -1;
-        if(!import_dict(zck))
-            return -1;
-    }
 
     /* Seek to beginning of requested chunk */
-    if(!comp_reset_comp_data(zck))
-        return -1;
-    if(!comp_reset(zck))
-        return -1;
-    if(!comp_init(zck))
+    if(!comp_reset_dchunk(zck))
         return -1;
     if(!seek_data(zck, zck_get_chunk_start(idx), SEEK_SET))
         return -1;
     zck->comp.data_idx = idx;
-    return comp_read(zck, dst, dst_size, 1);
+    ssize_t rb = comp_read(zck, dst, dst_size, 1);
+    if(use_cache && rb == (ssize_t)idx->length && !cache_add(zck, idx, dst))
+        return -1;
+    return rb;
+}
+
+ssize_t ZCK_PUBLIC_API zck_get_chunk_data(zckChunk *idx, char *dst,
+                                  size_t dst_size) {
+    zckCtx *zck = NULL;
+    if(idx && idx->zck) {
+        VALIDATE_INT(idx->zck);
+        zck = idx->zck;
+    }
+    ALLOCD_INT(zck, idx);
+
+    return comp_get_chunk_data(zck, idx, dst, dst_size);
 }
@@ -77,16 +77,9 @@ static bool decompress(zckCtx *zck, zckComp *comp, const bool use_dict) {
     VALIDATE_BOOL(zck);
     ALLOCD_BOOL(zck, comp);
 
-    char *src = comp->data;
     size_t src_size = comp->data_size;
-    comp->data = NULL;
     comp->data_size = 0;
-    if(!comp_add_to_dc(zck, comp, src, src_size)) {
-        free(src);
-        return false;
-    }
-    free(src);
-    return true;
+    return comp_add_to_dc(zck, comp, comp->data, src_size);
 }
 
 static bool end_dchunk(zckCtx *zck, zckComp *comp, const bool use_dict,
@@ -97,6 +90,22 @@ static bool end_dchunk(zckCtx *zck, zckComp *comp, const bool use_dict,
     return true;
 }
 
+static bool decompress_chunk(zckCtx *zck, zckComp *comp, const char *src,
+                             size_t src_size, char *dst, size_t dst_size,
+                             const bool use_dict) {
+    VALIDATE_BOOL(zck);
+    ALLOCD_BOOL(zck, comp);
+
+    if(src_size != dst_size) {
+        set_error(zck, "Uncompressed chunk has %llu bytes, expected %llu",
+                  (long long unsigned) src_size,
+                  (long long unsigned) dst_size);
+        return false;
+    }
+    memcpy(dst, src, src_size);
+    return true;
+}
+
 static bool close_zck_component(zckCtx *zck, zckComp *comp) {
     ALLOCD_BOOL(zck, zck);
     ALLOCD_BOOL(zck, comp);
@@ -130,6 +139,7 @@ bool nocomp_setup(zckCtx *zck, zckComp *comp) {
     comp->end_cchunk = end_cchunk;
     comp->decompress = decompress;
     comp->end_dchunk = end_dchunk;
+    comp->decompress_chunk = decompress_chunk;
     comp->close = close_zck_component;
     comp->type = ZCK_COMP_NONE;
     return set_default_parameters(zck, comp);
@@ -37,6 +37,24 @@ static bool init(zckCtx *zck, zckComp *comp) {
     VALIDATE_BOOL(zck);
     ALLOCD_BOOL(zck, comp);
 
+    /* Only create the contexts needed for the mode we're in */
+    if(zck->mode == ZCK_MODE_READ) {
+        comp->dctx = ZSTD_createDCtx();
+        if(comp->dctx == NULL) {
+            set_fatal_error(zck, "Unable to create zstd decompression context");
+            return false;
+        }
+        if(comp->dict && comp->dict_size > 0) {
+            comp->ddict_ctx = ZSTD_createDDict(comp->dict, comp->dict_size);
+            if(comp->ddict_ctx == NULL) {
+                set_fatal_error(zck,
+                                "Unable to create zstd decompression dict context");
+                return false;
+            }
+        }
+        return true;
+    }
+
 #ifndef OLD_ZSTD
     size_t retval = 0;
 #endif
@@ -56,7 +74,6 @@ static bool init(zckCtx *zck, zckComp *comp) {
         return false;
     }
 #endif //OLD_ZSTD
-    comp->dctx = ZSTD_createDCtx();
     if(comp->dict && comp->dict_size > 0) {
 #ifdef OLD_ZSTD
         comp->cdict_ctx = ZSTD_createCDict(comp->dict, comp->dict_size,
@@ -72,12 +89,6 @@ static bool init(zckCtx *zck, zckComp *comp) {
             return false;
         }
 #endif //OLD_ZSTD
-        comp->ddict_ctx = ZSTD_createDDict(comp->dict, comp->dict_size);
-        if(comp->ddict_ctx == NULL) {
-            set_fatal_error(zck,
-                            "Unable to create zstd decompression dict context");
-            return false;
-        }
     }
     return true;
 }
@@ -213,16 +224,15 @@ static bool end_dchunk(zckCtx *zck, zckComp *comp, const bool use_dict,
     VALIDATE_BOOL(zck);
     ALLOCD_BOOL(zck, comp);
 
+    /* Decompress straight from the compressed buffer into the decompressed
+     * buffer, keeping both allocations for the next chunk */
     char *src = comp->data;
     size_t src_size = comp->data_size;
-    comp->data = NULL;
     comp->data_size = 0;
 
-    char *dst = zmalloc(fd_size);
-    if (!dst) {
-        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+    char *dst = comp_reserve_dc(zck, comp, fd_size);
+    if(dst == NULL)
         return false;
-    }
     size_t retval = 0;
     zck_log(ZCK_LOG_DEBUG, "Decompressing %llu bytes to %llu bytes",
             (long long unsigned) src_size,
@@ -240,17 +250,37 @@ static bool end_dchunk(zckCtx *zck, zckComp *comp, const bool use_dict,
     if(ZSTD_isError(retval)) {
         set_fatal_error(zck, "zstd decompression error: %s",
                         ZSTD_getErrorName(retval));
-        goto decomp_error_2;
+        return false;
+    }
+    comp->dc_data_size += fd_size;
+    return true;
+}
+
+static bool decompress_chunk(zckCtx *zck, zckComp *comp, const char *src,
+                             size_t src_size, char *dst, size_t dst_size,
+                             const bool use_dict) {
+    VALIDATE_BOOL(zck);
+    ALLOCD_BOOL(zck, comp);
+
+    size_t retval = 0;
+    if(use_dict && comp->ddict_ctx)
+        retval = ZSTD_decompress_usingDDict(comp->dctx, dst, dst_size, src,
+                                            src_size, comp->ddict_ctx);
+    else
+        retval = ZSTD_decompressDCtx(comp->dctx, dst, dst_size, src,
+                                     src_size);
+    if(ZSTD_isError(retval)) {
+        set_fatal_error(zck, "zstd decompression error: %s",
+                        ZSTD_getErrorName(retval));
+        return false;
+    }
+    if(retval != dst_size) {
+        set_fatal_error(zck, "Decompressed chunk has %llu bytes, expected %llu",
+                        (long long unsigned) retval,
+                        (long long unsigned) dst_size);
+        return false;
     }
-    if(!comp_add_to_dc(zck, comp, dst, fd_size))
-        goto decomp_error_2;
-    free(dst);
-    free(src);
     return true;
-decomp_error_2:
-    free(dst);
-    free(src);
-    return false;
 }
 
 static bool set_parameter(zckCtx *zck, zckComp *comp, int option,
@@ -284,6 +314,7 @@ bool zstd_setup(zckCtx *zck, zckComp *comp) {
     comp->end_cchunk = end_cchunk;
     comp->decompress = decompress;
     comp->end_dchunk = end_dchunk;
+    comp->decompress_chunk = decompress_chunk;
     comp->close = close_zck_component;
     comp->type = ZCK_COMP_ZSTD;
     return set_default_parameters(zck, comp);
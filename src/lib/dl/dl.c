@@ -35,6 +35,11 @@
 
 #include "zck_private.h"
 
+/* Small chunks are copied in batches of up to this many chunks and this much
+ * data */
+#define COPY_BATCH_CHUNKS 256
+#define COPY_BATCH_SIZE 1048576
+
 /* Free zckDL header regex used for downloading ranges */
 static void clear_dl_regex(zckDL *dl) {
     if(dl == NULL)
@@ -79,15 +84,17 @@ static bool set_chunk_valid(zckDL *dl) {
     ALLOCD_BOOL(NULL, dl);
     VALIDATE_BOOL(dl->zck);
 
-    int retval = validate_chunk(dl->tgt_check, ZCK_LOG_WARNING);
+    int retval = validate_chunk(dl->zck, dl->tgt_check, ZCK_LOG_WARNING);
     if(retval < 1) {
         if(!zero_chunk(dl->zck, dl->tgt_check))
             return false;
         dl->tgt_check->valid = -1;
+        journal_mark(dl->zck, dl->tgt_check);
         return false;
     } else {
         dl->tgt_check->valid = 1;
     }
+    journal_mark(dl->zck, dl->tgt_check);
     dl->tgt_check = NULL;
     return true;
 }
@@ -114,6 +121,16 @@ static int dl_write(zckDL *dl, const char *at, size_t length) {
     return wb;
 }
 
+static void log_corrupt_chunk(zckChunk *src_idx, const char *digest) {
+    char *pdigest = zck_get_chunk_digest(src_idx);
+    zck_log(ZCK_LOG_INFO, "Corrupted chunk found in file, will redownload");
+    zck_log(ZCK_LOG_INFO, "Source hash: %s", pdigest);
+    free(pdigest);
+    pdigest = get_digest_string(digest, src_idx->digest_size);
+    zck_log(ZCK_LOG_INFO, "Target hash: %s", pdigest);
+    free(pdigest);
+}
+
 /* Copy chunk identified by src_idx into location specified by tgt_idx */
 static bool write_and_verify_chunk(zckCtx *src, zckCtx *tgt,
                                    zckChunk *src_idx,
@@ -135,7 +152,7 @@ static bool write_and_verify_chunk(zckCtx *src, zckCtx *tgt,
         int rb = BUF_SIZE;
         if(rb > to_read)
             rb = to_read;
-        if(!read_data(src, buf, rb))
+        if(read_data(src, buf, rb) != rb)
             return false;
         if(!hash_update(tgt, &check_hash, buf, rb))
             return false;
@@ -143,16 +160,14 @@ static bool write_and_verify_chunk(zckCtx *src, zckCtx *tgt,
             return false;
         to_read -= rb;
     }
-    char *digest = hash_finalize(tgt, &check_hash);
+    char digest[MAX_DIGEST_SIZE];
+    bool hashed = hash_final(tgt, &check_hash, digest);
+    hash_close(&check_hash);
+    if(!hashed)
+        return false;
     /* If chunk is invalid, overwrite with zeros and add to download range */
     if(memcmp(digest, src_idx->digest, src_idx->digest_size) != 0) {
-        char *pdigest = zck_get_chunk_digest(src_idx);
-        zck_log(ZCK_LOG_INFO, "Corrupted chunk found in file, will redownload");
-        zck_log(ZCK_LOG_INFO, "Source hash: %s", pdigest);
-        free(pdigest);
-        pdigest = get_digest_string(digest, src_idx->digest_size);
-        zck_log(ZCK_LOG_INFO, "Target hash: %s", pdigest);
-        free(pdigest);
+        log_corrupt_chunk(src_idx, digest);
         if(!zero_chunk(tgt, tgt_idx))
             return false;
         tgt_idx->valid = -1;
@@ -163,10 +178,73 @@ static bool write_and_verify_chunk(zckCtx *src, zckCtx *tgt,
                 (long long unsigned) tgt_idx->start
         );
     }
-    free(digest);
+    journal_mark(tgt, tgt_idx);
     return true;
 }
 
+/* Copy a batch of small chunks, reading them all first so they can be
+ * hashed together.  done is set to the number of chunks dealt with, so the
+ * caller can carry on with the rest if this fails */
+static bool write_and_verify_batch(zckCtx *src, zckCtx *tgt, char *buf,
+                                   zckChunk **src_idx, zckChunk **tgt_idx,
+                                   size_t count, size_t *done) {
+    bool ret = false;
+    int digest_size = src->chunk_hash_type.digest_size;
+    *done = 0;
+    const char **ptrs = zmalloc(count * sizeof(char *));
+    size_t *sizes = zmalloc(count * sizeof(size_t));
+    char *digests = zmalloc(count * digest_size);
+    if(!ptrs || !sizes || !digests) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        goto end;
+    }
+
+    size_t loc = 0;
+    for(size_t i=0; i<count; i++) {
+        if(!seek_data(src, src->data_offset + src_idx[i]->start, SEEK_SET))
+            goto end;
+        ptrs[i] = buf + loc;
+        sizes[i] = src_idx[i]->comp_length;
+        if(sizes[i] > 0 && read_data(src, buf + loc, sizes[i]) != sizes[i])
+            goto end;
+        loc += sizes[i];
+    }
+    if(!hash_many(tgt, &(src->chunk_hash_type), ptrs, sizes, count, digests))
+        goto end;
+
+    for(size_t i=0; i<count; i++) {
+        char *digest = digests + i * digest_size;
+        /* If chunk is invalid, zero it and add to download range */
+        if(memcmp(digest, src_idx[i]->digest, src_idx[i]->digest_size) != 0) {
+            log_corrupt_chunk(src_idx[i], digest);
+            if(!zero_chunk(tgt, tgt_idx[i]))
+                goto end;
+            tgt_idx[i]->valid = -1;
+            journal_mark(tgt, tgt_idx[i]);
+            *done = i + 1;
+            continue;
+        }
+        if(!seek_data(tgt, tgt->data_offset + tgt_idx[i]->start, SEEK_SET))
+            goto end;
+        if(sizes[i] > 0 && !write_data(tgt, tgt->fd, ptrs[i], sizes[i]))
+            goto end;
+        tgt_idx[i]->valid = 1;
+        journal_mark(tgt, tgt_idx[i]);
+        zck_log(ZCK_LOG_DEBUG, "Wrote %llu bytes at %llu",
+                (long long unsigned) tgt_idx[i]->comp_length,
+                (long long unsigned) tgt_idx[i]->start
+        );
+        *done = i + 1;
+    }
+    ret = true;
+
+end:
+    free(ptrs);
+    free(sizes);
+    free(digests);
+    return ret;
+}
+
 /* Split current read into the appropriate chunks and write appropriately */
 int dl_write_range(zckDL *dl, const char *at, size_t length) {
     ALLOCD_BOOL(NULL, dl);
@@ -181,6 +259,8 @@ int dl_write_range(zckDL *dl, const char *at, size_t length) {
         set_error(dl->zck, "zckDL index not initialized");
         return 0;
     }
+    if(!index_load(dl->zck))
+        return 0;
     if(dl->zck->index.first == NULL) {
         set_error(dl->zck, "zckCtx index not initialized");
         return 0;
@@ -236,24 +316,61 @@ int dl_write_range(zckDL *dl, const char *at, size_t length) {
 bool ZCK_PUBLIC_API zck_copy_chunks(zckCtx *src, zckCtx *tgt) {
     VALIDATE_READ_BOOL(src);
     VALIDATE_READ_BOOL(tgt);
+    if(!index_load(tgt) || !index_load_hashdb(src))
+        return false;
 
     zckIndex *tgt_info = &(tgt->index);
     zckIndex *src_info = &(src->index);
+    zckChunk *src_batch[COPY_BATCH_CHUNKS] = {NULL};
+    zckChunk *tgt_batch[COPY_BATCH_CHUNKS] = {NULL};
+    size_t batch_count = 0;
+    size_t batch_size = 0;
+    char *buf = NULL;
     zckChunk *tgt_idx = tgt_info->first;
-    while(tgt_idx) {
+    while(tgt_idx || batch_count > 0) {
+        zckChunk *f = NULL;
+
         /* No need to copy already valid chunk */
-        if(tgt_idx->valid == 1) {
-            tgt_idx = tgt_idx->next;
+        if(tgt_idx && tgt_idx->valid != 1)
+            HASH_FIND(hh, src_info->ht, tgt_idx->digest, tgt_idx->digest_size,
+                      f);
+        if(f && (f->length != tgt_idx->length ||
+                 f->comp_length != tgt_idx->comp_length))
+            f = NULL;
+
+        /* Copy the batch once it's full, or there's nothing left to add */
+        if(batch_count > 0 &&
+           (tgt_idx == NULL || batch_count == COPY_BATCH_CHUNKS ||
+            (f && batch_size + f->comp_length > COPY_BATCH_SIZE))) {
+            if(buf == NULL)
+                buf = zmalloc(COPY_BATCH_SIZE);
+            if(buf == NULL) {
+                zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+                return false;
+            }
+            size_t done = 0;
+            /* If the batch fails partway, copy what's left one chunk at a
+             * time, so one bad read doesn't lose the whole batch */
+            if(!write_and_verify_batch(src, tgt, buf, src_batch, tgt_batch,
+                                       batch_count, &done))
+                for(size_t i=done; i<batch_count; i++)
+                    write_and_verify_chunk(src, tgt, src_batch[i],
+                                           tgt_batch[i]);
+            batch_count = 0;
+            batch_size = 0;
             continue;
         }
-        zckChunk *f = NULL;
 
-        HASH_FIND(hh, src_info->ht, tgt_idx->digest, tgt_idx->digest_size, f);
-        if(f && f->length == tgt_idx->length &&
-           f->comp_length == tgt_idx->comp_length)
+        if(f && f->comp_length <= COPY_BATCH_SIZE / 4) {
+            src_batch[batch_count] = f;
+            tgt_batch[batch_count++] = tgt_idx;
+            batch_size += f->comp_length;
+        } else if(f) {
             write_and_verify_chunk(src, tgt, f, tgt_idx);
+        }
         tgt_idx = tgt_idx->next;
     }
+    free(buf);
     return true;
 }
 
@@ -261,6 +378,8 @@ bool ZCK_PUBLIC_API zck_find_matching_chunks(zckCtx *src, zckCtx *tgt) {
 
     if (!src || !tgt)
         return false;
+    if(!index_load(tgt) || !index_load_hashdb(src))
+        return false;
 
     zckIndex *src_info = &(src->index);
     zckIndex *tgt_info = &(tgt->index);
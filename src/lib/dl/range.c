@@ -192,6 +192,8 @@ char ZCK_PUBLIC_API *zck_get_range_char(zckCtx *zck, zckRange *range) {
 
 zckRange ZCK_PUBLIC_API *zck_get_missing_range(zckCtx *zck, int max_ranges) {
     VALIDATE_PTR(zck);
+    if(!index_load(zck))
+        return NULL;
 
     zckRange *range = zmalloc(sizeof(zckRange));
     if (!range) {
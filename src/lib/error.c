@@ -80,6 +80,27 @@ void set_error_wf(zckCtx *zck, int fatal, const char *function,
 
 }
 
+/* Copy src's error to zck without logging it a second time.  Used to hand
+ * errors from readers working on other threads back to their parent */
+void copy_error(zckCtx *zck, zckCtx *src) {
+    if(zck == NULL || src == NULL || src->error_state == 0)
+        return;
+
+    char *msg = NULL;
+    if(src->msg) {
+        msg = zmalloc(strlen(src->msg) + 1);
+        if (!msg) {
+           zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        } else {
+            strcpy(msg, src->msg);
+        }
+    }
+    free(zck->msg);
+    zck->msg = msg;
+    if(src->error_state > zck->error_state)
+        zck->error_state = src->error_state;
+}
+
 int ZCK_PUBLIC_API zck_is_error(zckCtx *zck) {
     if(zck == NULL)
         return 0;
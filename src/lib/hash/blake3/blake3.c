@@ -0,0 +1,700 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* BLAKE3, following the reference implementation's tree layout.  Runs of
+ * whole chunks, and of parent nodes, are compressed several at a time by
+ * hash_many(), which uses SSE2 to work on four of them at once where it's
+ * available */
+
+#include <stdbool.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "blake3.h"
+
+#define CHUNK_START 1
+#define CHUNK_END   2
+#define PARENT      4
+#define ROOT        8
+
+#ifdef __SSE2__
+#define MAX_SIMD_DEGREE 4
+#else
+#define MAX_SIMD_DEGREE 1
+#endif
+#define MAX_SIMD_DEGREE_OR_2 (MAX_SIMD_DEGREE > 2 ? MAX_SIMD_DEGREE : 2)
+
+static const uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+typedef struct output {
+    uint32_t input_cv[8];
+    uint64_t counter;
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint8_t block_len;
+    uint8_t flags;
+} output;
+
+static uint32_t load32(const void *src) {
+    const uint8_t *p = src;
+    return ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store32(void *dst, uint32_t w) {
+    uint8_t *p = dst;
+    p[0] = w;
+    p[1] = w >> 8;
+    p[2] = w >> 16;
+    p[3] = w >> 24;
+}
+
+static void store_cv_words(uint8_t *bytes, const uint32_t cv[8]) {
+    for(int i=0; i<8; i++)
+        store32(bytes + 4*i, cv[i]);
+}
+
+static uint32_t rotr32(uint32_t w, uint32_t c) {
+    return (w >> c) | (w << (32 - c));
+}
+
+static size_t round_down_to_power_of_2(uint64_t x) {
+    uint64_t p = 1;
+    while(p <= x / 2)
+        p *= 2;
+    return p;
+}
+
+static unsigned int popcnt(uint64_t x) {
+    unsigned int count = 0;
+    for(; x; x &= x - 1)
+        count++;
+    return count;
+}
+
+/***** Portable compression function *****/
+
+static void g(uint32_t *state, size_t a, size_t b, size_t c, size_t d,
+              uint32_t x, uint32_t y) {
+    state[a] = state[a] + state[b] + x;
+    state[d] = rotr32(state[d] ^ state[a], 16);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 12);
+    state[a] = state[a] + state[b] + y;
+    state[d] = rotr32(state[d] ^ state[a], 8);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 7);
+}
+
+static void round_fn(uint32_t state[16], const uint32_t *msg, size_t round) {
+    const uint8_t *s = MSG_SCHEDULE[round];
+
+    g(state, 0, 4, 8, 12, msg[s[0]], msg[s[1]]);
+    g(state, 1, 5, 9, 13, msg[s[2]], msg[s[3]]);
+    g(state, 2, 6, 10, 14, msg[s[4]], msg[s[5]]);
+    g(state, 3, 7, 11, 15, msg[s[6]], msg[s[7]]);
+    g(state, 0, 5, 10, 15, msg[s[8]], msg[s[9]]);
+    g(state, 1, 6, 11, 12, msg[s[10]], msg[s[11]]);
+    g(state, 2, 7, 8, 13, msg[s[12]], msg[s[13]]);
+    g(state, 3, 4, 9, 14, msg[s[14]], msg[s[15]]);
+}
+
+static void compress_pre(uint32_t state[16], const uint32_t cv[8],
+                         const uint8_t block[BLAKE3_BLOCK_LEN],
+                         uint8_t block_len, uint64_t counter, uint8_t flags) {
+    uint32_t block_words[16];
+    for(int i=0; i<16; i++)
+        block_words[i] = load32(block + 4*i);
+
+    for(int i=0; i<8; i++)
+        state[i] = cv[i];
+    for(int i=0; i<4; i++)
+        state[i+8] = IV[i];
+    state[12] = (uint32_t)counter;
+    state[13] = (uint32_t)(counter >> 32);
+    state[14] = block_len;
+    state[15] = flags;
+
+    for(size_t r=0; r<7; r++)
+        round_fn(state, block_words, r);
+}
+
+static void compress_in_place(uint32_t cv[8],
+                              const uint8_t block[BLAKE3_BLOCK_LEN],
+                              uint8_t block_len, uint64_t counter,
+                              uint8_t flags) {
+    uint32_t state[16];
+    compress_pre(state, cv, block, block_len, counter, flags);
+    for(int i=0; i<8; i++)
+        cv[i] = state[i] ^ state[i+8];
+}
+
+static void compress_xof(const uint32_t cv[8],
+                         const uint8_t block[BLAKE3_BLOCK_LEN],
+                         uint8_t block_len, uint64_t counter, uint8_t flags,
+                         uint8_t out[64]) {
+    uint32_t state[16];
+    compress_pre(state, cv, block, block_len, counter, flags);
+    for(int i=0; i<8; i++) {
+        store32(out + 4*i, state[i] ^ state[i+8]);
+        store32(out + 4*(i+8), state[i+8] ^ cv[i]);
+    }
+}
+
+static void hash_one(const uint8_t *input, size_t blocks, const uint32_t key[8],
+                     uint64_t counter, uint8_t flags, uint8_t flags_start,
+                     uint8_t flags_end, uint8_t out[BLAKE3_OUT_LEN]) {
+    uint32_t cv[8];
+    memcpy(cv, key, BLAKE3_OUT_LEN);
+    uint8_t block_flags = flags | flags_start;
+    while(blocks > 0) {
+        if(blocks == 1)
+            block_flags |= flags_end;
+        compress_in_place(cv, input, BLAKE3_BLOCK_LEN, counter, block_flags);
+        input += BLAKE3_BLOCK_LEN;
+        blocks--;
+        block_flags = flags;
+    }
+    store_cv_words(out, cv);
+}
+
+/***** SSE2 compression of four inputs at once *****/
+
+#ifdef __SSE2__
+static __m128i rot4(__m128i x, int c) {
+    if(c == 16)
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1);
+    return _mm_or_si128(_mm_srli_epi32(x, c), _mm_slli_epi32(x, 32 - c));
+}
+
+/* Load the same block from four inputs, transposing it so each vector holds
+ * one message word from every input */
+static void load_transposed(const uint8_t *const *inputs, size_t offset,
+                            __m128i m[16]) {
+    for(int q=0; q<4; q++) {
+        size_t o = offset + 16*q;
+        __m128i a = _mm_loadu_si128((const __m128i *)(inputs[0] + o));
+        __m128i b = _mm_loadu_si128((const __m128i *)(inputs[1] + o));
+        __m128i c = _mm_loadu_si128((const __m128i *)(inputs[2] + o));
+        __m128i d = _mm_loadu_si128((const __m128i *)(inputs[3] + o));
+        __m128i ab_lo = _mm_unpacklo_epi32(a, b);
+        __m128i cd_lo = _mm_unpacklo_epi32(c, d);
+        __m128i ab_hi = _mm_unpackhi_epi32(a, b);
+        __m128i cd_hi = _mm_unpackhi_epi32(c, d);
+        m[4*q] = _mm_unpacklo_epi64(ab_lo, cd_lo);
+        m[4*q+1] = _mm_unpackhi_epi64(ab_lo, cd_lo);
+        m[4*q+2] = _mm_unpacklo_epi64(ab_hi, cd_hi);
+        m[4*q+3] = _mm_unpackhi_epi64(ab_hi, cd_hi);
+    }
+}
+
+static void g4(__m128i *v, int a, int b, int c, int d, __m128i x, __m128i y) {
+    v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), x);
+    v[d] = rot4(_mm_xor_si128(v[d], v[a]), 16);
+    v[c] = _mm_add_epi32(v[c], v[d]);
+    v[b] = rot4(_mm_xor_si128(v[b], v[c]), 12);
+    v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), y);
+    v[d] = rot4(_mm_xor_si128(v[d], v[a]), 8);
+    v[c] = _mm_add_epi32(v[c], v[d]);
+    v[b] = rot4(_mm_xor_si128(v[b], v[c]), 7);
+}
+
+/* Each vector holds the same state word for four inputs */
+static void hash4_sse2(const uint8_t *const *inputs, size_t blocks,
+                       const uint32_t key[8], uint64_t counter,
+                       bool increment_counter, uint8_t flags,
+                       uint8_t flags_start, uint8_t flags_end, uint8_t *out) {
+    __m128i h[8];
+    for(int i=0; i<8; i++)
+        h[i] = _mm_set1_epi32(key[i]);
+
+    uint64_t counters[4];
+    for(int i=0; i<4; i++)
+        counters[i] = counter + (increment_counter ? i : 0);
+    __m128i counter_low = _mm_set_epi32(
+        (uint32_t)counters[3], (uint32_t)counters[2],
+        (uint32_t)counters[1], (uint32_t)counters[0]);
+    __m128i counter_high = _mm_set_epi32(
+        (uint32_t)(counters[3] >> 32), (uint32_t)(counters[2] >> 32),
+        (uint32_t)(counters[1] >> 32), (uint32_t)(counters[0] >> 32));
+
+    uint8_t block_flags = flags | flags_start;
+    for(size_t block=0; block<blocks; block++) {
+        if(block + 1 == blocks)
+            block_flags |= flags_end;
+
+        __m128i m[16];
+        load_transposed(inputs, block * BLAKE3_BLOCK_LEN, m);
+
+        __m128i v[16];
+        for(int i=0; i<8; i++)
+            v[i] = h[i];
+        for(int i=0; i<4; i++)
+            v[i+8] = _mm_set1_epi32(IV[i]);
+        v[12] = counter_low;
+        v[13] = counter_high;
+        v[14] = _mm_set1_epi32(BLAKE3_BLOCK_LEN);
+        v[15] = _mm_set1_epi32(block_flags);
+
+        for(int r=0; r<7; r++) {
+            const uint8_t *s = MSG_SCHEDULE[r];
+            g4(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            g4(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            g4(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            g4(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            g4(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            g4(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            g4(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            g4(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+        for(int i=0; i<8; i++)
+            h[i] = _mm_xor_si128(v[i], v[i+8]);
+        block_flags = flags;
+    }
+
+    uint32_t words[8][4];
+    for(int i=0; i<8; i++)
+        _mm_storeu_si128((__m128i *)words[i], h[i]);
+    for(int lane=0; lane<4; lane++)
+        for(int i=0; i<8; i++)
+            store32(out + lane * BLAKE3_OUT_LEN + 4*i, words[i][lane]);
+}
+#endif
+
+/* Hash num_inputs inputs of the same number of blocks, writing one chaining
+ * value for each to out */
+static void hash_many(const uint8_t *const *inputs, size_t num_inputs,
+                      size_t blocks, const uint32_t key[8], uint64_t counter,
+                      bool increment_counter, uint8_t flags,
+                      uint8_t flags_start, uint8_t flags_end, uint8_t *out) {
+#ifdef __SSE2__
+    while(num_inputs >= 4) {
+        hash4_sse2(inputs, blocks, key, counter, increment_counter, flags,
+                   flags_start, flags_end, out);
+        if(increment_counter)
+            counter += 4;
+        inputs += 4;
+        num_inputs -= 4;
+        out += 4 * BLAKE3_OUT_LEN;
+    }
+#endif
+    while(num_inputs > 0) {
+        hash_one(inputs[0], blocks, key, counter, flags, flags_start,
+                 flags_end, out);
+        if(increment_counter)
+            counter++;
+        inputs++;
+        num_inputs--;
+        out += BLAKE3_OUT_LEN;
+    }
+}
+
+/***** Chunks and outputs *****/
+
+static void chunk_state_init(blake3_chunk_state *self, const uint32_t key[8],
+                             uint8_t flags) {
+    memcpy(self->cv, key, BLAKE3_OUT_LEN);
+    self->chunk_counter = 0;
+    memset(self->buf, 0, BLAKE3_BLOCK_LEN);
+    self->buf_len = 0;
+    self->blocks_compressed = 0;
+    self->flags = flags;
+}
+
+static void chunk_state_reset(blake3_chunk_state *self, const uint32_t key[8],
+                              uint64_t chunk_counter) {
+    memcpy(self->cv, key, BLAKE3_OUT_LEN);
+    self->chunk_counter = chunk_counter;
+    self->blocks_compressed = 0;
+    memset(self->buf, 0, BLAKE3_BLOCK_LEN);
+    self->buf_len = 0;
+}
+
+static size_t chunk_state_len(const blake3_chunk_state *self) {
+    return (BLAKE3_BLOCK_LEN * (size_t)self->blocks_compressed) +
+           ((size_t)self->buf_len);
+}
+
+static size_t chunk_state_fill_buf(blake3_chunk_state *self,
+                                   const uint8_t *input, size_t input_len) {
+    size_t take = BLAKE3_BLOCK_LEN - ((size_t)self->buf_len);
+    if(take > input_len)
+        take = input_len;
+    memcpy(self->buf + self->buf_len, input, take);
+    self->buf_len += (uint8_t)take;
+    return take;
+}
+
+static uint8_t chunk_state_maybe_start_flag(const blake3_chunk_state *self) {
+    return self->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+static void chunk_state_update(blake3_chunk_state *self, const uint8_t *input,
+                               size_t input_len) {
+    if(self->buf_len > 0) {
+        size_t take = chunk_state_fill_buf(self, input, input_len);
+        input += take;
+        input_len -= take;
+        if(input_len > 0) {
+            compress_in_place(self->cv, self->buf, BLAKE3_BLOCK_LEN,
+                              self->chunk_counter,
+                              self->flags | chunk_state_maybe_start_flag(self));
+            self->blocks_compressed++;
+            self->buf_len = 0;
+            memset(self->buf, 0, BLAKE3_BLOCK_LEN);
+        }
+    }
+
+    /* Always keep the last block buffered, it may need the CHUNK_END flag */
+    while(input_len > BLAKE3_BLOCK_LEN) {
+        compress_in_place(self->cv, input, BLAKE3_BLOCK_LEN,
+                          self->chunk_counter,
+                          self->flags | chunk_state_maybe_start_flag(self));
+        self->blocks_compressed++;
+        input += BLAKE3_BLOCK_LEN;
+        input_len -= BLAKE3_BLOCK_LEN;
+    }
+
+    chunk_state_fill_buf(self, input, input_len);
+}
+
+static output make_output(const uint32_t input_cv[8],
+                          const uint8_t block[BLAKE3_BLOCK_LEN],
+                          uint8_t block_len, uint64_t counter, uint8_t flags) {
+    output ret;
+    memcpy(ret.input_cv, input_cv, 32);
+    memcpy(ret.block, block, BLAKE3_BLOCK_LEN);
+    ret.block_len = block_len;
+    ret.counter = counter;
+    ret.flags = flags;
+    return ret;
+}
+
+static output chunk_state_output(const blake3_chunk_state *self) {
+    uint8_t block_flags =
+        self->flags | chunk_state_maybe_start_flag(self) | CHUNK_END;
+    return make_output(self->cv, self->buf, self->buf_len, self->chunk_counter,
+                       block_flags);
+}
+
+static output parent_output(const uint8_t block[BLAKE3_BLOCK_LEN],
+                            const uint32_t key[8], uint8_t flags) {
+    return make_output(key, block, BLAKE3_BLOCK_LEN, 0, flags | PARENT);
+}
+
+static void output_chaining_value(const output *self, uint8_t cv[32]) {
+    uint32_t cv_words[8];
+    memcpy(cv_words, self->input_cv, 32);
+    compress_in_place(cv_words, self->block, self->block_len, self->counter,
+                      self->flags);
+    store_cv_words(cv, cv_words);
+}
+
+static void output_root_bytes(const output *self, uint8_t *out,
+                              size_t out_len) {
+    uint64_t output_block_counter = 0;
+    uint8_t wide_buf[64];
+    while(out_len > 0) {
+        compress_xof(self->input_cv, self->block, self->block_len,
+                     output_block_counter, self->flags | ROOT, wide_buf);
+        size_t take = out_len < sizeof(wide_buf) ? out_len : sizeof(wide_buf);
+        memcpy(out, wide_buf, take);
+        out += take;
+        out_len -= take;
+        output_block_counter++;
+    }
+}
+
+/***** Subtrees *****/
+
+/* Hash as many whole chunks as possible at once, plus any partial chunk at
+ * the end, returning the number of chaining values written to out */
+static size_t compress_chunks_parallel(const uint8_t *input, size_t input_len,
+                                       const uint32_t key[8],
+                                       uint64_t chunk_counter, uint8_t flags,
+                                       uint8_t *out) {
+    const uint8_t *chunks_array[MAX_SIMD_DEGREE];
+    size_t input_position = 0;
+    size_t chunks_array_len = 0;
+    while(input_len - input_position >= BLAKE3_CHUNK_LEN) {
+        chunks_array[chunks_array_len] = &input[input_position];
+        input_position += BLAKE3_CHUNK_LEN;
+        chunks_array_len++;
+    }
+
+    hash_many(chunks_array, chunks_array_len,
+              BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN, key, chunk_counter, true,
+              flags, CHUNK_START, CHUNK_END, out);
+
+    if(input_len > input_position) {
+        blake3_chunk_state chunk_state;
+        chunk_state_init(&chunk_state, key, flags);
+        chunk_state.chunk_counter = chunk_counter + chunks_array_len;
+        chunk_state_update(&chunk_state, &input[input_position],
+                           input_len - input_position);
+        output o = chunk_state_output(&chunk_state);
+        output_chaining_value(&o, &out[chunks_array_len * BLAKE3_OUT_LEN]);
+        return chunks_array_len + 1;
+    }
+    return chunks_array_len;
+}
+
+/* Hash pairs of chaining values into their parents, passing any odd one
+ * through, and return the number of chaining values written to out */
+static size_t compress_parents_parallel(const uint8_t *child_chaining_values,
+                                        size_t num_chaining_values,
+                                        const uint32_t key[8], uint8_t flags,
+                                        uint8_t *out) {
+    const uint8_t *parents_array[MAX_SIMD_DEGREE_OR_2];
+    size_t parents_array_len = 0;
+    while(num_chaining_values - (2 * parents_array_len) >= 2) {
+        parents_array[parents_array_len] =
+            &child_chaining_values[2 * parents_array_len * BLAKE3_OUT_LEN];
+        parents_array_len++;
+    }
+
+    hash_many(parents_array, parents_array_len, 1, key, 0, false,
+              flags | PARENT, 0, 0, out);
+
+    if(num_chaining_values > 2 * parents_array_len) {
+        memcpy(&out[parents_array_len * BLAKE3_OUT_LEN],
+               &child_chaining_values[2 * parents_array_len * BLAKE3_OUT_LEN],
+               BLAKE3_OUT_LEN);
+        return parents_array_len + 1;
+    }
+    return parents_array_len;
+}
+
+/* The largest power of two number of chunks that leaves at least one byte
+ * for the right side */
+static size_t left_len(size_t content_len) {
+    size_t full_chunks = (content_len - 1) / BLAKE3_CHUNK_LEN;
+    return round_down_to_power_of_2(full_chunks) * BLAKE3_CHUNK_LEN;
+}
+
+/* Hash a subtree, stopping short of its root so there are enough chaining
+ * values left over to keep hash_many() busy.  Returns the number of
+ * chaining values written to out */
+static size_t compress_subtree_wide(const uint8_t *input, size_t input_len,
+                                    const uint32_t key[8],
+                                    uint64_t chunk_counter, uint8_t flags,
+                                    uint8_t *out) {
+    if(input_len <= MAX_SIMD_DEGREE * BLAKE3_CHUNK_LEN)
+        return compress_chunks_parallel(input, input_len, key, chunk_counter,
+                                        flags, out);
+
+    size_t left_input_len = left_len(input_len);
+    size_t right_input_len = input_len - left_input_len;
+    const uint8_t *right_input = &input[left_input_len];
+    uint64_t right_chunk_counter =
+        chunk_counter + (uint64_t)(left_input_len / BLAKE3_CHUNK_LEN);
+
+    uint8_t cv_array[2 * MAX_SIMD_DEGREE_OR_2 * BLAKE3_OUT_LEN];
+    size_t degree = MAX_SIMD_DEGREE;
+    if(left_input_len > BLAKE3_CHUNK_LEN && degree == 1)
+        degree = 2;
+    uint8_t *right_cvs = &cv_array[degree * BLAKE3_OUT_LEN];
+
+    size_t left_n = compress_subtree_wide(input, left_input_len, key,
+                                          chunk_counter, flags, cv_array);
+    size_t right_n = compress_subtree_wide(right_input, right_input_len, key,
+                                           right_chunk_counter, flags,
+                                           right_cvs);
+
+    /* With no SIMD, keep two chaining values so the caller can still make a
+     * parent from them */
+    if(left_n == 1) {
+        memcpy(out, cv_array, 2 * BLAKE3_OUT_LEN);
+        return 2;
+    }
+
+    return compress_parents_parallel(cv_array, left_n + right_n, key, flags,
+                                     out);
+}
+
+/* Hash a subtree of more than one chunk down to the two chaining values
+ * under its root */
+static void compress_subtree_to_parent_node(const uint8_t *input,
+                                            size_t input_len,
+                                            const uint32_t key[8],
+                                            uint64_t chunk_counter,
+                                            uint8_t flags,
+                                            uint8_t out[2 * BLAKE3_OUT_LEN]) {
+    uint8_t cv_array[MAX_SIMD_DEGREE_OR_2 * BLAKE3_OUT_LEN];
+    size_t num_cvs = compress_subtree_wide(input, input_len, key,
+                                           chunk_counter, flags, cv_array);
+
+    uint8_t out_array[MAX_SIMD_DEGREE_OR_2 * BLAKE3_OUT_LEN / 2];
+    while(num_cvs > 2) {
+        num_cvs = compress_parents_parallel(cv_array, num_cvs, key, flags,
+                                            out_array);
+        memcpy(cv_array, out_array, num_cvs * BLAKE3_OUT_LEN);
+    }
+    memcpy(out, cv_array, 2 * BLAKE3_OUT_LEN);
+}
+
+/***** Hasher *****/
+
+void blake3_hasher_init(blake3_hasher *self) {
+    memcpy(self->key, IV, BLAKE3_OUT_LEN);
+    chunk_state_init(&self->chunk, IV, 0);
+    self->cv_stack_len = 0;
+}
+
+/* Merge chaining values until the stack holds one per set bit in
+ * total_len, the number of chunks so far.  This is done lazily, since the
+ * last chaining value might turn out to be the root */
+static void hasher_merge_cv_stack(blake3_hasher *self, uint64_t total_len) {
+    size_t post_merge_stack_len = (size_t)popcnt(total_len);
+    while(self->cv_stack_len > post_merge_stack_len) {
+        uint8_t *parent_node =
+            &self->cv_stack[(self->cv_stack_len - 2) * BLAKE3_OUT_LEN];
+        output o = parent_output(parent_node, self->key, self->chunk.flags);
+        output_chaining_value(&o, parent_node);
+        self->cv_stack_len--;
+    }
+}
+
+static void hasher_push_cv(blake3_hasher *self, uint8_t new_cv[BLAKE3_OUT_LEN],
+                           uint64_t chunk_counter) {
+    hasher_merge_cv_stack(self, chunk_counter);
+    memcpy(&self->cv_stack[self->cv_stack_len * BLAKE3_OUT_LEN], new_cv,
+           BLAKE3_OUT_LEN);
+    self->cv_stack_len++;
+}
+
+void blake3_hasher_update(blake3_hasher *self, const void *input,
+                          size_t input_len) {
+    if(input_len == 0)
+        return;
+
+    const uint8_t *input_bytes = input;
+
+    /* Finish off any partial chunk first */
+    if(chunk_state_len(&self->chunk) > 0) {
+        size_t take = BLAKE3_CHUNK_LEN - chunk_state_len(&self->chunk);
+        if(take > input_len)
+            take = input_len;
+        chunk_state_update(&self->chunk, input_bytes, take);
+        input_bytes += take;
+        input_len -= take;
+        if(input_len == 0)
+            return;
+        output o = chunk_state_output(&self->chunk);
+        uint8_t chunk_cv[32];
+        output_chaining_value(&o, chunk_cv);
+        hasher_push_cv(self, chunk_cv, self->chunk.chunk_counter);
+        chunk_state_reset(&self->chunk, self->key,
+                          self->chunk.chunk_counter + 1);
+    }
+
+    /* Hash the largest whole subtrees that fit, as long as there's at least
+     * one more byte after them */
+    while(input_len > BLAKE3_CHUNK_LEN) {
+        uint64_t subtree_len = round_down_to_power_of_2(input_len);
+        uint64_t count_so_far = self->chunk.chunk_counter * BLAKE3_CHUNK_LEN;
+        /* A subtree has to start at a multiple of its size */
+        while((((uint64_t)(subtree_len - 1)) & count_so_far) != 0)
+            subtree_len /= 2;
+        uint64_t subtree_chunks = subtree_len / BLAKE3_CHUNK_LEN;
+        if(subtree_len <= BLAKE3_CHUNK_LEN) {
+            blake3_chunk_state chunk_state;
+            chunk_state_init(&chunk_state, self->key, self->chunk.flags);
+            chunk_state.chunk_counter = self->chunk.chunk_counter;
+            chunk_state_update(&chunk_state, input_bytes, (size_t)subtree_len);
+            output o = chunk_state_output(&chunk_state);
+            uint8_t cv[BLAKE3_OUT_LEN];
+            output_chaining_value(&o, cv);
+            hasher_push_cv(self, cv, chunk_state.chunk_counter);
+        } else {
+            uint8_t cv_pair[2 * BLAKE3_OUT_LEN];
+            compress_subtree_to_parent_node(input_bytes, (size_t)subtree_len,
+                                            self->key,
+                                            self->chunk.chunk_counter,
+                                            self->chunk.flags, cv_pair);
+            hasher_push_cv(self, cv_pair, self->chunk.chunk_counter);
+            hasher_push_cv(self, &cv_pair[BLAKE3_OUT_LEN],
+                           self->chunk.chunk_counter + (subtree_chunks / 2));
+        }
+        self->chunk.chunk_counter += subtree_chunks;
+        input_bytes += subtree_len;
+        input_len -= (size_t)subtree_len;
+    }
+
+    /* Keep whatever's left, which is at most one chunk */
+    if(input_len > 0) {
+        chunk_state_update(&self->chunk, input_bytes, input_len);
+        hasher_merge_cv_stack(self, self->chunk.chunk_counter);
+    }
+}
+
+void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out,
+                            size_t out_len) {
+    if(out_len == 0)
+        return;
+
+    /* A single chunk is its own root */
+    if(self->cv_stack_len == 0) {
+        output o = chunk_state_output(&self->chunk);
+        output_root_bytes(&o, out, out_len);
+        return;
+    }
+
+    /* Otherwise merge everything on the stack, without changing it, so
+     * hashing can carry on afterwards */
+    output o;
+    size_t cvs_remaining;
+    if(chunk_state_len(&self->chunk) > 0) {
+        cvs_remaining = self->cv_stack_len;
+        o = chunk_state_output(&self->chunk);
+    } else {
+        cvs_remaining = self->cv_stack_len - 2;
+        o = parent_output(&self->cv_stack[cvs_remaining * 32], self->key,
+                          self->chunk.flags);
+    }
+    while(cvs_remaining > 0) {
+        cvs_remaining--;
+        uint8_t parent_block[BLAKE3_BLOCK_LEN];
+        memcpy(parent_block, &self->cv_stack[cvs_remaining * 32], 32);
+        output_chaining_value(&o, &parent_block[32]);
+        o = parent_output(parent_block, self->key, self->chunk.flags);
+    }
+    output_root_bytes(&o, out, out_len);
+}
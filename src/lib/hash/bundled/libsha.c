@@ -31,107 +31,79 @@
 #include "zck_private.h"
 #include "libsha.h"
 
-static void SHA256_Final(unsigned char *md, SHA256_CTX *c)
+_Static_assert(sizeof(SHA_CTX) <= HASH_SHA_CTX_SIZE &&
+               sizeof(SHA256_CTX) <= HASH_SHA_CTX_SIZE &&
+               sizeof(SHA512_CTX) <= HASH_SHA_CTX_SIZE,
+               "HASH_SHA_CTX_SIZE is too small");
+
+static bool sha1_hash_update(zckCtx *zck, zckHash *hash, const char *message,
+                             size_t size)
+{
+        SHA1_Update((SHA_CTX *)hash->ctx.sha, (const sha1_byte *)message, size);
+        return true;
+}
+
+static bool sha1_hash_final(zckCtx *zck, zckHash *hash, char *digest)
 {
-    sha256_final(c, md);
+        SHA1_Final((sha1_byte *)digest, (SHA_CTX *)hash->ctx.sha);
+        return true;
 }
 
-static void SHA512_Final(unsigned char *md, SHA512_CTX *c)
+static bool sha256_hash_update(zckCtx *zck, zckHash *hash,
+                               const char *message, size_t size)
 {
-    sha512_final(c, md);
+        SHA256_Update((SHA256_CTX *)hash->ctx.sha,
+                      (const unsigned char *)message, size);
+        return true;
+}
+
+static bool sha256_hash_final(zckCtx *zck, zckHash *hash, char *digest)
+{
+        sha256_final((SHA256_CTX *)hash->ctx.sha, (unsigned char *)digest);
+        return true;
+}
+
+static bool sha512_hash_update(zckCtx *zck, zckHash *hash,
+                               const char *message, size_t size)
+{
+        SHA512_Update((SHA512_CTX *)hash->ctx.sha,
+                      (const unsigned char *)message, size);
+        return true;
+}
+
+static bool sha512_hash_final(zckCtx *zck, zckHash *hash, char *digest)
+{
+        sha512_final((SHA512_CTX *)hash->ctx.sha, (unsigned char *)digest);
+        return true;
 }
 
 void lib_hash_ctx_close(zckHash *hash)
 {
-        free(hash->ctx);
 }
 
 bool lib_hash_init(zckCtx *zck, zckHash *hash)
 {
+        sha2_select_impl();
         if(hash->type->type == ZCK_HASH_SHA1) {
                 zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-1 hash");
-                hash->ctx = zmalloc(sizeof(SHA_CTX));
-                if (!hash->ctx) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                SHA1_Init((SHA_CTX *) hash->ctx);
+                SHA1_Init((SHA_CTX *)hash->ctx.sha);
+                hash->update = sha1_hash_update;
+                hash->final = sha1_hash_final;
                 return true;
         } else if(hash->type->type == ZCK_HASH_SHA256) {
-                 zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-256 hash");
-                hash->ctx = zmalloc(sizeof(SHA256_CTX));
-                if (!hash->ctx) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                SHA256_Init((SHA256_CTX *) hash->ctx);
+                zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-256 hash");
+                SHA256_Init((SHA256_CTX *)hash->ctx.sha);
+                hash->update = sha256_hash_update;
+                hash->final = sha256_hash_final;
                 return true;
         } else if(hash->type->type >= ZCK_HASH_SHA512 &&
                 hash->type->type <= ZCK_HASH_SHA512_128) {
                 zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-512 hash");
-                hash->ctx = zmalloc(sizeof(SHA512_CTX));
-                if (!hash->ctx) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                SHA512_Init((SHA512_CTX *) hash->ctx);
+                SHA512_Init((SHA512_CTX *)hash->ctx.sha);
+                hash->update = sha512_hash_update;
+                hash->final = sha512_hash_final;
                 return true;
         }
         set_error(zck, "Unsupported hash type: %s", zck_hash_name_from_type(hash->type->type));
         return false;
 }
-
-bool lib_hash_update(zckCtx *zck, zckHash *hash, const char *message, const size_t size)
-{
-        if(hash->type->type == ZCK_HASH_SHA1) {
-            SHA1_Update((SHA_CTX *)hash->ctx, (const sha1_byte *)message, size);
-            return true;
-        } else if(hash->type->type == ZCK_HASH_SHA256) {
-            SHA256_Update((SHA256_CTX *)hash->ctx,
-                          (const unsigned char *)message, size);
-            return true;
-        } else if(hash->type->type >= ZCK_HASH_SHA512 &&
-                  hash->type->type <= ZCK_HASH_SHA512_128) {
-            SHA512_Update((SHA512_CTX *)hash->ctx,
-                          (const unsigned char *)message, size);
-            return true;
-        }
-        set_error(zck, "Unsupported hash type: %s", zck_hash_name_from_type(hash->type->type));
-        return false;
-}
-
-char *lib_hash_final(zckCtx *zck, zckHash *hash)
-{
-        if(hash->type->type == ZCK_HASH_SHA1) {
-        unsigned char *digest = zmalloc(SHA1_DIGEST_LENGTH);
-        if (!digest) {
-           zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-           return false;
-        }
-        SHA1_Final((sha1_byte*)digest, (SHA_CTX *)hash->ctx);
-        hash_close(hash);
-        return (char *)digest;
-    } else if(hash->type->type == ZCK_HASH_SHA256) {
-        unsigned char *digest = zmalloc(SHA256_DIGEST_SIZE);
-        if (!digest) {
-           zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-           return false;
-        }
-        SHA256_Final(digest, (SHA256_CTX *)hash->ctx);
-        hash_close(hash);
-        return (char *)digest;
-    } else if(hash->type->type >= ZCK_HASH_SHA512 &&
-              hash->type->type <= ZCK_HASH_SHA512_128) {
-        unsigned char *digest = zmalloc(SHA512_DIGEST_SIZE);
-        if (!digest) {
-           zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-           return false;
-        }
-        SHA512_Final(digest, (SHA512_CTX *)hash->ctx);
-        hash_close(hash);
-        return (char *)digest;
-    }
-    set_error(zck, "Unsupported hash type: %s", zck_hash_name_from_type(hash->type->type));
-    hash_close(hash);
-    return NULL;
-}
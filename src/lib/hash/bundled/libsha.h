@@ -15,7 +15,5 @@
 
 void lib_hash_ctx_close(zckHash *hash);
 bool lib_hash_init(zckCtx *zck, zckHash *hash);
-bool lib_hash_update(zckCtx *zck, zckHash *hash, const char *message, const size_t size);
-char *lib_hash_final(zckCtx *zck, zckHash *hash);
 
 #endif
@@ -207,10 +207,16 @@ uint64 sha512_k[80] =
              0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
              0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL};
 
+/* Block transforms used by the functions below.  These start out as the
+ * portable versions and may be replaced by sha2_select_impl() */
+
+sha256_transf_fn sha256_transf = sha256_transf_c;
+sha512_transf_fn sha512_transf = sha512_transf_c;
+
 /* SHA-256 functions */
 
-void sha256_transf(sha256_ctx *ctx, const unsigned char *message,
-                   unsigned int block_nb)
+void sha256_transf_c(sha256_ctx *ctx, const unsigned char *message,
+                     unsigned int block_nb)
 {
     uint32 w[64];
     uint32 wv[8];
@@ -425,8 +431,8 @@ void sha256_final(sha256_ctx *ctx, unsigned char *digest)
 
 /* SHA-512 functions */
 
-void sha512_transf(sha512_ctx *ctx, const unsigned char *message,
-                   unsigned int block_nb)
+void sha512_transf_c(sha512_ctx *ctx, const unsigned char *message,
+                     unsigned int block_nb)
 {
     uint64 w[80];
     uint64 wv[8];
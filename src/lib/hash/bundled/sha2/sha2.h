@@ -72,6 +72,33 @@ typedef struct {
 typedef sha512_ctx sha384_ctx;
 typedef sha256_ctx sha224_ctx;
 
+/* Block transform implementations, see sha2_accel.c */
+#define SHA2_IMPL_C     0
+#define SHA2_IMPL_SHANI 1
+#define SHA2_IMPL_AVX2  2
+#define SHA2_IMPL_ARMV8 3
+#define SHA2_IMPL_COUNT 4
+
+typedef void (*sha256_transf_fn)(sha256_ctx *ctx, const unsigned char *message,
+                                 unsigned int block_nb);
+typedef void (*sha512_transf_fn)(sha512_ctx *ctx, const unsigned char *message,
+                                 unsigned int block_nb);
+
+extern uint32 sha256_k[64];
+extern uint64 sha512_k[80];
+extern sha256_transf_fn sha256_transf;
+extern sha512_transf_fn sha512_transf;
+
+void sha256_transf_c(sha256_ctx *ctx, const unsigned char *message,
+                     unsigned int block_nb);
+void sha512_transf_c(sha512_ctx *ctx, const unsigned char *message,
+                     unsigned int block_nb);
+
+void sha2_select_impl(void);
+int sha2_impl_supported(int impl);
+int sha2_use_impl(int impl);
+const char *sha2_impl_name(int impl);
+
 void sha224_init(sha224_ctx *ctx);
 void sha224_update(sha224_ctx *ctx, const unsigned char *message,
                    unsigned int len);
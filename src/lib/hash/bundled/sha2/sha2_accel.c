@@ -0,0 +1,543 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Hardware accelerated SHA-256 and SHA-512 block transforms.  Which ones the
+ * CPU supports is worked out once, and the fastest is then used in place of
+ * the portable transforms in sha2.c.
+ *
+ * x86-64 has the SHA extensions (SHA-256 only) and AVX2, which is used to
+ * compute the message schedule four words at a time while the rounds stay
+ * scalar.  ARMv8 has instructions for SHA-256 and, from ARMv8.2, SHA-512 */
+
+#include <stdbool.h>
+#include <string.h>
+#ifdef ZCHUNK_THREADS
+#include <pthread.h>
+#endif
+#ifdef ZCHUNK_X86_SIMD
+#include <immintrin.h>
+#endif
+#ifdef ZCHUNK_SHA2_ARMV8
+#include <stdint.h>
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#endif
+
+#include <zck.h>
+
+#include "zck_private.h"
+#include "sha2.h"
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+#ifdef ZCHUNK_X86_SIMD
+
+#define TARGET_SHANI __attribute__((target("sha,sse4.1,ssse3")))
+#define TARGET_AVX2  __attribute__((target("avx2,bmi2")))
+
+/* Four rounds, using the message words in m */
+#define SHANI_ROUNDS(m, j)                                                 \
+{                                                                          \
+    msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i *)&sha256_k[j])); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                   \
+    msg = _mm_shuffle_epi32(msg, 0x0E);                                    \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);                   \
+}
+
+/* Replace m0 with the four message words that follow m3 */
+#define SHANI_SCHED(m0, m1, m2, m3)                                        \
+{                                                                          \
+    m0 = _mm_add_epi32(_mm_sha256msg1_epu32(m0, m1),                       \
+                       _mm_alignr_epi8(m3, m2, 4));                        \
+    m0 = _mm_sha256msg2_epu32(m0, m3);                                     \
+}
+
+TARGET_SHANI
+static void sha256_transf_shani(sha256_ctx *ctx, const unsigned char *message,
+                                unsigned int block_nb)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                        0x0405060700010203ULL);
+    __m128i state0, state1, abef, cdgh, msg, tmp, m0, m1, m2, m3;
+    int j;
+
+    if(block_nb == 0)
+        return;
+
+    /* The instructions want the state as ABEF and CDGH */
+    tmp = _mm_loadu_si128((const __m128i *)&ctx->h[0]);
+    state1 = _mm_loadu_si128((const __m128i *)&ctx->h[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for(; block_nb > 0; block_nb--, message += SHA256_BLOCK_SIZE) {
+        abef = state0;
+        cdgh = state1;
+
+        m0 = _mm_loadu_si128((const __m128i *)(message + 0));
+        m1 = _mm_loadu_si128((const __m128i *)(message + 16));
+        m2 = _mm_loadu_si128((const __m128i *)(message + 32));
+        m3 = _mm_loadu_si128((const __m128i *)(message + 48));
+        m0 = _mm_shuffle_epi8(m0, mask);
+        m1 = _mm_shuffle_epi8(m1, mask);
+        m2 = _mm_shuffle_epi8(m2, mask);
+        m3 = _mm_shuffle_epi8(m3, mask);
+
+        for(j = 0; j < 64; j += 16) {
+            SHANI_ROUNDS(m0, j);
+            if(j < 48)
+                SHANI_SCHED(m0, m1, m2, m3);
+            SHANI_ROUNDS(m1, j + 4);
+            if(j < 48)
+                SHANI_SCHED(m1, m2, m3, m0);
+            SHANI_ROUNDS(m2, j + 8);
+            if(j < 48)
+                SHANI_SCHED(m2, m3, m0, m1);
+            SHANI_ROUNDS(m3, j + 12);
+            if(j < 48)
+                SHANI_SCHED(m3, m0, m1, m2);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *)&ctx->h[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i *)&ctx->h[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+#define AVX2_ROR32(x, n) \
+    _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define AVX2_ROR64(x, n) \
+    _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - (n)))
+
+#define SHA256_S0(x) (_mm_xor_si128(_mm_xor_si128(AVX2_ROR32(x, 7),    \
+                                                  AVX2_ROR32(x, 18)), \
+                                    _mm_srli_epi32(x, 3)))
+#define SHA256_S1(x) (_mm_xor_si128(_mm_xor_si128(AVX2_ROR32(x, 17),   \
+                                                  AVX2_ROR32(x, 19)), \
+                                    _mm_srli_epi32(x, 10)))
+#define SHA512_S0(x) (_mm256_xor_si256(_mm256_xor_si256(AVX2_ROR64(x, 1),  \
+                                                        AVX2_ROR64(x, 8)), \
+                                       _mm256_srli_epi64(x, 7)))
+#define SHA512_S1(x) (_mm256_xor_si256(_mm256_xor_si256(AVX2_ROR64(x, 19),  \
+                                                        AVX2_ROR64(x, 61)), \
+                                       _mm256_srli_epi64(x, 6)))
+
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, j)                           \
+{                                                                         \
+    t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25))                  \
+         + (g ^ (e & (f ^ g))) + wk[j];                                   \
+    t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22))                      \
+         + ((a & b) | (c & (a | b)));                                     \
+    d += t1;                                                              \
+    h = t1 + t2;                                                          \
+}
+
+#define SHA512_ROUND(a, b, c, d, e, f, g, h, j)                           \
+{                                                                         \
+    t1 = h + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41))                 \
+         + (g ^ (e & (f ^ g))) + wk[j];                                   \
+    t2 = (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39))                     \
+         + ((a & b) | (c & (a | b)));                                     \
+    d += t1;                                                              \
+    h = t1 + t2;                                                          \
+}
+
+/* Fill in w[j..j+3] and wk[j..j+3].  Only the first two words of each group
+ * can take their sigma1 term from earlier groups, so the other two are
+ * finished off once the first two are known */
+#define SHA256_SCHED(j)                                                   \
+{                                                                         \
+    x = _mm_add_epi32(_mm_loadu_si128((const __m128i *)&w[(j) - 16]),     \
+                      _mm_loadu_si128((const __m128i *)&w[(j) - 7]));     \
+    x = _mm_add_epi32(x, SHA256_S0(_mm_loadu_si128(                       \
+                                    (const __m128i *)&w[(j) - 15])));     \
+    x = _mm_add_epi32(x, SHA256_S1(_mm_loadl_epi64(                       \
+                                    (const __m128i *)&w[(j) - 2])));      \
+    x = _mm_add_epi32(x, SHA256_S1(_mm_slli_si128(x, 8)));                \
+    _mm_storeu_si128((__m128i *)&w[j], x);                                \
+    x = _mm_add_epi32(x, _mm_loadu_si128((const __m128i *)&sha256_k[j])); \
+    _mm_storeu_si128((__m128i *)&wk[j], x);                               \
+}
+
+#define SHA512_SCHED(j)                                                   \
+{                                                                         \
+    x = _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)&w[(j) - 16]), \
+                         _mm256_loadu_si256((const __m256i *)&w[(j) - 7])); \
+    x = _mm256_add_epi64(x, SHA512_S0(_mm256_loadu_si256(                 \
+                                    (const __m256i *)&w[(j) - 15])));     \
+    x = _mm256_add_epi64(x, SHA512_S1(_mm256_inserti128_si256(            \
+                                    _mm256_setzero_si256(),               \
+                                    _mm_loadu_si128(                      \
+                                        (const __m128i *)&w[(j) - 2]),    \
+                                    0)));                                 \
+    x = _mm256_add_epi64(x, SHA512_S1(_mm256_permute2x128_si256(x, x,     \
+                                                                0x08)));  \
+    _mm256_storeu_si256((__m256i *)&w[j], x);                             \
+    x = _mm256_add_epi64(x, _mm256_loadu_si256(                           \
+                                    (const __m256i *)&sha512_k[j]));      \
+    _mm256_storeu_si256((__m256i *)&wk[j], x);                            \
+}
+
+/* The schedule for the next sixteen words is worked out in vector registers
+ * alongside the scalar rounds, which keeps both kinds of unit busy */
+TARGET_AVX2
+static void sha256_transf_avx2(sha256_ctx *ctx, const unsigned char *message,
+                               unsigned int block_nb)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                        0x0405060700010203ULL);
+    uint32 w[64], wk[64];
+    uint32 a, b, c, d, e, f, g, h, t1, t2;
+    __m128i x;
+    int j;
+
+    for(; block_nb > 0; block_nb--, message += SHA256_BLOCK_SIZE) {
+        for(j = 0; j < 16; j += 4) {
+            x = _mm_loadu_si128((const __m128i *)(message + j * 4));
+            x = _mm_shuffle_epi8(x, mask);
+            _mm_storeu_si128((__m128i *)&w[j], x);
+            x = _mm_add_epi32(x, _mm_loadu_si128((const __m128i *)&sha256_k[j]));
+            _mm_storeu_si128((__m128i *)&wk[j], x);
+        }
+
+        a = ctx->h[0]; b = ctx->h[1]; c = ctx->h[2]; d = ctx->h[3];
+        e = ctx->h[4]; f = ctx->h[5]; g = ctx->h[6]; h = ctx->h[7];
+        for(j = 0; j < 64; j += 8) {
+            if(j < 48)
+                SHA256_SCHED(j + 16);
+            SHA256_ROUND(a, b, c, d, e, f, g, h, j);
+            SHA256_ROUND(h, a, b, c, d, e, f, g, j + 1);
+            SHA256_ROUND(g, h, a, b, c, d, e, f, j + 2);
+            SHA256_ROUND(f, g, h, a, b, c, d, e, j + 3);
+            if(j < 48)
+                SHA256_SCHED(j + 20);
+            SHA256_ROUND(e, f, g, h, a, b, c, d, j + 4);
+            SHA256_ROUND(d, e, f, g, h, a, b, c, j + 5);
+            SHA256_ROUND(c, d, e, f, g, h, a, b, j + 6);
+            SHA256_ROUND(b, c, d, e, f, g, h, a, j + 7);
+        }
+        ctx->h[0] += a; ctx->h[1] += b; ctx->h[2] += c; ctx->h[3] += d;
+        ctx->h[4] += e; ctx->h[5] += f; ctx->h[6] += g; ctx->h[7] += h;
+    }
+}
+
+TARGET_AVX2
+static void sha512_transf_avx2(sha512_ctx *ctx, const unsigned char *message,
+                               unsigned int block_nb)
+{
+    const __m256i mask = _mm256_set_epi64x(0x08090a0b0c0d0e0fULL,
+                                           0x0001020304050607ULL,
+                                           0x08090a0b0c0d0e0fULL,
+                                           0x0001020304050607ULL);
+    uint64 w[80], wk[80];
+    uint64 a, b, c, d, e, f, g, h, t1, t2;
+    __m256i x;
+    int j;
+
+    for(; block_nb > 0; block_nb--, message += SHA512_BLOCK_SIZE) {
+        for(j = 0; j < 16; j += 4) {
+            x = _mm256_loadu_si256((const __m256i *)(message + j * 8));
+            x = _mm256_shuffle_epi8(x, mask);
+            _mm256_storeu_si256((__m256i *)&w[j], x);
+            x = _mm256_add_epi64(x, _mm256_loadu_si256(
+                                        (const __m256i *)&sha512_k[j]));
+            _mm256_storeu_si256((__m256i *)&wk[j], x);
+        }
+
+        a = ctx->h[0]; b = ctx->h[1]; c = ctx->h[2]; d = ctx->h[3];
+        e = ctx->h[4]; f = ctx->h[5]; g = ctx->h[6]; h = ctx->h[7];
+        for(j = 0; j < 80; j += 8) {
+            if(j < 64)
+                SHA512_SCHED(j + 16);
+            SHA512_ROUND(a, b, c, d, e, f, g, h, j);
+            SHA512_ROUND(h, a, b, c, d, e, f, g, j + 1);
+            SHA512_ROUND(g, h, a, b, c, d, e, f, j + 2);
+            SHA512_ROUND(f, g, h, a, b, c, d, e, j + 3);
+            if(j < 64)
+                SHA512_SCHED(j + 20);
+            SHA512_ROUND(e, f, g, h, a, b, c, d, j + 4);
+            SHA512_ROUND(d, e, f, g, h, a, b, c, j + 5);
+            SHA512_ROUND(c, d, e, f, g, h, a, b, j + 6);
+            SHA512_ROUND(b, c, d, e, f, g, h, a, j + 7);
+        }
+        ctx->h[0] += a; ctx->h[1] += b; ctx->h[2] += c; ctx->h[3] += d;
+        ctx->h[4] += e; ctx->h[5] += f; ctx->h[6] += g; ctx->h[7] += h;
+    }
+}
+
+static void detect_x86(sha256_transf_fn *t256, sha512_transf_fn *t512)
+{
+    int cpu = cpu_features();
+
+    if((cpu & CPU_SHA) && (cpu & CPU_SSSE3) && (cpu & CPU_SSE41))
+        t256[SHA2_IMPL_SHANI] = sha256_transf_shani;
+    if((cpu & CPU_AVX2) && (cpu & CPU_BMI2)) {
+        t256[SHA2_IMPL_AVX2] = sha256_transf_avx2;
+        t512[SHA2_IMPL_AVX2] = sha512_transf_avx2;
+    }
+}
+
+#endif /* ZCHUNK_X86_SIMD */
+
+#ifdef ZCHUNK_SHA2_ARMV8
+
+#ifdef __clang__
+#define TARGET_ARMV8_SHA2   __attribute__((target("sha2")))
+#define TARGET_ARMV8_SHA512 __attribute__((target("sha3")))
+#else
+#define TARGET_ARMV8_SHA2   __attribute__((target("+sha2")))
+#define TARGET_ARMV8_SHA512 __attribute__((target("+sha3")))
+#endif
+
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#ifndef HWCAP_SHA512
+#define HWCAP_SHA512 (1 << 21)
+#endif
+
+/* Four rounds, using the message words in m */
+#define ARMV8_ROUNDS(m, j)                                                 \
+{                                                                          \
+    wk = vaddq_u32(m, vld1q_u32((const uint32_t *)&sha256_k[j]));          \
+    tmp = state0;                                                          \
+    state0 = vsha256hq_u32(state0, state1, wk);                            \
+    state1 = vsha256h2q_u32(state1, tmp, wk);                              \
+}
+
+/* Replace m0 with the four message words that follow m3 */
+#define ARMV8_SCHED(m0, m1, m2, m3) \
+    m0 = vsha256su1q_u32(vsha256su0q_u32(m0, m1), m2, m3)
+
+TARGET_ARMV8_SHA2
+static void sha256_transf_armv8(sha256_ctx *ctx, const unsigned char *message,
+                                unsigned int block_nb)
+{
+    uint32x4_t state0, state1, abcd, efgh, wk, tmp, m0, m1, m2, m3;
+    int j;
+
+    state0 = vld1q_u32((const uint32_t *)&ctx->h[0]);
+    state1 = vld1q_u32((const uint32_t *)&ctx->h[4]);
+
+    for(; block_nb > 0; block_nb--, message += SHA256_BLOCK_SIZE) {
+        abcd = state0;
+        efgh = state1;
+
+        m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + 0)));
+        m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + 16)));
+        m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + 32)));
+        m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(message + 48)));
+
+        for(j = 0; j < 64; j += 16) {
+            ARMV8_ROUNDS(m0, j);
+            if(j < 48)
+                ARMV8_SCHED(m0, m1, m2, m3);
+            ARMV8_ROUNDS(m1, j + 4);
+            if(j < 48)
+                ARMV8_SCHED(m1, m2, m3, m0);
+            ARMV8_ROUNDS(m2, j + 8);
+            if(j < 48)
+                ARMV8_SCHED(m2, m3, m0, m1);
+            ARMV8_ROUNDS(m3, j + 12);
+            if(j < 48)
+                ARMV8_SCHED(m3, m0, m1, m2);
+        }
+
+        state0 = vaddq_u32(state0, abcd);
+        state1 = vaddq_u32(state1, efgh);
+    }
+
+    vst1q_u32((uint32_t *)&ctx->h[0], state0);
+    vst1q_u32((uint32_t *)&ctx->h[4], state1);
+}
+
+/* Two rounds.  i0 to i3 hold the state as ab, cd, ef and gh, and the new ef
+ * is written to i4, so after each call the state has moved along to
+ * (i3, i0, i4, i2) and i1 is free.  m[] holds the next sixteen message
+ * words, and is refilled as it's used */
+#define ARMV8_DROUND(i0, i1, i2, i3, i4, j)                                \
+{                                                                          \
+    wk = vaddq_u64(m[(j) & 7],                                             \
+                   vld1q_u64((const uint64_t *)&sha512_k[2 * (j)]));       \
+    wk = vextq_u64(wk, wk, 1);                                             \
+    fg = vextq_u64(i2, i3, 1);                                             \
+    de = vextq_u64(i1, i2, 1);                                             \
+    i3 = vaddq_u64(i3, wk);                                                \
+    if((j) < 32)                                                           \
+        m[(j) & 7] = vsha512su1q_u64(                                      \
+                        vsha512su0q_u64(m[(j) & 7], m[((j) + 1) & 7]),     \
+                        m[((j) + 7) & 7],                                  \
+                        vextq_u64(m[((j) + 4) & 7], m[((j) + 5) & 7], 1)); \
+    i3 = vsha512hq_u64(i3, fg, de);                                        \
+    i4 = vaddq_u64(i1, i3);                                                \
+    i3 = vsha512h2q_u64(i3, i1, i0);                                       \
+}
+
+TARGET_ARMV8_SHA512
+static void sha512_transf_armv8(sha512_ctx *ctx, const unsigned char *message,
+                                unsigned int block_nb)
+{
+    uint64x2_t s0, s1, s2, s3, s4, ab, cd, ef, gh, wk, fg, de, m[8];
+    int i, j;
+
+    ab = vld1q_u64((const uint64_t *)&ctx->h[0]);
+    cd = vld1q_u64((const uint64_t *)&ctx->h[2]);
+    ef = vld1q_u64((const uint64_t *)&ctx->h[4]);
+    gh = vld1q_u64((const uint64_t *)&ctx->h[6]);
+
+    for(; block_nb > 0; block_nb--, message += SHA512_BLOCK_SIZE) {
+        for(i = 0; i < 8; i++)
+            m[i] = vreinterpretq_u64_u8(vrev64q_u8(vld1q_u8(message + i * 16)));
+
+        s0 = ab;
+        s1 = cd;
+        s2 = ef;
+        s3 = gh;
+        for(j = 0; j < 40; j += 5) {
+            ARMV8_DROUND(s0, s1, s2, s3, s4, j);
+            ARMV8_DROUND(s3, s0, s4, s2, s1, j + 1);
+            ARMV8_DROUND(s2, s3, s1, s4, s0, j + 2);
+            ARMV8_DROUND(s4, s2, s0, s1, s3, j + 3);
+            ARMV8_DROUND(s1, s4, s3, s0, s2, j + 4);
+        }
+
+        ab = vaddq_u64(ab, s0);
+        cd = vaddq_u64(cd, s1);
+        ef = vaddq_u64(ef, s2);
+        gh = vaddq_u64(gh, s3);
+    }
+
+    vst1q_u64((uint64_t *)&ctx->h[0], ab);
+    vst1q_u64((uint64_t *)&ctx->h[2], cd);
+    vst1q_u64((uint64_t *)&ctx->h[4], ef);
+    vst1q_u64((uint64_t *)&ctx->h[6], gh);
+}
+
+static void detect_armv8(sha256_transf_fn *t256, sha512_transf_fn *t512)
+{
+    unsigned long hwcap = getauxval(AT_HWCAP);
+
+    if(hwcap & HWCAP_SHA2)
+        t256[SHA2_IMPL_ARMV8] = sha256_transf_armv8;
+    if(hwcap & HWCAP_SHA512)
+        t512[SHA2_IMPL_ARMV8] = sha512_transf_armv8;
+}
+
+#endif /* ZCHUNK_SHA2_ARMV8 */
+
+static const char *impl_names[SHA2_IMPL_COUNT] = {
+    "portable",
+    "SHA-NI",
+    "AVX2",
+    "ARMv8"
+};
+
+/* Most preferred first */
+static const int impl_order[SHA2_IMPL_COUNT] = {
+    SHA2_IMPL_ARMV8,
+    SHA2_IMPL_SHANI,
+    SHA2_IMPL_AVX2,
+    SHA2_IMPL_C
+};
+
+/* The transforms each implementation provides on this CPU, or NULL */
+static sha256_transf_fn impl_sha256[SHA2_IMPL_COUNT];
+static sha512_transf_fn impl_sha512[SHA2_IMPL_COUNT];
+
+#ifdef ZCHUNK_THREADS
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+#else
+static bool selected = false;
+#endif
+
+static void select_best(void)
+{
+    int i;
+
+    impl_sha256[SHA2_IMPL_C] = sha256_transf_c;
+    impl_sha512[SHA2_IMPL_C] = sha512_transf_c;
+#ifdef ZCHUNK_X86_SIMD
+    detect_x86(impl_sha256, impl_sha512);
+#endif
+#ifdef ZCHUNK_SHA2_ARMV8
+    detect_armv8(impl_sha256, impl_sha512);
+#endif
+
+    for(i = SHA2_IMPL_COUNT - 1; i >= 0; i--) {
+        if(impl_sha256[impl_order[i]])
+            sha256_transf = impl_sha256[impl_order[i]];
+        if(impl_sha512[impl_order[i]])
+            sha512_transf = impl_sha512[impl_order[i]];
+    }
+}
+
+/* Pick the fastest transforms this CPU supports.  Only the first call does
+ * anything */
+void sha2_select_impl(void)
+{
+#ifdef ZCHUNK_THREADS
+    pthread_once(&select_once, select_best);
+#else
+    if(!selected) {
+        select_best();
+        selected = true;
+    }
+#endif
+}
+
+int sha2_impl_supported(int impl)
+{
+    if(impl < 0 || impl >= SHA2_IMPL_COUNT)
+        return 0;
+    sha2_select_impl();
+    return impl_sha256[impl] != NULL || impl_sha512[impl] != NULL;
+}
+
+/* Force an implementation, falling back to the portable transform for
+ * whichever of SHA-256 and SHA-512 it doesn't cover.  Returns 0 if the CPU
+ * doesn't support it.  This is for testing, and isn't thread-safe */
+int sha2_use_impl(int impl)
+{
+    if(!sha2_impl_supported(impl))
+        return 0;
+    sha256_transf = impl_sha256[impl] ? impl_sha256[impl] : sha256_transf_c;
+    sha512_transf = impl_sha512[impl] ? impl_sha512[impl] : sha512_transf_c;
+    return 1;
+}
+
+const char *sha2_impl_name(int impl)
+{
+    if(impl < 0 || impl >= SHA2_IMPL_COUNT)
+        return "unknown";
+    return impl_names[impl];
+}
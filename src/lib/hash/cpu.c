@@ -0,0 +1,67 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdbool.h>
+#ifdef ZCHUNK_X86_SIMD
+#include <cpuid.h>
+#endif
+#include <zck.h>
+
+#include "zck_private.h"
+
+/* Find which of the instruction set extensions we have SIMD code for are
+ * usable, which for AVX means the OS has to save the wider registers too */
+int cpu_features() {
+    int features = 0;
+#ifdef ZCHUNK_X86_SIMD
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int xcr0 = 0, xcr0_hi = 0;
+
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    if(ecx & (1 << 9))
+        features |= CPU_SSSE3;
+    if(ecx & (1 << 19))
+        features |= CPU_SSE41;
+    /* OSXSAVE and AVX */
+    if((ecx & (1 << 27)) && (ecx & (1 << 28)))
+        __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+
+    if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return features;
+    if(ebx & (1 << 29))
+        features |= CPU_SHA;
+    if(ebx & (1 << 8))
+        features |= CPU_BMI2;
+    /* XMM and YMM state */
+    if((ebx & (1 << 5)) && (xcr0 & 0x06) == 0x06)
+        features |= CPU_AVX2;
+    /* Plus opmask and ZMM state */
+    if((ebx & (1 << 16)) && (xcr0 & 0xE6) == 0xE6)
+        features |= CPU_AVX512;
+#endif
+    return features;
+}
@@ -29,6 +29,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include <zck.h>
 
 #include "zck_private.h"
@@ -39,10 +42,11 @@
 /***** Using bundled sha libraries *****/
 #include "bundled/libsha.h"
 #endif
-/* This needs to be updated to the largest hash size every time a new hash type
- * is added */
+/* Neither OpenSSL nor the bundled libraries have BLAKE3, so it's always
+ * bundled */
+#include "blake3/blake3.h"
 int get_max_hash_size() {
-    return SHA512_DIGEST_SIZE;
+    return MAX_DIGEST_SIZE;
 }
 
 static char unknown[] = "Unknown(\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
@@ -51,61 +55,471 @@ const static char *HASH_NAME[] = {
     "SHA-1",
     "SHA-256",
     "SHA-512",
-    "SHA-512/128"
+    "SHA-512/128",
+    "BLAKE3",
+    "BLAKE3/128"
 };
 
-static int validate_checksums(zckCtx *zck, zck_log_type bad_checksums) {
-    VALIDATE_READ_BOOL(zck);
-    char buf[BUF_SIZE] = {0};
+/* Compressed data to validate at a time when using threads, and the most a
+ * single worker reads in one go */
+#define VALIDATE_BATCH_SIZE 8388608
+#define VALIDATE_SLICE_SIZE 1048576
 
-    if(zck->data_offset == 0) {
-        set_error(zck, "Header hasn't been read yet");
-        return 0;
+/* A run of consecutive chunks that one worker reads and checks */
+typedef struct validateSlice {
+    size_t first;
+    size_t count;
+    size_t offset;
+    size_t length;
+    char *buf;
+    const char *data;
+    size_t available;
+} validateSlice;
+
+typedef struct validateJob {
+    zckCtx *zck;
+    zckReader **readers;
+    zck_log_type bad_checksums;
+    validateSlice *slices;
+    size_t slice_count;
+    /* Slices from the previous batch, still to be added to the data
+     * checksum */
+    validateSlice *hash_slices;
+    size_t hash_count;
+    int *valid;
+} validateJob;
+
+/* Read length bytes of consecutive chunks from the current position.  A
+ * short read isn't an error, the missing chunks just fail their checksums */
+static bool read_run(zckCtx *zck, char *buf, size_t length, const char **data,
+                     size_t *available) {
+    if(zck->src_buf) {
+        ssize_t rb = read_data_ptr(zck, data, NULL, length);
+        if(rb < 0)
+            return false;
+        *available = rb;
+        return true;
+    }
+    *data = buf;
+    *available = 0;
+    while(*available < length) {
+        ssize_t rb = read_data(zck, buf + *available, length - *available);
+        if(rb < 0)
+            return false;
+        if(rb == 0)
+            break;
+        *available += rb;
+    }
+    return true;
+}
+
+/* Check count consecutive chunks, starting with idx, against the data read
+ * for them, setting valid[] for each.  The chunks are hashed together with
+ * hash_many() */
+static bool validate_run(zckCtx *zck, zckChunk *idx, size_t count,
+                         const char *data, size_t available,
+                         zck_log_type bad_checksums, int *valid) {
+    bool ret = false;
+    int digest_size = zck->chunk_hash_type.digest_size;
+    const char **ptrs = zmalloc(count * sizeof(char *));
+    size_t *sizes = zmalloc(count * sizeof(size_t));
+    char *digests = zmalloc(count * digest_size);
+    if(!ptrs || !sizes || !digests) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        goto end;
     }
 
-    if(!hash_init(zck, &(zck->check_full_hash), &(zck->hash_type)))
-        return 0;
+    size_t loc = 0;
+    zckChunk *chk = idx;
+    for(size_t i=0; i<count; i++, chk = chk->next) {
+        ptrs[i] = data + loc;
+        if(loc < available)
+            sizes[i] = available - loc;
+        if(sizes[i] > chk->comp_length)
+            sizes[i] = chk->comp_length;
+        loc += chk->comp_length;
+    }
+    if(!hash_many(zck, &(zck->chunk_hash_type), ptrs, sizes, count, digests))
+        goto end;
 
-    if(!seek_data(zck, zck->data_offset, SEEK_SET))
-        return 0;
+    chk = idx;
+    for(size_t i=0; i<count; i++, chk = chk->next) {
+        if(chk == chk->zck->index.first && chk->length == 0) {
+            valid[i] = 1;
+            continue;
+        }
+        valid[i] = validate_chunk_digest(zck, chk, digests + i * digest_size,
+                                         bad_checksums);
+        if(!valid[i])
+            goto end;
+    }
+    ret = true;
 
-    /* Check each chunk checksum */
-    bool all_good = true;
-    for(zckChunk *idx = zck->index.first; idx; idx = idx->next) {
+end:
+    free(ptrs);
+    free(sizes);
+    free(digests);
+    return ret;
+}
+
+/* Check runs of small chunks together, so they can be hashed side by side,
+ * and stream anything bigger through a small buffer */
+static bool validate_small_chunks(zckCtx *zck, zckChunk **idx,
+                                  zck_log_type bad_checksums, bool *all_good,
+                                  const bool *unwritten, char **run_buf) {
+    size_t count = 0;
+    size_t length = 0;
+    zckChunk *next = *idx;
+    while(next && length + next->comp_length <= VALIDATE_SLICE_SIZE &&
+          !(unwritten && unwritten[next->number])) {
+        length += next->comp_length;
+        count++;
+        next = next->next;
+    }
+    if(count < 2)
+        return true;
+
+    if(zck->src_buf == NULL && *run_buf == NULL) {
+        *run_buf = zmalloc(VALIDATE_SLICE_SIZE);
+        if(!*run_buf) {
+            zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            return false;
+        }
+    }
+    const char *data = NULL;
+    size_t available = 0;
+    if(!read_run(zck, *run_buf, length, &data, &available))
+        return false;
+    if(!zck->has_uncompressed_source && !zck->has_tree_digest &&
+       available > 0 &&
+       !hash_update(zck, &(zck->check_full_hash), data, available))
+        return false;
+
+    int *valid = zmalloc(count * sizeof(int));
+    if(!valid) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    bool ret = validate_run(zck, *idx, count, data, available, bad_checksums,
+                            valid);
+    for(size_t i=0; ret && i<count; i++, *idx = (*idx)->next) {
+        (*idx)->valid = valid[i];
+        if(valid[i] != 1)
+            *all_good = false;
+    }
+    free(valid);
+    return ret;
+}
+
+/* Read idx from the current position into check_chunk_hash, and into
+ * check_full_hash as well if full is set */
+static bool hash_chunk(zckCtx *zck, zckChunk *idx, char *buf, bool full) {
+    if(!hash_init(zck, &(zck->check_chunk_hash), &(zck->chunk_hash_type)))
+        return false;
+
+    /* When reading from memory, hash the whole chunk in place */
+    size_t rlen = 0;
+    while(rlen < idx->comp_length) {
+        size_t rsize = idx->comp_length - rlen;
+        if(zck->src_buf == NULL && rsize > BUF_SIZE)
+            rsize = BUF_SIZE;
+        const char *data = NULL;
+        ssize_t rb = read_data_ptr(zck, &data, buf, rsize);
+        if(rb < 0)
+            return false;
+        if(rb != rsize) {
+            zck_log(ZCK_LOG_DEBUG, "No more data");
+            /* Only hash what's left in memory, failing the checksum */
+            if(data != buf) {
+                if(rb == 0)
+                    break;
+                rsize = rb;
+            }
+        }
+        if(!hash_update(zck, &(zck->check_chunk_hash), data, rsize))
+            return false;
+        if(full && !hash_update(zck, &(zck->check_full_hash), data, rsize))
+            return false;
+        rlen += rsize;
+    }
+    return true;
+}
+
+/* Check each chunk in turn, skipping past any that haven't been written */
+static bool validate_chunks(zckCtx *zck, zck_log_type bad_checksums,
+                            bool *all_good, const bool *unwritten) {
+    bool ret = false;
+    char buf[BUF_SIZE] = {0};
+    char *run_buf = NULL;
+    bool skipped = false;
+
+    zckChunk *idx = zck->index.first;
+    while(idx) {
         if(idx == zck->index.first && idx->length == 0) {
             idx->valid = 1;
             if(zck->header_only)
                 break;
+            idx = idx->next;
             continue;
         }
+        if(unwritten && unwritten[idx->number]) {
+            idx->valid = 0;
+            *all_good = false;
+            skipped = true;
+            idx = idx->next;
+            continue;
+        }
+        if(skipped) {
+            if(!seek_data(zck, zck->data_offset + idx->start, SEEK_SET))
+                goto end;
+            skipped = false;
+        }
 
-        if(!hash_init(zck, &(zck->check_chunk_hash), &(zck->chunk_hash_type)))
-            return 0;
-
-        size_t rlen = 0;
-        while(rlen < idx->comp_length) {
-            size_t rsize = BUF_SIZE;
-            if(BUF_SIZE > idx->comp_length - rlen)
-                rsize = idx->comp_length - rlen;
-            if(read_data(zck, buf, rsize) != rsize)
-                zck_log(ZCK_LOG_DEBUG, "No more data");
-            if(!hash_update(zck, &(zck->check_chunk_hash), buf, rsize))
-                return 0;
-            if(!zck->has_uncompressed_source) {
-                if(!hash_update(zck, &(zck->check_full_hash), buf, rsize))
-                    return 0;
-            }
-            rlen += rsize;
+        if(!zck->header_only) {
+            zckChunk *first = idx;
+            if(!validate_small_chunks(zck, &idx, bad_checksums, all_good,
+                                      unwritten, &run_buf))
+                goto end;
+            if(idx != first)
+                continue;
         }
-        int valid_chunk = validate_chunk(idx, bad_checksums);
+
+        if(!hash_chunk(zck, idx, buf, !zck->has_uncompressed_source &&
+                                      !zck->has_tree_digest))
+            goto end;
+        int valid_chunk = validate_chunk(zck, idx, bad_checksums);
         if(!valid_chunk)
-            return 0;
+            goto end;
         idx->valid = valid_chunk;
-        if(all_good && valid_chunk != 1)
-            all_good = false;
+        if(*all_good && valid_chunk != 1)
+            *all_good = false;
         if(zck->header_only)
             break;
+        idx = idx->next;
+    }
+    ret = true;
+
+end:
+    free(run_buf);
+    return ret;
+}
+
+/* Read a slice using the worker's own reader and check its chunks */
+static bool validate_slice(zckCtx *zck, validateJob *job, validateSlice *s) {
+    zckChunk *chunks = job->zck->index.chunks;
+
+    if(!seek_data(zck, zck_get_chunk_start(&(chunks[s->first])), SEEK_SET))
+        return false;
+    if(!read_run(zck, s->buf, s->length, &(s->data), &(s->available)))
+        return false;
+    return validate_run(zck, &(chunks[s->first]), s->count, s->data,
+                        s->available, job->bad_checksums,
+                        job->valid + s->first);
+}
+
+/* Item 0 adds the previous batch to the data checksum, in order, while the
+ * other workers check the chunks in this batch */
+static bool validate_item(void *arg, size_t item, int worker) {
+    validateJob *job = arg;
+
+    if(job->hash_count > 0) {
+        if(item == 0) {
+            for(size_t i=0; i<job->hash_count; i++) {
+                validateSlice *s = &(job->hash_slices[i]);
+                if(s->available > 0 &&
+                   !hash_update(job->zck, &(job->zck->check_full_hash),
+                                s->data, s->available))
+                    return false;
+            }
+            return true;
+        }
+        item--;
+    }
+    return validate_slice(&(job->readers[worker]->zck), job,
+                          &(job->slices[item]));
+}
+
+/* Like validate_chunks(), but with workers reading and checking slices of
+ * the data section in parallel.  Batches are read into two buffers in turn,
+ * so the data checksum can be built from the last batch while the next one
+ * is being checked */
+static bool validate_chunks_threaded(zckCtx *zck, zck_log_type bad_checksums,
+                                     bool *all_good, const bool *unwritten) {
+    bool ret = false;
+    int threads = get_thread_count(zck);
+    size_t count = zck->index.chunks_count;
+    zckChunk *chunks = zck->index.chunks;
+    validateSlice *slices[2] = {NULL, NULL};
+    char *bufs[2] = {NULL, NULL};
+    size_t buf_sizes[2] = {0, 0};
+    validateJob job = {0};
+    /* Readers are only created once a batch has the slices to need them */
+    int reader_count = 0;
+    zckReader **readers = zmalloc(threads * sizeof(zckReader *));
+    int *valid = zmalloc(count * sizeof(int));
+    slices[0] = zmalloc(count * sizeof(validateSlice));
+    slices[1] = zmalloc(count * sizeof(validateSlice));
+    if(!readers || !valid || !slices[0] || !slices[1]) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        goto end;
+    }
+
+    job.zck = zck;
+    job.readers = readers;
+    job.bad_checksums = bad_checksums;
+    job.valid = valid;
+    int cur = 0;
+    size_t next = 0;
+    while(next < count || job.hash_count > 0) {
+        /* Split the next batch into slices */
+        size_t first = next;
+        size_t batch_size = 0;
+        job.slices = slices[cur];
+        job.slice_count = 0;
+        while(next < count && batch_size < VALIDATE_BATCH_SIZE) {
+            /* Unwritten chunks are left as missing */
+            if(unwritten && unwritten[next]) {
+                next++;
+                continue;
+            }
+            if(batch_size > 0 &&
+               batch_size + chunks[next].comp_length > VALIDATE_BATCH_SIZE)
+                break;
+            validateSlice *s = &(job.slices[job.slice_count++]);
+            memset(s, 0, sizeof(validateSlice));
+            s->first = next;
+            s->offset = batch_size;
+            do {
+                s->length += chunks[next].comp_length;
+                s->count++;
+                next++;
+            } while(next < count && !(unwritten && unwritten[next]) &&
+                    s->length + chunks[next].comp_length <=
+                        VALIDATE_SLICE_SIZE &&
+                    batch_size + s->length + chunks[next].comp_length <=
+                        VALIDATE_BATCH_SIZE);
+            batch_size += s->length;
+        }
+        if(zck->src_buf == NULL && buf_sizes[cur] < batch_size) {
+            free(bufs[cur]);
+            bufs[cur] = zmalloc(batch_size);
+            if(!bufs[cur]) {
+                buf_sizes[cur] = 0;
+                zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+                goto end;
+            }
+            buf_sizes[cur] = batch_size;
+        }
+        for(size_t i=0; i<job.slice_count; i++)
+            if(bufs[cur])
+                job.slices[i].buf = bufs[cur] + job.slices[i].offset;
+
+        size_t items = job.slice_count + (job.hash_count > 0 ? 1 : 0);
+        /* parallel_for() never has more workers than items */
+        for(; reader_count < threads && reader_count < items; reader_count++) {
+            readers[reader_count] = zck_reader_create(zck);
+            if(readers[reader_count] == NULL)
+                goto end;
+        }
+        if(!parallel_for(items, threads, validate_item, &job)) {
+            for(int i=0; i<reader_count; i++) {
+                if(zck_is_error(&(readers[i]->zck))) {
+                    copy_error(zck, &(readers[i]->zck));
+                    break;
+                }
+            }
+            goto end;
+        }
+        for(size_t i=first; i<next; i++) {
+            chunks[i].valid = valid[i];
+            if(valid[i] != 1)
+                *all_good = false;
+        }
+
+        /* The data checksum is meaningless with an uncompressed source,
+         * doesn't need the data if it's a tree checksum, and won't be checked
+         * if any chunk failed */
+        job.hash_slices = job.slices;
+        job.hash_count = job.slice_count;
+        if(zck->has_uncompressed_source || zck->has_tree_digest || !*all_good)
+            job.hash_count = 0;
+        cur = 1 - cur;
+    }
+    ret = true;
+
+end:
+    if(readers)
+        for(int i=0; i<reader_count; i++)
+            zck_reader_free(&(readers[i]));
+    free(readers);
+    free(valid);
+    free(slices[0]);
+    free(slices[1]);
+    free(bufs[0]);
+    free(bufs[1]);
+    return ret;
+}
+
+/* Find chunks that can't have been written yet, so they can be marked as
+ * missing without reading them.  Returns NULL if there aren't any */
+static bool *get_unwritten_chunks(zckCtx *zck) {
+    if(zck->header_only || zck->index.count == 0)
+        return NULL;
+    bool *unwritten = zmalloc(zck->index.count * sizeof(bool));
+    if(!unwritten) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return NULL;
+    }
+    size_t count = find_unwritten_chunks(zck, unwritten);
+    if(count == 0) {
+        free(unwritten);
+        return NULL;
     }
+    zck_log(ZCK_LOG_DEBUG, "Skipping %llu chunks that haven't been written",
+            (long long unsigned) count);
+    return unwritten;
+}
+
+/* If find_missing is set, chunks that haven't been written yet are marked
+ * as missing rather than read and failed */
+static int validate_checksums(zckCtx *zck, zck_log_type bad_checksums,
+                              bool find_missing) {
+    VALIDATE_READ_BOOL(zck);
+    if(!index_load(zck))
+        return 0;
+
+    if(zck->data_offset == 0) {
+        set_error(zck, "Header hasn't been read yet");
+        return 0;
+    }
+
+    if(!hash_init(zck, &(zck->check_full_hash), &(zck->hash_type)))
+        return 0;
+
+    if(!seek_data(zck, zck->data_offset, SEEK_SET))
+        return 0;
+
+    /* Workers read from the file using their own position, so it has to be
+     * seekable */
+    bool threaded = get_thread_count(zck) > 1 && !zck->header_only &&
+                    zck->index.chunks_count > 0;
+#ifndef _WIN32
+    threaded = threaded &&
+               (zck->src_buf != NULL || lseek(zck->fd, 0, SEEK_CUR) != -1);
+#endif
+
+    /* Check each chunk checksum */
+    bool all_good = true;
+    bool *unwritten = find_missing ? get_unwritten_chunks(zck) : NULL;
+    bool checked = false;
+    if(threaded)
+        checked = validate_chunks_threaded(zck, bad_checksums, &all_good,
+                                           unwritten);
+    else
+        checked = validate_chunks(zck, bad_checksums, &all_good, unwritten);
+    free(unwritten);
+    if(!checked)
+        return 0;
     int valid_file = -1;
     if(zck->has_uncompressed_source || zck->header_only) {
         /* If we have an uncompressed source or are a detached header,
@@ -122,8 +536,8 @@ static int validate_checksums(zckCtx *zck, zck_log_type bad_checksums) {
 
             /* If data checksum failed, invalidate *all* chunks */
             if(valid_file == -1)
-                for(zckChunk *idx = zck->index.first; idx; idx = idx->next)
-                    idx->valid = -1;
+                for(size_t i=0; i<zck->index.chunks_count; i++)
+                    zck->index.chunks[i].valid = -1;
         }
     }
 
@@ -183,21 +597,43 @@ bool hash_setup(zckCtx *zck, zckHashType *ht, int h) {
         zck_log(ZCK_LOG_DEBUG, "Setting up hash type %s",
                 zck_hash_name_from_type(ht->type));
         return true;
+    } else if(h >= ZCK_HASH_BLAKE3 &&
+              h <= ZCK_HASH_BLAKE3_128) {
+        memset(ht, 0, sizeof(zckHashType));
+        ht->type = h;
+        if(h == ZCK_HASH_BLAKE3)
+            ht->digest_size = BLAKE3_OUT_LEN;
+        else if(h == ZCK_HASH_BLAKE3_128)
+            ht->digest_size = 16;
+        zck_log(ZCK_LOG_DEBUG, "Setting up hash type %s",
+                zck_hash_name_from_type(ht->type));
+        return true;
     }
     set_error(zck, "Unsupported hash type: %s", zck_hash_name_from_type(h));
     return false;
 }
 
+static bool blake3_hash_update(zckCtx *zck, zckHash *hash,
+                               const char *message, size_t size) {
+    blake3_hasher_update(&(hash->ctx.blake3), message, size);
+    return true;
+}
+
+static bool blake3_hash_final(zckCtx *zck, zckHash *hash, char *digest) {
+    blake3_hasher_finalize(&(hash->ctx.blake3), (uint8_t *)digest,
+                           BLAKE3_OUT_LEN);
+    return true;
+}
+
 void hash_close(zckHash *hash)
 {
     if(!hash)
         return;
 
-    if(hash->ctx) {
-        lib_hash_ctx_close(hash);
-        hash->ctx = NULL;
-    }
+    lib_hash_ctx_close(hash);
     hash->type = NULL;
+    hash->update = NULL;
+    hash->final = NULL;
     return;
 }
 
@@ -206,16 +642,30 @@ void hash_reset(zckHashType *ht) {
     return;
 }
 
+/* Start a new digest.  Anything the last one left behind is reused, so this
+ * doesn't allocate unless OpenSSL needs a new context */
 bool hash_init(zckCtx *zck, zckHash *hash, zckHashType *hash_type) {
-    hash_close(hash);
     if(hash == NULL || hash_type == NULL) {
         set_error(zck, "Either zckHash or zckHashType struct is null");
+        hash_close(hash);
         return false;
     }
 
     hash->type = hash_type;
 
-    return lib_hash_init(zck, hash);
+    if(hash_type->type >= ZCK_HASH_BLAKE3 &&
+       hash_type->type <= ZCK_HASH_BLAKE3_128) {
+        zck_log(ZCK_LOG_DDEBUG, "Initializing BLAKE3 hash");
+        blake3_hasher_init(&(hash->ctx.blake3));
+        hash->update = blake3_hash_update;
+        hash->final = blake3_hash_final;
+        return true;
+    }
+    if(!lib_hash_init(zck, hash)) {
+        hash->type = NULL;
+        return false;
+    }
+    return true;
 }
 
 bool hash_update(zckCtx *zck, zckHash *hash, const char *message,
@@ -234,20 +684,52 @@ bool hash_update(zckCtx *zck, zckHash *hash, const char *message,
                   "Hash data is supposed to be 0-length, but is not NULL");
         return false;
     }
-    if(hash && hash->ctx && hash->type) {
-        return lib_hash_update(zck, hash, message, size);
+    if(hash && hash->type) {
+        if(!hash->update(zck, hash, message, size)) {
+            hash->type = NULL;
+            return false;
+        }
+        return true;
     }
     set_error(zck, "Hash hasn't been initialized");
     return false;
 }
 
+/* Write the digest, truncated to the hash type's digest size, to digest.
+ * The hash has to be initialized again before it can be reused */
+bool hash_final(zckCtx *zck, zckHash *hash, char *digest) {
+    if(!hash || !hash->type) {
+        set_error(zck, "Hash hasn't been initialized");
+        return false;
+    }
+    char full[MAX_DIGEST_SIZE];
+    bool ret = hash->final(zck, hash, full);
+    if(ret)
+        memcpy(digest, full, hash->type->digest_size);
+    hash->type = NULL;
+    return ret;
+}
+
+/* Like hash_final(), but returns the digest in a newly allocated buffer and
+ * frees everything the hash was using */
 char *hash_finalize(zckCtx *zck, zckHash *hash) {
-    if(!hash || !hash->ctx || !hash->type) {
+    if(!hash || !hash->type) {
         set_error(zck, "Hash hasn't been initialized");
         hash_close(hash);
         return NULL;
     }
-    return lib_hash_final(zck, hash);
+    char *digest = zmalloc(hash->type->digest_size);
+    if (!digest) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        hash_close(hash);
+        return NULL;
+    }
+    if(!hash_final(zck, hash, digest)) {
+        free(digest);
+        digest = NULL;
+    }
+    hash_close(hash);
+    return digest;
 }
 
 bool set_full_hash_type(zckCtx *zck, int hash_type) {
@@ -269,6 +751,11 @@ bool set_full_hash_type(zckCtx *zck, int hash_type) {
 bool set_chunk_hash_type(zckCtx *zck, int hash_type) {
     VALIDATE_BOOL(zck);
 
+    /* The index's digests are laid out for the current chunk hash */
+    if(zck->index.chunks_count > 0 && hash_type != zck->index.hash_type) {
+        set_error(zck, "Chunk hash can't change once there are chunks");
+        return false;
+    }
     memset(&(zck->chunk_hash_type), 0, sizeof(zckHashType));
     zck_log(ZCK_LOG_DEBUG, "Setting chunk hash to %s",
             zck_hash_name_from_type(hash_type));
@@ -281,52 +768,75 @@ bool set_chunk_hash_type(zckCtx *zck, int hash_type) {
     return true;
 }
 
-/* Validate chunk, returning -1 if checksum fails, 1 if good, 0 if error */
-int validate_chunk(zckChunk *idx, zck_log_type bad_checksum) {
-    zckCtx *zck = NULL;
-    if(idx && idx->zck) {
-        VALIDATE_INT(idx->zck);
-        zck = idx->zck;
-    }
+/* Validate chunk against zck's chunk checksum, returning -1 if checksum fails,
+ * 1 if good, 0 if error.  The chunk is only marked as valid or invalid if zck
+ * is the context it belongs to, as readers share their parent's index */
+int validate_chunk(zckCtx *zck, zckChunk *idx, zck_log_type bad_checksum) {
+    VALIDATE_INT(zck);
     ALLOCD_INT(zck, idx);
 
-    char *digest = hash_finalize(zck, &(zck->check_chunk_hash));
-    if(digest == NULL) {
+    char digest[MAX_DIGEST_SIZE];
+    if(!hash_final(zck, &(zck->check_chunk_hash), digest)) {
         set_error(zck, "Unable to calculate chunk checksum");
-        idx->valid = 0;
+        if(zck == idx->zck)
+            idx->valid = 0;
         return 0;
     }
+    return validate_chunk_digest(zck, idx, digest, bad_checksum);
+}
+
+/* Like validate_chunk(), but against a digest that has already been
+ * calculated.  An empty chunk's digest is set to zeros */
+int validate_chunk_digest(zckCtx *zck, zckChunk *idx, char *digest,
+                          zck_log_type bad_checksum) {
+    VALIDATE_INT(zck);
+    ALLOCD_INT(zck, idx);
+    ALLOCD_INT(zck, digest);
+
+    bool owner = (zck == idx->zck);
     if(idx->comp_length == 0)
         memset(digest, 0, idx->digest_size);
-    char *pdigest = zck_get_chunk_digest(idx);
-    zck_log(ZCK_LOG_DDEBUG, "Expected chunk checksum:   %s", pdigest);
-    free(pdigest);
-    pdigest = get_digest_string(digest, idx->digest_size);
-    zck_log(ZCK_LOG_DDEBUG, "Calculated chunk checksum: %s", pdigest);
-    free(pdigest);
+    if(zck_log_enabled(ZCK_LOG_DDEBUG)) {
+        char *pdigest = zck_get_chunk_digest(idx);
+        zck_log(ZCK_LOG_DDEBUG, "Expected chunk checksum:   %s", pdigest);
+        free(pdigest);
+        pdigest = get_digest_string(digest, idx->digest_size);
+        zck_log(ZCK_LOG_DDEBUG, "Calculated chunk checksum: %s", pdigest);
+        free(pdigest);
+    }
     if(memcmp(digest, idx->digest, idx->digest_size) != 0) {
-        free(digest);
         if(idx->number == -1)
             zck_log(bad_checksum, "Chunk checksum: FAILED!");
         else
             zck_log(bad_checksum, "Chunk %i's checksum: FAILED",
                     idx->number);
-        idx->valid = -1;
+        if(owner)
+            idx->valid = -1;
         return -1;
     }
     if(idx->number == -1)
         zck_log(ZCK_LOG_DEBUG, "Chunk checksum: valid");
     else
         zck_log(ZCK_LOG_DEBUG, "Chunk %i's checksum: valid", idx->number);
-    free(digest);
-    idx->valid = 1;
+    if(owner)
+        idx->valid = 1;
     return 1;
 }
 
 int validate_current_chunk(zckCtx *zck) {
     VALIDATE_BOOL(zck);
 
-    return validate_chunk(zck->comp.data_idx, ZCK_LOG_ERROR);
+    return validate_chunk(zck, zck->comp.data_idx, ZCK_LOG_ERROR);
+}
+
+/* Hash the chunk checksums in order, including the dictionary's */
+bool hash_tree(zckCtx *zck, zckHash *hash) {
+    if(!index_load(zck) || !hash_init(zck, hash, &(zck->hash_type)))
+        return false;
+    for(zckChunk *idx = zck->index.first; idx; idx = idx->next)
+        if(!hash_update(zck, hash, idx->digest, idx->digest_size))
+            return false;
+    return true;
 }
 
 int validate_file(zckCtx *zck, zck_log_type bad_checksums) {
@@ -338,6 +848,10 @@ int validate_file(zckCtx *zck, zck_log_type bad_checksums) {
         );
         return 1;
     }
+    /* A tree checksum comes from the index, so it only vouches for the data
+     * once the chunks have been checked */
+    if(zck->has_tree_digest && !hash_tree(zck, &(zck->check_full_hash)))
+        return 0;
     char *digest = hash_finalize(zck, &(zck->check_full_hash));
     if(digest == NULL) {
         set_error(zck, "Unable to calculate full file checksum");
@@ -356,6 +870,19 @@ int validate_file(zckCtx *zck, zck_log_type bad_checksums) {
         zck_log(bad_checksums, "Data checksum failed!");
         return -1;
     }
+    /* The tree checksum matching only says the index is intact, so every
+     * chunk has to have been checked against it as well */
+    if(zck->has_tree_digest) {
+        for(zckChunk *idx = zck->index.first; idx; idx = idx->next) {
+            if(idx->valid == 1 ||
+               (idx == zck->index.first && idx->length == 0))
+                continue;
+            free(digest);
+            zck_log(bad_checksums, "Chunk %i hasn't been verified, so data "
+                                   "checksum can't be trusted", idx->number);
+            return -1;
+        }
+    }
     zck_log(ZCK_LOG_DEBUG, "Data checksum valid");
     free(digest);
     return 1;
@@ -397,9 +924,13 @@ int validate_header(zckCtx *zck) {
  * each chunk checksum independently, since there is no data hash */
 int ZCK_PUBLIC_API zck_validate_data_checksum(zckCtx *zck) {
     VALIDATE_READ_BOOL(zck);
+    if(!index_load(zck))
+        return 0;
 
-    if(zck->has_uncompressed_source) {
-        return validate_checksums(zck, ZCK_LOG_WARNING);
+    /* A tree data checksum only covers the data through the chunk
+     * checksums */
+    if(zck->has_uncompressed_source || zck->has_tree_digest) {
+        return validate_checksums(zck, ZCK_LOG_WARNING, false);
     }
 
     if(!seek_data(zck, zck->data_offset, SEEK_SET))
@@ -412,14 +943,16 @@ int ZCK_PUBLIC_API zck_validate_data_checksum(zckCtx *zck) {
     while(idx) {
         size_t to_read = idx->comp_length;
         while(to_read > 0) {
-            size_t rb = BUF_SIZE;
-            if(rb > to_read)
-                rb = to_read;
-            if(!read_data(zck, buf, rb))
+            size_t rb = to_read;
+            if(zck->src_buf == NULL && rb > BUF_SIZE)
+                rb = BUF_SIZE;
+            const char *data = NULL;
+            ssize_t rs = read_data_ptr(zck, &data, buf, rb);
+            if(rs < 1)
                 return 0;
-            if(!hash_update(zck, &(zck->check_full_hash), buf, rb))
+            if(!hash_update(zck, &(zck->check_full_hash), data, rs))
                 return 0;
-            to_read -= rb;
+            to_read -= rs;
         }
         idx = idx->next;
     }
@@ -488,16 +1021,68 @@ char ZCK_PUBLIC_API *zck_get_chunk_digest_uncompressed(zckChunk *item) {
 }
 
 
+/* Only check the chunks the validity journal doesn't have as verified.
+ * If they all turn out to be valid, everything is checked again, since the
+ * data checksum still needs to be */
+static int validate_journaled(zckCtx *zck, zck_log_type bad_checksums) {
+    char buf[BUF_SIZE] = {0};
+    bool all_good = true;
+    bool *unwritten = get_unwritten_chunks(zck);
+
+    for(zckChunk *idx = zck->index.first; idx; idx = idx->next) {
+        if(idx == zck->index.first && idx->length == 0) {
+            idx->valid = 1;
+            continue;
+        }
+        if(unwritten && unwritten[idx->number]) {
+            idx->valid = 0;
+            all_good = false;
+            continue;
+        }
+        if(idx->valid == 1)
+            continue;
+        if(!seek_data(zck, zck->data_offset + idx->start, SEEK_SET) ||
+           !hash_chunk(zck, idx, buf, false)) {
+            free(unwritten);
+            return 0;
+        }
+        idx->valid = validate_chunk(zck, idx, bad_checksums);
+        if(!idx->valid) {
+            free(unwritten);
+            return 0;
+        }
+        if(idx->valid != 1)
+            all_good = false;
+    }
+    free(unwritten);
+    if(all_good)
+        return validate_checksums(zck, bad_checksums, true);
+
+    if(!seek_data(zck, zck->data_offset, SEEK_SET) ||
+       !hash_init(zck, &(zck->check_full_hash), &(zck->hash_type)))
+        return 0;
+    return -1;
+}
+
 /* Returns 1 if all chunks are valid, -1 if even one isn't and 0 if error */
 int ZCK_PUBLIC_API zck_find_valid_chunks(zckCtx *zck) {
     VALIDATE_READ_BOOL(zck);
+    if(!index_load(zck))
+        return 0;
 
-    return validate_checksums(zck, ZCK_LOG_DEBUG);
+    int ret = 0;
+    if(zck->data_offset > 0 && journal_apply(zck))
+        ret = validate_journaled(zck, ZCK_LOG_DEBUG);
+    else
+        ret = validate_checksums(zck, ZCK_LOG_DEBUG, true);
+    if(ret)
+        journal_save(zck);
+    return ret;
 }
 
 /* Returns 1 if all checksums matched, -1 if even one doesn't and 0 if error */
 int ZCK_PUBLIC_API zck_validate_checksums(zckCtx *zck) {
     VALIDATE_READ_BOOL(zck);
 
-    return validate_checksums(zck, ZCK_LOG_WARNING);
+    return validate_checksums(zck, ZCK_LOG_WARNING, false);
 }
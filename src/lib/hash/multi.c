@@ -0,0 +1,465 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Multi-buffer SHA-256 and SHA-512.  A single message can't keep the vector
+ * units busy, as each round depends on the one before, so instead each SIMD
+ * lane works on its own message.  Lanes are refilled as their messages end,
+ * longest messages first, so few lanes sit idle at the end of a run */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef ZCHUNK_THREADS
+#include <pthread.h>
+#endif
+#include <zck.h>
+
+#include "zck_private.h"
+
+#define MAX_LANES 16
+#define MAX_BLOCK_SIZE 128
+
+/* Process one block from each of ptr[0..lanes-1].  state holds the eight
+ * working variables, each as a run of one word per lane */
+typedef void (*mb_transform)(void *state, const unsigned char **ptr);
+
+typedef struct mbAlgo {
+    mb_transform transform;
+    int lanes;
+    int word_size;
+    int block_size;
+    /* Size of the message length at the end of the padding */
+    int length_size;
+    const void *iv;
+} mbAlgo;
+
+typedef struct mbMessage {
+    size_t size;
+    size_t index;
+} mbMessage;
+
+static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint64_t sha512_iv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+#ifdef ZCHUNK_X86_SIMD
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t sha512_k[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+    0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+    0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+    0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+    0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+    0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+    0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+    0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+    0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+    0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+    0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+    0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+    0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+    0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+    0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+    0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+    0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+    0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+    0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+    0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+/* The transforms are written with the compiler's vector extensions, so the
+ * same code builds for AVX2 and AVX-512 depending on the vector size */
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+typedef uint32_t v16u32 __attribute__((vector_size(64)));
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+typedef uint64_t v8u64 __attribute__((vector_size(64)));
+
+#define TARGET_AVX2   __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+
+#define ROR(x, n, bits) (((x) >> (n)) | ((x) << ((bits) - (n))))
+
+/* Round j, extending the message schedule in w[] as it goes */
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, j)                           \
+{                                                                         \
+    if((j) >= 16)                                                         \
+        w[(j) & 15] += (ROR(w[((j) - 2) & 15], 17, 32) ^                  \
+                        ROR(w[((j) - 2) & 15], 19, 32) ^                  \
+                        (w[((j) - 2) & 15] >> 10)) +                      \
+                       w[((j) - 7) & 15] +                                \
+                       (ROR(w[((j) - 15) & 15], 7, 32) ^                  \
+                        ROR(w[((j) - 15) & 15], 18, 32) ^                 \
+                        (w[((j) - 15) & 15] >> 3));                       \
+    t1 = h + (ROR(e, 6, 32) ^ ROR(e, 11, 32) ^ ROR(e, 25, 32)) +          \
+         (g ^ (e & (f ^ g))) + sha256_k[j] + w[(j) & 15];                 \
+    t2 = (ROR(a, 2, 32) ^ ROR(a, 13, 32) ^ ROR(a, 22, 32)) +              \
+         ((a & b) | (c & (a | b)));                                       \
+    d += t1;                                                              \
+    h = t1 + t2;                                                          \
+}
+
+#define SHA512_ROUND(a, b, c, d, e, f, g, h, j)                           \
+{                                                                         \
+    if((j) >= 16)                                                         \
+        w[(j) & 15] += (ROR(w[((j) - 2) & 15], 19, 64) ^                  \
+                        ROR(w[((j) - 2) & 15], 61, 64) ^                  \
+                        (w[((j) - 2) & 15] >> 6)) +                       \
+                       w[((j) - 7) & 15] +                                \
+                       (ROR(w[((j) - 15) & 15], 1, 64) ^                  \
+                        ROR(w[((j) - 15) & 15], 8, 64) ^                  \
+                        (w[((j) - 15) & 15] >> 7));                       \
+    t1 = h + (ROR(e, 14, 64) ^ ROR(e, 18, 64) ^ ROR(e, 41, 64)) +         \
+         (g ^ (e & (f ^ g))) + sha512_k[j] + w[(j) & 15];                 \
+    t2 = (ROR(a, 28, 64) ^ ROR(a, 34, 64) ^ ROR(a, 39, 64)) +             \
+         ((a & b) | (c & (a | b)));                                       \
+    d += t1;                                                              \
+    h = t1 + t2;                                                          \
+}
+
+/* One block for each lane.  The message words are gathered into tw[] with
+ * one row per word, so each row can be loaded as a vector */
+#define MB_TRANSFORM(vec, word, bswap, lanes, rounds, ROUND)              \
+{                                                                         \
+    word *st = state;                                                     \
+    word tw[16][lanes];                                                   \
+    vec s[8], a, b, c, d, e, f, g, h, t1, t2, w[16];                      \
+    int i, j;                                                             \
+                                                                          \
+    for(i = 0; i < lanes; i++) {                                          \
+        for(j = 0; j < 16; j++) {                                         \
+            word x;                                                       \
+            memcpy(&x, ptr[i] + j * sizeof(word), sizeof(word));          \
+            tw[j][i] = bswap(x);                                          \
+        }                                                                 \
+    }                                                                     \
+    memcpy(w, tw, sizeof(w));                                             \
+    memcpy(s, st, sizeof(s));                                             \
+                                                                          \
+    a = s[0]; b = s[1]; c = s[2]; d = s[3];                               \
+    e = s[4]; f = s[5]; g = s[6]; h = s[7];                               \
+    for(j = 0; j < rounds; j += 8) {                                      \
+        ROUND(a, b, c, d, e, f, g, h, j);                                 \
+        ROUND(h, a, b, c, d, e, f, g, j + 1);                             \
+        ROUND(g, h, a, b, c, d, e, f, j + 2);                             \
+        ROUND(f, g, h, a, b, c, d, e, j + 3);                             \
+        ROUND(e, f, g, h, a, b, c, d, j + 4);                             \
+        ROUND(d, e, f, g, h, a, b, c, j + 5);                             \
+        ROUND(c, d, e, f, g, h, a, b, j + 6);                             \
+        ROUND(b, c, d, e, f, g, h, a, j + 7);                             \
+    }                                                                     \
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;                           \
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;                           \
+    memcpy(st, s, sizeof(s));                                             \
+}
+
+TARGET_AVX2
+static void sha256_x8_avx2(void *state, const unsigned char **ptr)
+    MB_TRANSFORM(v8u32, uint32_t, __builtin_bswap32, 8, 64, SHA256_ROUND)
+
+TARGET_AVX512
+static void sha256_x16_avx512(void *state, const unsigned char **ptr)
+    MB_TRANSFORM(v16u32, uint32_t, __builtin_bswap32, 16, 64, SHA256_ROUND)
+
+TARGET_AVX2
+static void sha512_x4_avx2(void *state, const unsigned char **ptr)
+    MB_TRANSFORM(v4u64, uint64_t, __builtin_bswap64, 4, 80, SHA512_ROUND)
+
+TARGET_AVX512
+static void sha512_x8_avx512(void *state, const unsigned char **ptr)
+    MB_TRANSFORM(v8u64, uint64_t, __builtin_bswap64, 8, 80, SHA512_ROUND)
+
+static const mbAlgo algos[] = {
+    {sha256_x8_avx2, 8, 4, 64, 8, sha256_iv},
+    {sha256_x16_avx512, 16, 4, 64, 8, sha256_iv},
+    {sha512_x4_avx2, 4, 8, 128, 16, sha512_iv},
+    {sha512_x8_avx512, 8, 8, 128, 16, sha512_iv}
+};
+
+#endif /* ZCHUNK_X86_SIMD */
+
+static const mbAlgo *sha256_algo = NULL;
+static const mbAlgo *sha512_algo = NULL;
+
+#ifdef ZCHUNK_THREADS
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+#else
+static bool selected = false;
+#endif
+
+/* With the SHA extensions, a single SHA-256 message is already faster than
+ * eight AVX2 lanes */
+static void select_algos(void) {
+#ifdef ZCHUNK_X86_SIMD
+    int cpu = cpu_features();
+
+    if(cpu & CPU_AVX512) {
+        sha256_algo = &algos[1];
+        sha512_algo = &algos[3];
+    } else if(cpu & CPU_AVX2) {
+        if(!(cpu & CPU_SHA))
+            sha256_algo = &algos[0];
+        sha512_algo = &algos[2];
+    }
+#endif
+}
+
+static void select_once_only(void) {
+#ifdef ZCHUNK_THREADS
+    pthread_once(&select_once, select_algos);
+#else
+    if(!selected) {
+        select_algos();
+        selected = true;
+    }
+#endif
+}
+
+static const mbAlgo *get_algo(int hash_type) {
+    select_once_only();
+    if(hash_type == ZCK_HASH_SHA256)
+        return sha256_algo;
+    if(hash_type >= ZCK_HASH_SHA512 && hash_type <= ZCK_HASH_SHA512_128)
+        return sha512_algo;
+    return NULL;
+}
+
+/* Force the number of lanes used for hash_type, or turn multi-buffer hashing
+ * off with 0.  Returns false if the CPU can't do it.  This is for testing,
+ * and isn't thread-safe */
+bool hash_many_set_lanes(int hash_type, int lanes) {
+    const mbAlgo *algo = NULL;
+
+    select_once_only();
+    bool sha256 = (hash_type == ZCK_HASH_SHA256);
+    if(lanes > 0) {
+#ifdef ZCHUNK_X86_SIMD
+        int cpu = cpu_features();
+        for(int i=0; i<sizeof(algos)/sizeof(mbAlgo); i++) {
+            if(algos[i].lanes != lanes ||
+               (algos[i].word_size == 4) != sha256)
+                continue;
+            if((algos[i].transform == sha256_x8_avx2 ||
+                algos[i].transform == sha512_x4_avx2) && (cpu & CPU_AVX2))
+                algo = &algos[i];
+            if((algos[i].transform == sha256_x16_avx512 ||
+                algos[i].transform == sha512_x8_avx512) && (cpu & CPU_AVX512))
+                algo = &algos[i];
+        }
+#endif
+        if(algo == NULL)
+            return false;
+    }
+    if(sha256)
+        sha256_algo = algo;
+    else
+        sha512_algo = algo;
+    return true;
+}
+
+static void set_word(const mbAlgo *algo, void *state, int word, int lane,
+                     uint64_t value) {
+    if(algo->word_size == 4)
+        ((uint32_t *)state)[word * algo->lanes + lane] = value;
+    else
+        ((uint64_t *)state)[word * algo->lanes + lane] = value;
+}
+
+static uint64_t get_word(const mbAlgo *algo, const void *state, int word,
+                         int lane) {
+    if(algo->word_size == 4)
+        return ((const uint32_t *)state)[word * algo->lanes + lane];
+    return ((const uint64_t *)state)[word * algo->lanes + lane];
+}
+
+static int message_cmp(const void *a, const void *b) {
+    const mbMessage *ma = a;
+    const mbMessage *mb = b;
+
+    if(ma->size != mb->size)
+        return ma->size > mb->size ? -1 : 1;
+    return ma->index < mb->index ? -1 : (ma->index > mb->index);
+}
+
+static void hash_lanes(const mbAlgo *algo, const char **data,
+                       const mbMessage *messages, size_t count,
+                       size_t digest_size, char *digests) {
+    static const unsigned char idle[MAX_BLOCK_SIZE] = {0};
+    uint64_t state[8 * MAX_LANES];
+    unsigned char pad[MAX_LANES][2 * MAX_BLOCK_SIZE];
+    const unsigned char *ptr[MAX_LANES];
+    size_t blocks[MAX_LANES];
+    size_t pad_blocks[MAX_LANES];
+    size_t message[MAX_LANES];
+    bool busy[MAX_LANES] = {false};
+    int bs = algo->block_size;
+    size_t next = 0;
+    int active = 0;
+
+    for(int l=0; l<algo->lanes; l++)
+        ptr[l] = idle;
+
+    while(true) {
+        /* Start the next messages on any free lanes */
+        for(int l=0; l<algo->lanes && next<count; l++) {
+            if(busy[l])
+                continue;
+            size_t size = messages[next].size;
+            size_t full = size / bs;
+            size_t rem = size % bs;
+            message[l] = messages[next].index;
+            for(int i=0; i<8; i++) {
+                uint64_t iv = algo->word_size == 4
+                              ? ((const uint32_t *)algo->iv)[i]
+                              : ((const uint64_t *)algo->iv)[i];
+                set_word(algo, state, i, l, iv);
+            }
+
+            /* The rest of the message after the last full block, padding
+             * and the length in bits */
+            pad_blocks[l] = rem + 1 + algo->length_size <= bs ? 1 : 2;
+            memset(pad[l], 0, 2 * bs);
+            if(rem > 0)
+                memcpy(pad[l], data[message[l]] + full * bs, rem);
+            pad[l][rem] = 0x80;
+            uint64_t bits = (uint64_t)size << 3;
+            for(int i=0; i<8; i++)
+                pad[l][pad_blocks[l] * bs - 1 - i] = bits >> (i * 8);
+
+            if(full > 0) {
+                ptr[l] = (const unsigned char *)data[message[l]];
+                blocks[l] = full;
+            } else {
+                ptr[l] = pad[l];
+                blocks[l] = pad_blocks[l];
+                pad_blocks[l] = 0;
+            }
+            busy[l] = true;
+            active++;
+            next++;
+        }
+        if(active == 0)
+            break;
+
+        algo->transform(state, ptr);
+
+        for(int l=0; l<algo->lanes; l++) {
+            if(!busy[l])
+                continue;
+            ptr[l] += bs;
+            if(--blocks[l] > 0)
+                continue;
+            if(pad_blocks[l] > 0) {
+                ptr[l] = pad[l];
+                blocks[l] = pad_blocks[l];
+                pad_blocks[l] = 0;
+                continue;
+            }
+
+            /* Finished, so write out the digest big-endian */
+            char *digest = digests + message[l] * digest_size;
+            for(size_t i=0; i<digest_size; i++) {
+                int word = i / algo->word_size;
+                int shift = (algo->word_size - 1 - i % algo->word_size) * 8;
+                digest[i] = get_word(algo, state, word, l) >> shift;
+            }
+            ptr[l] = idle;
+            busy[l] = false;
+            active--;
+        }
+    }
+}
+
+/* Hash count independent messages, writing the digest of data[i] to
+ * digests + i * hash_type->digest_size.  SHA-256 and SHA-512 messages are
+ * hashed several at a time if the CPU has suitable SIMD instructions,
+ * everything else one at a time */
+bool hash_many(zckCtx *zck, zckHashType *hash_type, const char **data,
+               const size_t *size, size_t count, char *digests) {
+    ALLOCD_BOOL(zck, hash_type);
+
+    const mbAlgo *algo = get_algo(hash_type->type);
+    if(algo == NULL || count < 2) {
+        zckHash hash = {0};
+        bool ret = true;
+        for(size_t i=0; ret && i<count; i++)
+            ret = hash_init(zck, &hash, hash_type) &&
+                  (size[i] == 0 ||
+                   hash_update(zck, &hash, data[i], size[i])) &&
+                  hash_final(zck, &hash,
+                             digests + i * hash_type->digest_size);
+        hash_close(&hash);
+        return ret;
+    }
+
+    mbMessage *messages = zmalloc(count * sizeof(mbMessage));
+    if(!messages) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    for(size_t i=0; i<count; i++) {
+        messages[i].size = size[i];
+        messages[i].index = i;
+    }
+    qsort(messages, count, sizeof(mbMessage), message_cmp);
+    hash_lanes(algo, data, messages, count, hash_type->digest_size, digests);
+    free(messages);
+    return true;
+}
@@ -29,193 +29,141 @@
 #include <stdbool.h>
 #include "openssl.h"
 
+#if defined(ZCHUNK_OPENSSL_DEPRECATED)
+_Static_assert(sizeof(SHA_CTX) <= HASH_SHA_CTX_SIZE &&
+               sizeof(SHA256_CTX) <= HASH_SHA_CTX_SIZE &&
+               sizeof(SHA512_CTX) <= HASH_SHA_CTX_SIZE,
+               "HASH_SHA_CTX_SIZE is too small");
+
+static bool sha1_hash_update(zckCtx *zck, zckHash *hash, const char *message,
+                             size_t size)
+{
+        SHA1_Update((SHA_CTX *)hash->ctx.sha, (const sha1_byte *)message, size);
+        return true;
+}
+
+static bool sha1_hash_final(zckCtx *zck, zckHash *hash, char *digest)
+{
+        SHA1_Final((unsigned char *)digest, (SHA_CTX *)hash->ctx.sha);
+        return true;
+}
+
+static bool sha256_hash_update(zckCtx *zck, zckHash *hash,
+                               const char *message, size_t size)
+{
+        SHA256_Update((SHA256_CTX *)hash->ctx.sha,
+                      (const unsigned char *)message, size);
+        return true;
+}
+
+static bool sha256_hash_final(zckCtx *zck, zckHash *hash, char *digest)
+{
+        SHA256_Final((unsigned char *)digest, (SHA256_CTX *)hash->ctx.sha);
+        return true;
+}
+
+static bool sha512_hash_update(zckCtx *zck, zckHash *hash,
+                               const char *message, size_t size)
+{
+        SHA512_Update((SHA512_CTX *)hash->ctx.sha,
+                      (const unsigned char *)message, size);
+        return true;
+}
+
+static bool sha512_hash_final(zckCtx *zck, zckHash *hash, char *digest)
+{
+        SHA512_Final((unsigned char *)digest, (SHA512_CTX *)hash->ctx.sha);
+        return true;
+}
+
 void lib_hash_ctx_close(zckHash *hash)
 {
-#if defined(ZCHUNK_OPENSSL_DEPRECATED)
-        free(hash->ctx);
-#else
-        EVP_MD_CTX_free(hash->ctx);
-#endif
 }
 
 bool lib_hash_init(zckCtx *zck, zckHash *hash)
 {
-#if defined(ZCHUNK_OPENSSL_DEPRECATED)
-        if(hash->type->type == ZCK_HASH_SHA1) {
-                zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-1 hash");
-                hash->ctx = zmalloc(sizeof(SHA_CTX));
-                if (!hash->ctx) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                SHA1_Init((SHA_CTX *) hash->ctx);
-                return true;
-        } else if(hash->type->type == ZCK_HASH_SHA256) {
-                 zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-256 hash");
-                hash->ctx = zmalloc(sizeof(SHA256_CTX));
-                if (!hash->ctx) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                SHA256_Init((SHA256_CTX *) hash->ctx);
-                return true;
-        } else if(hash->type->type >= ZCK_HASH_SHA512 &&
-                hash->type->type <= ZCK_HASH_SHA512_128) {
-                zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-512 hash");
-                hash->ctx = zmalloc(sizeof(SHA512_CTX));
-                if (!hash->ctx) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                SHA512_Init((SHA512_CTX *) hash->ctx);
-                return true;
-        }
-#else
-        hash->ctx = EVP_MD_CTX_new();
-        if (!hash->ctx) {
-                zck_log(ZCK_LOG_ERROR, "openSSL context create error in %s", __func__);
-                return false;
-        }
-
         if(hash->type->type == ZCK_HASH_SHA1) {
                 zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-1 hash");
-                if (!EVP_DigestInit_ex(hash->ctx, EVP_sha1(), NULL)) {
-                        zck_log(ZCK_LOG_ERROR, "openSSL digest init error in %s", __func__);
-                        hash_close(hash);
-                        return false;
-                }
+                SHA1_Init((SHA_CTX *)hash->ctx.sha);
+                hash->update = sha1_hash_update;
+                hash->final = sha1_hash_final;
                 return true;
         } else if(hash->type->type == ZCK_HASH_SHA256) {
                 zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-256 hash");
-                if (!EVP_DigestInit_ex(hash->ctx, EVP_sha256(), NULL)) {
-                        zck_log(ZCK_LOG_ERROR, "openSSL digest init error in %s", __func__);
-                        hash_close(hash);
-                        return false;
-                }
+                SHA256_Init((SHA256_CTX *)hash->ctx.sha);
+                hash->update = sha256_hash_update;
+                hash->final = sha256_hash_final;
                 return true;
-
         } else if(hash->type->type >= ZCK_HASH_SHA512 &&
                 hash->type->type <= ZCK_HASH_SHA512_128) {
                 zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-512 hash");
-                if (!EVP_DigestInit_ex(hash->ctx, EVP_sha512(), NULL)) {
-                        zck_log(ZCK_LOG_ERROR, "openSSL digest init error in %s", __func__);
-                        hash_close(hash);
-                        return false;
-                }
+                SHA512_Init((SHA512_CTX *)hash->ctx.sha);
+                hash->update = sha512_hash_update;
+                hash->final = sha512_hash_final;
                 return true;
         }
-#endif
         set_error(zck, "Unsupported hash type: %s", zck_hash_name_from_type(hash->type->type));
         return false;
 }
-
-bool lib_hash_update(zckCtx *zck, zckHash *hash, const char *message, const size_t size)
-{
-#if defined(ZCHUNK_OPENSSL_DEPRECATED)
-        if(hash->type->type == ZCK_HASH_SHA1) {
-            SHA1_Update((SHA_CTX *)hash->ctx, (const sha1_byte *)message, size);
-            return true;
-        } else if(hash->type->type == ZCK_HASH_SHA256) {
-            SHA256_Update((SHA256_CTX *)hash->ctx,
-                          (const unsigned char *)message, size);
-            return true;
-        } else if(hash->type->type >= ZCK_HASH_SHA512 &&
-                  hash->type->type <= ZCK_HASH_SHA512_128) {
-            SHA512_Update((SHA512_CTX *)hash->ctx,
-                          (const unsigned char *)message, size);
-            return true;
-        }
-        set_error(zck, "Unsupported hash type: %s", zck_hash_name_from_type(hash->type->type));
-        return false;
 #else
-        if (!EVP_DigestUpdate(hash->ctx, message, size)) {
+static bool evp_hash_update(zckCtx *zck, zckHash *hash, const char *message,
+                            size_t size)
+{
+        if (!EVP_DigestUpdate(hash->evp, message, size)) {
                 set_error(zck, "%s digest update error", zck_hash_name_from_type(hash->type->type));
-                hash_close(hash);
                 return false;
-        } else {
-                return true;
         }
-#endif
+        return true;
 }
 
-char *lib_hash_final(zckCtx *zck, zckHash *hash)
+static bool evp_hash_final(zckCtx *zck, zckHash *hash, char *digest)
 {
-#if defined(ZCHUNK_OPENSSL_DEPRECATED)
-        if(hash->type->type == ZCK_HASH_SHA1) {
-                unsigned char *digest = zmalloc(SHA1_DIGEST_LENGTH);
-                if (!digest) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                SHA1_Final((sha1_byte*)digest, (SHA_CTX *)hash->ctx);
-                hash_close(hash);
-                return (char *)digest;
-        } else if(hash->type->type == ZCK_HASH_SHA256) {
-                unsigned char *digest = zmalloc(SHA256_DIGEST_SIZE);
-                if (!digest) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                SHA256_Final(digest, (SHA256_CTX *)hash->ctx);
-                hash_close(hash);
-                return (char *)digest;
-        } else if(hash->type->type >= ZCK_HASH_SHA512 && hash->type->type <= ZCK_HASH_SHA512_128) {
-                unsigned char *digest = zmalloc(SHA512_DIGEST_SIZE);
-                if (!digest) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                SHA512_Final(digest, (SHA512_CTX *)hash->ctx);
-                hash_close(hash);
-                return (char *)digest;
+        unsigned int len;
+        if (!EVP_DigestFinal_ex(hash->evp, (unsigned char *)digest, &len)) {
+                set_error(zck, "%s digest finalize error", zck_hash_name_from_type(hash->type->type));
+                return false;
         }
-#else
+        return true;
+}
+
+void lib_hash_ctx_close(zckHash *hash)
+{
+        EVP_MD_CTX_free(hash->evp);
+        hash->evp = NULL;
+}
+
+bool lib_hash_init(zckCtx *zck, zckHash *hash)
+{
+        const EVP_MD *md = NULL;
         if(hash->type->type == ZCK_HASH_SHA1) {
-                unsigned char *digest = zmalloc(SHA1_DIGEST_LENGTH);
-                if (!digest) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                unsigned int len;
-                if (!EVP_DigestFinal_ex(hash->ctx, digest, &len)) {
-                        set_error(zck, "%s digest finalize error", zck_hash_name_from_type(hash->type->type));
-                        hash_close(hash);
-                        return NULL;
-                }
-                hash_close(hash);
-                return (char *)digest;
+                zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-1 hash");
+                md = EVP_sha1();
         } else if(hash->type->type == ZCK_HASH_SHA256) {
-                unsigned char *digest = zmalloc(SHA256_DIGEST_SIZE);
-                if (!digest) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-                        return false;
-                }
-                unsigned int len;
-                if (!EVP_DigestFinal_ex(hash->ctx, digest, &len)) {
-                        set_error(zck, "%s digest finalize error", zck_hash_name_from_type(hash->type->type));
-                        hash_close(hash);
-                        return NULL;
-                }
-                hash_close(hash);
-                return (char *)digest;
+                zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-256 hash");
+                md = EVP_sha256();
         } else if(hash->type->type >= ZCK_HASH_SHA512 &&
                 hash->type->type <= ZCK_HASH_SHA512_128) {
-                unsigned char *digest = zmalloc(SHA512_DIGEST_SIZE);
-                if (!digest) {
-                        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+                zck_log(ZCK_LOG_DDEBUG, "Initializing SHA-512 hash");
+                md = EVP_sha512();
+        } else {
+                set_error(zck, "Unsupported hash type: %s", zck_hash_name_from_type(hash->type->type));
+                return false;
+        }
+
+        /* The context is kept for the next digest */
+        if (!hash->evp) {
+                hash->evp = EVP_MD_CTX_new();
+                if (!hash->evp) {
+                        zck_log(ZCK_LOG_ERROR, "openSSL context create error in %s", __func__);
                         return false;
                 }
-                unsigned int len;
-                if (!EVP_DigestFinal_ex(hash->ctx, digest, &len)) {
-                        set_error(zck, "%s digest finalize error", zck_hash_name_from_type(hash->type->type));
-                        hash_close(hash);
-                        return NULL;
-                }
-                hash_close(hash);
-                return (char *)digest;
         }
-#endif
-        set_error(zck, "Unsupported hash type: %s", zck_hash_name_from_type(hash->type->type));
-        hash_close(hash);
-        return NULL;
+        if (!EVP_DigestInit_ex(hash->evp, md, NULL)) {
+                zck_log(ZCK_LOG_ERROR, "openSSL digest init error in %s", __func__);
+                return false;
+        }
+        hash->update = evp_hash_update;
+        hash->final = evp_hash_final;
+        return true;
 }
+#endif
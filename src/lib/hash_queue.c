@@ -0,0 +1,487 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zck.h>
+#ifdef ZCHUNK_THREADS
+#include <pthread.h>
+#endif
+
+#include "zck_private.h"
+
+#ifdef ZCHUNK_THREADS
+/* Maximum number of buffers and bytes waiting to be hashed before the
+ * writer has to wait for the hashing threads to catch up */
+#define HASH_QUEUE_SLOTS 64
+#define HASH_QUEUE_MAX_SIZE (16*1024*1024)
+
+/* The digest streams that are built while writing */
+#define HASH_STREAM_FULL   0
+#define HASH_STREAM_CHUNK  1
+#define HASH_STREAM_UNCOMP 2
+#define HASH_STREAM_COUNT  3
+
+/* A buffer waiting to be hashed, or the end of a chunk */
+typedef struct hashQueueItem {
+    char *data;
+    size_t size;
+    bool uncomp;
+    bool end_chunk;
+    size_t number;
+    size_t length;
+} hashQueueItem;
+
+typedef struct hashQueueWorker {
+    zckHashQueue *q;
+    bool streams[HASH_STREAM_COUNT];
+    zckHash chunk_hash;
+    zckHash uncomp_hash;
+    char digest[MAX_DIGEST_SIZE];
+    char digest_uncompressed[MAX_DIGEST_SIZE];
+    /* Only used to pick up errors from the hashing functions */
+    zckCtx err;
+    size_t done;
+    bool failed;
+    pthread_t thread;
+} hashQueueWorker;
+
+/* Hash the compressed data, the per-chunk checksums and the uncompressed
+ * per-chunk checksums on helper threads while the writer carries on
+ * chunking and compressing.  Every worker goes through every item in order,
+ * handling the streams it's been given.  Items from freed up to the slowest
+ * worker's done can be reused, and items from there up to head are still
+ * waiting for at least one worker */
+struct zckHashQueue {
+    zckCtx *zck;
+    hashQueueWorker *workers;
+    int worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    hashQueueItem slots[HASH_QUEUE_SLOTS];
+    size_t head;
+    size_t freed;
+    size_t queued_size;
+    bool stop;
+    /* The index can move as it grows, so finished digests are kept here,
+     * two per chunk, until they're copied into it at the end */
+    char *digests;
+    size_t first_chunk;
+    size_t chunk_count;
+    size_t chunk_alloc;
+};
+
+/* Chunk checksums are started when they're first needed */
+static bool worker_update(hashQueueWorker *worker, zckHash *hash,
+                          const char *data, size_t size) {
+    zckCtx *zck = worker->q->zck;
+
+    if(hash->type == NULL &&
+       !hash_init(&(worker->err), hash, &(zck->chunk_hash_type)))
+        return false;
+    return hash_update(&(worker->err), hash, data, size);
+}
+
+static bool worker_end_chunk(hashQueueWorker *worker, zckHash *hash,
+                             size_t length, char *digest) {
+    zckCtx *zck = worker->q->zck;
+
+    /* Empty chunks keep a digest of zeros */
+    memset(digest, 0, MAX_DIGEST_SIZE);
+    if(length == 0) {
+        hash_close(hash);
+        return true;
+    }
+    if(hash->type == NULL &&
+       !hash_init(&(worker->err), hash, &(zck->chunk_hash_type)))
+        return false;
+    if(!hash_final(&(worker->err), hash, digest)) {
+        set_fatal_error(&(worker->err),
+                        "Unable to calculate %s checksum for new chunk",
+                        zck_hash_name_from_type(zck->index.hash_type));
+        return false;
+    }
+    return true;
+}
+
+static bool worker_hash(hashQueueWorker *worker, hashQueueItem *item) {
+    zckCtx *zck = worker->q->zck;
+    zckCtx *err = &(worker->err);
+
+    if(item->uncomp) {
+        return !worker->streams[HASH_STREAM_UNCOMP] ||
+               worker_update(worker, &(worker->uncomp_hash), item->data,
+                             item->size);
+    }
+    if(item->data) {
+        if(worker->streams[HASH_STREAM_FULL] &&
+           !hash_update(err, &(zck->full_hash), item->data, item->size))
+            return false;
+        if(worker->streams[HASH_STREAM_CHUNK] &&
+           !worker_update(worker, &(worker->chunk_hash), item->data,
+                          item->size))
+            return false;
+    }
+    if(item->end_chunk) {
+        if(worker->streams[HASH_STREAM_CHUNK] &&
+           !worker_end_chunk(worker, &(worker->chunk_hash), item->length,
+                             worker->digest))
+            return false;
+        if(worker->streams[HASH_STREAM_UNCOMP] &&
+           !worker_end_chunk(worker, &(worker->uncomp_hash), item->length,
+                             worker->digest_uncompressed))
+            return false;
+    }
+    return true;
+}
+
+/* Store the digests the worker just finished.  Must be called with the lock
+ * held, as the writer may be growing the digest buffer */
+static void worker_store(hashQueueWorker *worker, hashQueueItem *item) {
+    zckHashQueue *q = worker->q;
+    size_t digest_size = q->zck->index.digest_size;
+    char *digest = q->digests +
+                   (item->number - q->first_chunk) * 2 * digest_size;
+
+    if(worker->streams[HASH_STREAM_CHUNK])
+        memcpy(digest, worker->digest, digest_size);
+    if(worker->streams[HASH_STREAM_UNCOMP])
+        memcpy(digest + digest_size, worker->digest_uncompressed,
+               digest_size);
+}
+
+static void *hash_queue_run(void *data) {
+    hashQueueWorker *worker = data;
+    zckHashQueue *q = worker->q;
+
+    pthread_mutex_lock(&(q->lock));
+    while(true) {
+        if(worker->done == q->head) {
+            if(q->stop)
+                break;
+            pthread_cond_wait(&(q->cond), &(q->lock));
+            continue;
+        }
+        hashQueueItem *item = &(q->slots[worker->done % HASH_QUEUE_SLOTS]);
+        pthread_mutex_unlock(&(q->lock));
+
+        /* After a failure, keep going through the items so the writer
+         * doesn't wait forever, but don't hash them */
+        bool hashed = worker->failed || worker_hash(worker, item);
+
+        pthread_mutex_lock(&(q->lock));
+        if(!hashed)
+            worker->failed = true;
+        else if(!worker->failed && item->end_chunk)
+            worker_store(worker, item);
+        worker->done++;
+        pthread_cond_broadcast(&(q->cond));
+    }
+    pthread_mutex_unlock(&(q->lock));
+    return NULL;
+}
+
+/* Free the buffers every worker has finished with.  Must be called with the
+ * lock held */
+static void hash_queue_reclaim(zckHashQueue *q) {
+    size_t tail = q->head;
+    for(int i=0; i<q->worker_count; i++)
+        if(q->workers[i].done < tail)
+            tail = q->workers[i].done;
+    for(; q->freed < tail; q->freed++) {
+        hashQueueItem *item = &(q->slots[q->freed % HASH_QUEUE_SLOTS]);
+        free(item->data);
+        q->queued_size -= item->size;
+        memset(item, 0, sizeof(hashQueueItem));
+    }
+}
+
+/* Stop the workers once they've hashed everything that's queued, and pass on
+ * the first error any of them hit */
+static bool hash_queue_join(zckCtx *zck, zckHashQueue *q) {
+    pthread_mutex_lock(&(q->lock));
+    q->stop = true;
+    pthread_cond_broadcast(&(q->cond));
+    pthread_mutex_unlock(&(q->lock));
+    for(int i=0; i<q->worker_count; i++)
+        pthread_join(q->workers[i].thread, NULL);
+    hash_queue_reclaim(q);
+    pthread_mutex_destroy(&(q->lock));
+    pthread_cond_destroy(&(q->cond));
+
+    bool ret = true;
+    for(int i=0; i<q->worker_count; i++) {
+        hashQueueWorker *worker = &(q->workers[i]);
+        if(worker->failed && ret) {
+            if(zck_is_error(&(worker->err)))
+                copy_error(zck, &(worker->err));
+            else
+                set_error(zck, "Unable to calculate checksums");
+            ret = false;
+        }
+        hash_close(&(worker->chunk_hash));
+        hash_close(&(worker->uncomp_hash));
+        free(worker->err.msg);
+    }
+    return ret;
+}
+
+static void hash_queue_free(zckCtx *zck) {
+    free(zck->hash_queue->digests);
+    free(zck->hash_queue->workers);
+    free(zck->hash_queue);
+    zck->hash_queue = NULL;
+}
+
+/* Add item to the queue, waiting for space if it's full.  The queue takes
+ * ownership of item's data */
+static bool hash_queue_push(zckCtx *zck, hashQueueItem *item) {
+    zckHashQueue *q = zck->hash_queue;
+
+    pthread_mutex_lock(&(q->lock));
+    while(true) {
+        hash_queue_reclaim(q);
+        bool failed = false;
+        for(int i=0; i<q->worker_count; i++)
+            failed = failed || q->workers[i].failed;
+        if(failed) {
+            pthread_mutex_unlock(&(q->lock));
+            free(item->data);
+            /* Pick up the error now rather than at the end */
+            hash_queue_join(zck, q);
+            hash_queue_free(zck);
+            return false;
+        }
+        /* Always let one item through, however big it is */
+        if(q->head - q->freed < HASH_QUEUE_SLOTS &&
+           (q->head == q->freed ||
+            q->queued_size + item->size <= HASH_QUEUE_MAX_SIZE))
+            break;
+        pthread_cond_wait(&(q->cond), &(q->lock));
+    }
+    q->slots[q->head % HASH_QUEUE_SLOTS] = *item;
+    q->queued_size += item->size;
+    q->head++;
+    pthread_cond_broadcast(&(q->cond));
+    pthread_mutex_unlock(&(q->lock));
+    return true;
+}
+
+/* Make room for one more chunk's digests, which the workers may be writing
+ * into */
+static bool hash_queue_reserve(zckCtx *zck, zckHashQueue *q) {
+    size_t digest_size = 2 * zck->index.digest_size;
+
+    if(q->chunk_count < q->chunk_alloc) {
+        q->chunk_count++;
+        return true;
+    }
+    size_t alloc = q->chunk_alloc ? q->chunk_alloc * 2 : 64;
+    char *digests = zmalloc(alloc * digest_size);
+    if(!digests) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    pthread_mutex_lock(&(q->lock));
+    if(q->digests)
+        memcpy(digests, q->digests, q->chunk_count * digest_size);
+    free(q->digests);
+    q->digests = digests;
+    q->chunk_alloc = alloc;
+    q->chunk_count++;
+    pthread_mutex_unlock(&(q->lock));
+    return true;
+}
+#endif
+
+/* Start hashing on helper threads if we're allowed more than one thread.
+ * This has to happen between chunks, as the helpers start each chunk's
+ * checksum from scratch */
+bool hash_queue_start(zckCtx *zck) {
+    VALIDATE_WRITE_BOOL(zck);
+
+#ifdef ZCHUNK_THREADS
+    int threads = get_thread_count(zck);
+    if(zck->hash_queue || threads < 2)
+        return true;
+
+    bool streams[HASH_STREAM_COUNT] = {0};
+    streams[HASH_STREAM_FULL] = !zck->has_uncompressed_source &&
+                                !zck->has_tree_digest;
+    streams[HASH_STREAM_CHUNK] = true;
+    streams[HASH_STREAM_UNCOMP] = zck->has_uncompressed_source;
+    int stream_count = 0;
+    for(int i=0; i<HASH_STREAM_COUNT; i++)
+        stream_count += streams[i];
+
+    /* The writer keeps one thread, and gets one helper per stream if
+     * there are enough threads to go around */
+    int worker_count = threads - 1;
+    if(worker_count > stream_count)
+        worker_count = stream_count;
+
+    zckHashQueue *q = zmalloc(sizeof(zckHashQueue));
+    if(q)
+        q->workers = zmalloc(worker_count * sizeof(hashQueueWorker));
+    if(!q || !q->workers) {
+        free(q);
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    q->zck = zck;
+    q->first_chunk = zck->index.chunks_count;
+    int w = 0;
+    for(int i=0; i<HASH_STREAM_COUNT; i++) {
+        if(!streams[i])
+            continue;
+        q->workers[w % worker_count].streams[i] = true;
+        w++;
+    }
+    for(int i=0; i<worker_count; i++)
+        q->workers[i].q = q;
+
+    pthread_mutex_init(&(q->lock), NULL);
+    pthread_cond_init(&(q->cond), NULL);
+    /* If a thread can't be started, hand its streams to the first one.  Hold
+     * the lock so nothing is hashed until the streams are settled */
+    pthread_mutex_lock(&(q->lock));
+    int started = 0;
+    for(; started < worker_count; started++) {
+        if(pthread_create(&(q->workers[started].thread), NULL,
+                          hash_queue_run, &(q->workers[started])) != 0) {
+            zck_log(ZCK_LOG_DEBUG, "Unable to start thread %i", started);
+            break;
+        }
+    }
+    for(int i=started; i<worker_count && started > 0; i++)
+        for(int j=0; j<HASH_STREAM_COUNT; j++)
+            if(q->workers[i].streams[j])
+                q->workers[0].streams[j] = true;
+    q->worker_count = started;
+    pthread_mutex_unlock(&(q->lock));
+    /* Without any helpers, just hash as we go */
+    if(started == 0) {
+        pthread_mutex_destroy(&(q->lock));
+        pthread_cond_destroy(&(q->cond));
+        free(q->workers);
+        free(q);
+        return true;
+    }
+    zck->hash_queue = q;
+    zck_log(ZCK_LOG_DEBUG, "Hashing on %i helper threads", started);
+    return true;
+#else
+    return true;
+#endif
+}
+
+/* Queue size bytes of data for hashing, taking ownership of it.  Compressed
+ * data goes into the data checksum and the chunk checksum, while
+ * uncompressed data only goes into the uncompressed chunk checksum */
+bool hash_queue_add(zckCtx *zck, char *data, size_t size, bool uncomp) {
+#ifdef ZCHUNK_THREADS
+    if(zck == NULL || zck->hash_queue == NULL) {
+        free(data);
+        set_error(zck, "Hashing threads haven't been started");
+        return false;
+    }
+    if(size == 0) {
+        free(data);
+        return true;
+    }
+    hashQueueItem item = {0};
+    item.data = data;
+    item.size = size;
+    item.uncomp = uncomp;
+    return hash_queue_push(zck, &item);
+#else
+    free(data);
+    set_error(zck, "Built without thread support");
+    return false;
+#endif
+}
+
+/* Finish the checksums for chunk, which must already be in the index */
+bool hash_queue_end_chunk(zckCtx *zck, zckChunk *chunk) {
+#ifdef ZCHUNK_THREADS
+    if(zck == NULL || zck->hash_queue == NULL) {
+        set_error(zck, "Hashing threads haven't been started");
+        return false;
+    }
+    zckHashQueue *q = zck->hash_queue;
+    if(chunk->number != q->first_chunk + q->chunk_count) {
+        set_error(zck, "Chunk %llu finished out of order",
+                  (long long unsigned) chunk->number);
+        return false;
+    }
+    if(!hash_queue_reserve(zck, q))
+        return false;
+    hashQueueItem item = {0};
+    item.end_chunk = true;
+    item.number = chunk->number;
+    item.length = chunk->length;
+    return hash_queue_push(zck, &item);
+#else
+    set_error(zck, "Built without thread support");
+    return false;
+#endif
+}
+
+/* Wait until everything queued has been hashed and stop the helper
+ * threads, after which the checksums can be used */
+bool hash_queue_finish(zckCtx *zck) {
+    if(zck == NULL || zck->hash_queue == NULL)
+        return true;
+
+#ifdef ZCHUNK_THREADS
+    zckHashQueue *q = zck->hash_queue;
+    bool ret = hash_queue_join(zck, q);
+    size_t digest_size = zck->index.digest_size;
+    for(size_t i=0; ret && i<q->chunk_count; i++) {
+        zckChunk *chk = &(zck->index.chunks[q->first_chunk + i]);
+        memcpy(chk->digest, q->digests + i * 2 * digest_size, digest_size);
+        memcpy(chk->digest_uncompressed,
+               q->digests + (i * 2 + 1) * digest_size, digest_size);
+    }
+    hash_queue_free(zck);
+    return ret;
+#else
+    return true;
+#endif
+}
+
+/* Stop the helper threads without caring whether they succeeded */
+void hash_queue_stop(zckCtx *zck) {
+    if(zck == NULL || zck->hash_queue == NULL)
+        return;
+
+#ifdef ZCHUNK_THREADS
+    hash_queue_join(NULL, zck->hash_queue);
+    hash_queue_free(zck);
+#endif
+}
@@ -47,6 +47,9 @@ static bool check_flags(zckCtx *zck, size_t flags) {
     zck->has_uncompressed_source = flags & 4;
     if(zck->has_uncompressed_source)
         flags -= 4;
+    zck->has_tree_digest = flags & 8;
+    if(zck->has_tree_digest)
+        flags -= 8;
 
     flags = flags & (SIZE_MAX - 1);
     if(flags != 0) {
@@ -64,6 +67,8 @@ static ssize_t get_flags(zckCtx *zck) {
         flags |= 2;
     if(zck->has_uncompressed_source)
         flags |= 4;
+    if(zck->has_tree_digest)
+        flags |= 8;
     return flags;
 }
 
@@ -85,8 +90,26 @@ static bool read_header_from_file(zckCtx *zck) {
         return false;
     }
 
-    /* Allocate header and store any extra bytes at beginning of header */
-    zck->header = zrealloc(zck->header, zck->lead_size + zck->header_length);
+    /* If the rest of the header is already in memory, use it where it is
+     * rather than copying it */
+    size_t full_size = zck->lead_size + zck->header_length;
+    if(zck->src_buf && zck->src_loc >= zck->header_size &&
+       zck->src_buf_size - (zck->src_loc - zck->header_size) >= full_size &&
+       zck->header_size <= full_size) {
+        const char *start = zck->src_buf + zck->src_loc - zck->header_size;
+        const char *rest = NULL;
+        size_t rest_size = full_size - zck->header_size;
+        if(read_data_ptr(zck, &rest, NULL, rest_size) != rest_size)
+            return false;
+        free(zck->header);
+        zck->header = (char *)start;
+        zck->header_borrowed = true;
+        zck->header_size = full_size;
+    } else {
+        /* Allocate header and store any extra bytes at beginning of
+         * header */
+        zck->header = zrealloc(zck->header, full_size);
+    }
     if (!zck->header) {
         zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
         return false;
@@ -629,9 +652,11 @@ bool ZCK_PUBLIC_API zck_validate_lead(zckCtx *zck) {
     int retval = read_lead(zck);
     if(!zck_clear_error(zck))
         return false;
-    free(zck->header);
+    if(!zck->header_borrowed)
+        free(zck->header);
     free(zck->header_digest);
     zck->header = NULL;
+    zck->header_borrowed = false;
     zck->header_size = 0;
     zck->header_length = 0;
     zck->hdr_digest_loc = 0;
@@ -671,9 +696,11 @@ ssize_t ZCK_PUBLIC_API zck_get_lead_length(zckCtx *zck) {
 
 ssize_t ZCK_PUBLIC_API zck_get_data_length(zckCtx *zck) {
     VALIDATE_INT(zck);
-    zckChunk *idx = zck->index.first;
-    while(idx->next != NULL)
-        idx = idx->next;
+    if(!index_load(zck))
+        return -1;
+    zckChunk *idx = zck->index.last;
+    if(idx == NULL)
+        return 0;
     return idx->start + idx->comp_length;
 }
 
@@ -32,17 +32,110 @@
 
 #include "zck_private.h"
 
-static void index_free_item(zckChunk **item) {
-    if(*item == NULL)
-        return;
+/* Point each item in index at its digests and the item after it */
+static void index_link(zckIndex *index) {
+    for(size_t i=0; i<index->chunks_count; i++) {
+        zckChunk *idx = &(index->chunks[i]);
+        idx->digest = index->digests + i * index->digest_size;
+        if(index->digests_uncompressed)
+            idx->digest_uncompressed = index->digests_uncompressed +
+                                       i * index->digest_size;
+        idx->next = (i + 1 < index->chunks_count) ? idx + 1 : NULL;
+    }
+    index->first = index->chunks_count ? index->chunks : NULL;
+    index->last = index->chunks_count ?
+                  &(index->chunks[index->chunks_count - 1]) : NULL;
+}
+
+/* Rebuild the digest hash tables after the items have moved, keeping the
+ * first item with each digest */
+static void index_rehash(zckIndex *index, bool ht, bool htuncomp) {
+    HASH_CLEAR(hh, index->ht);
+    HASH_CLEAR(hhuncomp, index->htuncomp);
+    for(size_t i=0; i<index->chunks_count; i++) {
+        zckChunk *idx = &(index->chunks[i]);
+        zckChunk *tmp = NULL;
+        if(ht) {
+            HASH_FIND(hh, index->ht, idx->digest, idx->digest_size, tmp);
+            if(!tmp)
+                HASH_ADD_KEYPTR(hh, index->ht, idx->digest, idx->digest_size,
+                                idx);
+        }
+        if(htuncomp && idx->digest_uncompressed) {
+            HASH_FIND(hhuncomp, index->htuncomp, idx->digest_uncompressed,
+                      idx->digest_size, tmp);
+            if(!tmp)
+                HASH_ADD_KEYPTR(hhuncomp, index->htuncomp,
+                                idx->digest_uncompressed, idx->digest_size,
+                                idx);
+        }
+    }
+}
+
+/* Make room for at least count items in index, along with their uncompressed
+ * digests if uncomp is set.  The items may move, so anything in the index
+ * that points at them is updated */
+bool index_grow(zckCtx *zck, zckIndex *index, size_t count, bool uncomp) {
+    VALIDATE_BOOL(zck);
+    ALLOCD_BOOL(zck, index);
 
-    if((*item)->digest)
-        free((*item)->digest);
-    if((*item)->digest_uncompressed)
-        free((*item)->digest_uncompressed);
-    free(*item);
-    *item = NULL;
-    return;
+    if(index->arena) {
+        set_error(zck, "Index can't grow once it's been read");
+        return false;
+    }
+    uncomp = uncomp || index->digests_uncompressed != NULL;
+    if(count <= index->chunks_alloc &&
+       (!uncomp || index->digests_uncompressed != NULL))
+        return true;
+    if(count < index->chunks_alloc)
+        count = index->chunks_alloc;
+    if(count > SIZE_MAX / sizeof(zckChunk) ||
+       (index->digest_size > 0 && count > SIZE_MAX / index->digest_size)) {
+        set_error(zck, "Too many chunks in index");
+        return false;
+    }
+
+    size_t digests_size = count * index->digest_size;
+    zckChunk *chunks = zmalloc(count * sizeof(zckChunk));
+    char *digests = zmalloc(digests_size ? digests_size : 1);
+    char *digests_uncompressed = NULL;
+    if(uncomp)
+        digests_uncompressed = zmalloc(digests_size ? digests_size : 1);
+    if(!chunks || !digests || (uncomp && !digests_uncompressed)) {
+        free(chunks);
+        free(digests);
+        free(digests_uncompressed);
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+
+    size_t used = index->chunks_count;
+    if(used > 0) {
+        memcpy(chunks, index->chunks, used * sizeof(zckChunk));
+        memcpy(digests, index->digests, used * index->digest_size);
+        if(index->digests_uncompressed)
+            memcpy(digests_uncompressed, index->digests_uncompressed,
+                   used * index->digest_size);
+    }
+    size_t current = index->current ? index->current - index->chunks : 0;
+    bool ht = index->ht != NULL;
+    bool htuncomp = index->htuncomp != NULL;
+    HASH_CLEAR(hh, index->ht);
+    HASH_CLEAR(hhuncomp, index->htuncomp);
+    free(index->chunks);
+    free(index->digests);
+    free(index->digests_uncompressed);
+
+    index->chunks = chunks;
+    index->digests = digests;
+    index->digests_uncompressed = digests_uncompressed;
+    index->chunks_alloc = count;
+    if(index->current)
+        index->current = chunks + current;
+    index_link(index);
+    if(ht || htuncomp)
+        index_rehash(index, ht, htuncomp);
+    return true;
 }
 
 void index_clean(zckIndex *index) {
@@ -51,15 +144,14 @@ void index_clean(zckIndex *index) {
 
     HASH_CLEAR(hh, index->ht);
     HASH_CLEAR(hhuncomp, index->htuncomp);
-    if(index->first) {
-        zckChunk *next;
-        zckChunk *tmp=index->first;
-        while(tmp != NULL) {
-            next = tmp->next;
-            index_free_item(&tmp);
-            tmp = next;
-        }
+    if(index->arena) {
+        free(index->arena);
+    } else {
+        free(index->chunks);
+        free(index->dc_offset);
     }
+    free(index->digests);
+    free(index->digests_uncompressed);
     memset(index, 0, sizeof(zckIndex));
 }
 
@@ -69,10 +161,7 @@ void index_free(zckCtx *zck) {
         free(zck->full_hash_digest);
         zck->full_hash_digest = NULL;
     }
-    if(zck->full_hash.ctx) {
-        free(zck->full_hash.ctx);
-        zck->full_hash.ctx = NULL;
-    }
+    hash_close(&(zck->full_hash));
     zck->lead_string = NULL;
     zck->lead_size = 0;
     zck->preface_string = NULL;
@@ -87,12 +176,11 @@ void index_free(zckCtx *zck) {
     }
 }
 
+/* The chunk hashes are left for the next chunk to reuse */
 void clear_work_index(zckCtx *zck) {
     if(zck == NULL)
         return;
 
-    hash_close(&(zck->work_index_hash));
-    hash_close(&(zck->work_index_hash_uncomp));
-    if(zck->work_index_item)
-        index_free_item(&(zck->work_index_item));
+    free(zck->work_index_item);
+    zck->work_index_item = NULL;
 }
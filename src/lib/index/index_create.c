@@ -36,6 +36,8 @@ static bool create_chunk(zckCtx *zck) {
     VALIDATE_BOOL(zck);
 
     clear_work_index(zck);
+    if(!hash_queue_start(zck))
+        return false;
     zck->work_index_item = zmalloc(sizeof(zckChunk));
     if (!zck->work_index_item) {
        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
@@ -47,39 +49,49 @@ static bool create_chunk(zckCtx *zck) {
     return true;
 }
 
+/* Copy item into the next slot in index */
 static bool finish_chunk(zckIndex *index, zckChunk *item, char *digest,
                         char *digest_uncompressed, bool valid, zckCtx *zck) {
     VALIDATE_BOOL(zck);
     ALLOCD_BOOL(zck, index);
     ALLOCD_BOOL(zck, item);
 
-    item->digest = zmalloc(index->digest_size);
-    item->digest_uncompressed = zmalloc(index->digest_size);
-    if (!item->digest || !item->digest_uncompressed) {
-       free(item->digest);
-       zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-       return false;
-    }
+    /* Double the array as it fills, so adding chunks stays cheap */
+    if(index->chunks_count == index->chunks_alloc &&
+       !index_grow(zck, index, index->chunks_alloc ? index->chunks_alloc * 2
+                                                   : 64, true))
+        return false;
+
+    zckChunk *chk = &(index->chunks[index->chunks_count]);
+    memcpy(chk, item, sizeof(zckChunk));
+    chk->digest = index->digests + index->chunks_count * index->digest_size;
+    chk->digest_uncompressed = index->digests_uncompressed +
+                               index->chunks_count * index->digest_size;
+    chk->digest_size = 0;
     if(digest) {
-        memcpy(item->digest, digest, index->digest_size);
-        item->digest_size = index->digest_size;
+        memcpy(chk->digest, digest, index->digest_size);
+        chk->digest_size = index->digest_size;
     }
     if(digest_uncompressed) {
-        memcpy(item->digest_uncompressed, digest_uncompressed, index->digest_size);
-    }
-    item->start = index->length;
-    item->valid = valid;
-    item->zck = zck;
-    item->number = index->count;
-    if(index->first == NULL) {
-        index->first = item;
-    } else {
-        index->last->next = item;
+        memcpy(chk->digest_uncompressed, digest_uncompressed, index->digest_size);
     }
-    index->last = item;
+    chk->start = index->length;
+    chk->valid = valid;
+    chk->zck = zck;
+    chk->number = index->count;
+    chk->next = NULL;
+    if(index->last)
+        index->last->next = chk;
+    else
+        index->first = chk;
+    index->last = chk;
+    index->chunks_count += 1;
     index->count += 1;
-    index->length += item->comp_length;
+    index->length += chk->comp_length;
 
+    /* Digests from the hashing threads aren't known yet */
+    if(!zck_log_enabled(ZCK_LOG_DEBUG) || zck->hash_queue)
+        return true;
     char *s = get_digest_string(digest, index->digest_size);
     if (zck->has_uncompressed_source) {
         char *s1 = get_digest_string(digest_uncompressed, index->digest_size);
@@ -98,7 +110,10 @@ bool index_create(zckCtx *zck) {
     size_t index_malloc = 0;
     size_t index_size = 0;
 
-
+    if(!hash_queue_finish(zck))
+        return false;
+    if(zck->has_tree_digest && !hash_tree(zck, &(zck->full_hash)))
+        return false;
     zck->full_hash_digest = hash_finalize(zck, &(zck->full_hash));
     if(zck->full_hash_digest == NULL)
         return false;
@@ -112,14 +127,9 @@ bool index_create(zckCtx *zck) {
 
     /* Add digest size + MAX_COMP_SIZE bytes for length of each entry in
      * index */
-    if(zck->index.first) {
-        zckChunk *tmp = zck->index.first;
-        while(tmp) {
-            index_malloc += (zck->has_uncompressed_source + 1) * zck->index.digest_size +
-		    MAX_COMP_SIZE * 2;
-            tmp = tmp->next;
-        }
-    }
+    index_malloc += zck->index.chunks_count *
+                    ((zck->has_uncompressed_source + 1) * zck->index.digest_size +
+                     MAX_COMP_SIZE * 2);
 
     /* Write index */
     index = zmalloc(index_malloc);
@@ -129,25 +139,21 @@ bool index_create(zckCtx *zck) {
     }
     compint_from_size(index+index_size, zck->index.hash_type, &index_size);
     compint_from_size(index+index_size, zck->index.count, &index_size);
-    if(zck->index.first) {
-        zckChunk *tmp = zck->index.first;
-        while(tmp) {
-            /* Write digest */
-            memcpy(index+index_size, tmp->digest, zck->index.digest_size);
+    for(size_t i=0; i<zck->index.chunks_count; i++) {
+        zckChunk *tmp = &(zck->index.chunks[i]);
+        /* Write digest */
+        memcpy(index+index_size, tmp->digest, zck->index.digest_size);
+        index_size += zck->index.digest_size;
+        /* Write digest for uncompressed if any */
+        if (zck->has_uncompressed_source) {
+            memcpy(index+index_size, tmp->digest_uncompressed, zck->index.digest_size);
             index_size += zck->index.digest_size;
-	    /* Write digest for uncompressed if any */
-	    if (zck->has_uncompressed_source) {
-                memcpy(index+index_size, tmp->digest_uncompressed, zck->index.digest_size);
-                index_size += zck->index.digest_size;
-	    }
-            /* Write compressed size */
-            compint_from_size(index+index_size, tmp->comp_length,
-                                  &index_size);
-            /* Write uncompressed size */
-            compint_from_size(index+index_size, tmp->length, &index_size);
-
-            tmp = tmp->next;
         }
+        /* Write compressed size */
+        compint_from_size(index+index_size, tmp->comp_length,
+                              &index_size);
+        /* Write uncompressed size */
+        compint_from_size(index+index_size, tmp->length, &index_size);
     }
     /* Shrink index to actual size */
     index = zrealloc(index, index_size);
@@ -178,19 +184,21 @@ bool index_new_chunk(zckCtx *zck, zckIndex *index, char *digest,
         set_error(zck, "Digest size 0 too small");
         return false;
     }
-    zckChunk *chk = zmalloc(sizeof(zckChunk));
-    if (!chk) {
-       zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-       return false;
+    if(index->chunks_count > 0 && index->digest_size != digest_size) {
+        set_error(zck, "Digest size %i doesn't match index", digest_size);
+        return false;
     }
+    zckChunk chk = {0};
     index->digest_size = digest_size;
-    chk->comp_length = comp_size;
-    chk->length = orig_size;
-    chk->src = src;
-    return finish_chunk(index, chk, digest, digest_uncompressed, finished, zck);
+    chk.comp_length = comp_size;
+    chk.length = orig_size;
+    chk.src = src;
+    return finish_chunk(index, &chk, digest, digest_uncompressed, finished, zck);
 }
 
-bool index_add_to_chunk(zckCtx *zck, char *data, size_t comp_size,
+/* Add compressed data to the current chunk.  If the hashing threads are
+ * running, they take ownership of *data and it's set to NULL */
+bool index_add_to_chunk(zckCtx *zck, char **data, size_t comp_size,
                            size_t orig_size) {
     VALIDATE_BOOL(zck);
 
@@ -201,60 +209,79 @@ bool index_add_to_chunk(zckCtx *zck, char *data, size_t comp_size,
     if(comp_size == 0)
         return true;
 
-    if(!zck->has_uncompressed_source) {
-        if(!hash_update(zck, &(zck->full_hash), data, comp_size))
+    if(zck->hash_queue) {
+        char *queued = *data;
+        *data = NULL;
+        if(!hash_queue_add(zck, queued, comp_size, false))
+            return false;
+        zck->work_index_item->comp_length += comp_size;
+        return true;
+    }
+    if(!zck->has_uncompressed_source && !zck->has_tree_digest) {
+        if(!hash_update(zck, &(zck->full_hash), *data, comp_size))
             return false;
     }
-    if(!hash_update(zck, &(zck->work_index_hash), data, comp_size))
+    if(!hash_update(zck, &(zck->work_index_hash), *data, comp_size))
         return false;
 
     zck->work_index_item->comp_length += comp_size;
     return true;
 }
 
+/* Add uncompressed data to the current chunk's uncompressed checksum */
+bool index_add_uncompressed(zckCtx *zck, const char *data, size_t size) {
+    VALIDATE_BOOL(zck);
+
+    if(zck->work_index_item == NULL && !create_chunk(zck))
+        return false;
+
+    if(zck->hash_queue == NULL || size == 0)
+        return hash_update(zck, &(zck->work_index_hash_uncomp), data, size);
+
+    /* The caller keeps its buffer, so the hashing threads need a copy */
+    char *copy = zmalloc(size);
+    if(!copy) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    memcpy(copy, data, size);
+    return hash_queue_add(zck, copy, size, true);
+}
+
 bool index_finish_chunk(zckCtx *zck) {
     VALIDATE_BOOL(zck);
 
     if(zck->work_index_item == NULL && !create_chunk(zck))
         return false;
 
-    char *digest = NULL;
-    char *digest_uncompressed = NULL;
+    char digest[MAX_DIGEST_SIZE] = {0};
+    char digest_uncompressed[MAX_DIGEST_SIZE] = {0};
+    if(zck->hash_queue) {
+        /* The hashing threads fill in the digests when they get here */
+        if(!finish_chunk(&(zck->index), zck->work_index_item, digest,
+                         digest_uncompressed, true, zck))
+            return false;
+        clear_work_index(zck);
+        return hash_queue_end_chunk(zck, zck->index.last);
+    }
     if(zck->work_index_item->length > 0) {
         /* Finalize chunk checksum */
-        digest = hash_finalize(zck, &(zck->work_index_hash));
-        if(digest == NULL) {
+        if(!hash_final(zck, &(zck->work_index_hash), digest)) {
             set_fatal_error(zck,
                             "Unable to calculate %s checksum for new chunk",
                             zck_hash_name_from_type(zck->index.hash_type));
             return false;
         }
-        digest_uncompressed = hash_finalize(zck, &(zck->work_index_hash_uncomp));
-        if(digest_uncompressed == NULL) {
+        if(!hash_final(zck, &(zck->work_index_hash_uncomp),
+                       digest_uncompressed)) {
             set_fatal_error(zck, "Unable to calculate %s checksum for new chunk",
                             zck_hash_name_from_type(zck->index.hash_type));
-            free(digest);
             return false;
         }
-    } else {
-        digest = zmalloc(zck->chunk_hash_type.digest_size);
-        digest_uncompressed = zmalloc(zck->chunk_hash_type.digest_size);
-        if (!digest || !digest_uncompressed) {
-           free(digest);
-           zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-           return false;
-        }
     }
-    if(!finish_chunk(&(zck->index), zck->work_index_item, digest, digest_uncompressed, true, zck)) {
-        free(digest);
-        free(digest_uncompressed);
+    if(!finish_chunk(&(zck->index), zck->work_index_item, digest, digest_uncompressed, true, zck))
         return false;
-    }
 
-    free(digest);
-    free(digest_uncompressed);
-    zck->work_index_item = NULL;
-    hash_close(&(zck->work_index_hash));
-    hash_close(&(zck->work_index_hash_uncomp));
+    clear_work_index(zck);
     return true;
 }
@@ -41,84 +41,104 @@
 
 #include "zck_private.h"
 
-bool index_read(zckCtx *zck, char *data, size_t size, size_t max_length) {
-    VALIDATE_BOOL(zck);
-    size_t length = 0;
+/* Fill in the table of the uncompressed offset of each chunk so chunks can
+ * be looked up by decompressed offset without walking the index.  The
+ * dictionary (chunk 0) isn't part of the decompressed data, so it has no
+ * length in the offset table */
+static void index_build_offsets(zckIndex *index) {
+    size_t count = index->chunks_count;
+
+    if(count == 0) {
+        index->dc_offset = NULL;
+        return;
+    }
 
-    /* Read and configure hash type */
-    int hash_type = 0;
-    if(!compint_to_int(zck, &hash_type, data + length, &length, max_length)) {
-        set_fatal_error(zck, "Unable to read hash type");
-        return false;
+    size_t dc_loc = 0;
+    for(size_t i=0; i<count; i++) {
+        index->dc_offset[i] = dc_loc;
+        if(i > 0)
+            dc_loc += index->chunks[i].length;
     }
-    if(!set_chunk_hash_type(zck, hash_type)) {
-        set_fatal_error(zck, "Unable to set chunk hash type");
+    index->dc_offset[count] = dc_loc;
+}
+
+/* Allocate the index items and the offset table in one go, so parsing the
+ * index doesn't need an allocation per chunk and freeing it is cheap */
+static bool index_alloc(zckCtx *zck, zckIndex *index, size_t count) {
+    if(count == 0)
+        return true;
+    if(count > (SIZE_MAX - sizeof(size_t)) /
+               (sizeof(zckChunk) + sizeof(size_t))) {
+        set_fatal_error(zck, "Too many chunks in index");
         return false;
     }
 
-    /* Read number of index entries */
-    size_t index_count;
-    if(!compint_to_size(zck, &index_count, data + length, &length,
-                        max_length)) {
-        set_fatal_error(zck, "Unable to read index count");
+    index->arena = zmalloc(count * sizeof(zckChunk) +
+                           (count + 1) * sizeof(size_t));
+    if(!index->arena) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
         return false;
     }
-    zck->index.count = index_count;
+    index->chunks = index->arena;
+    index->chunks_alloc = count;
+    index->dc_offset = (size_t *)(index->chunks + count);
+    return true;
+}
+
+/* Decode the index entries in data into the index.  The index items'
+ * digests point into data, which has to stay around for as long as the index
+ * does */
+static bool index_decode(zckCtx *zck, char *data, size_t size,
+                         size_t max_length) {
+    zckIndex *index = &(zck->index);
+    size_t length = 0;
+
+    /* Size the index from the count, but don't trust it any further than
+     * the smallest possible entries would fill the index */
+    size_t entry_size = (zck->has_uncompressed_source ? 2 : 1) *
+                        index->digest_size + 2;
+    size_t alloc = size / entry_size + 1;
+    if(index->count < alloc)
+        alloc = index->count;
+    if(!index_alloc(zck, index, alloc))
+        return false;
 
-    zckChunk *prev = zck->index.first;
     size_t idx_loc = 0;
-    int count = 0;
+    size_t count = 0;
     while(length < size) {
-        if(length + zck->index.digest_size > max_length) {
+        if(length + index->digest_size > max_length) {
             set_fatal_error(zck, "Read past end of header");
             return false;
         }
-
-        zckChunk *tmp = NULL;
-        zckChunk *new = zmalloc(sizeof(zckChunk));
-        if (!new) {
-           zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-           return false;
+        if(count == index->chunks_alloc) {
+            set_fatal_error(zck, "Index has more than %llu entries",
+                            (long long unsigned) index->count);
+            return false;
         }
 
+        zckChunk *new = &(index->chunks[count]);
+
         /* Read index entry digest */
-        new->digest = zmalloc(zck->index.digest_size);
-        if (!new->digest) {
-           zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
-           free(new);
-           return false;
-        }
-        memcpy(new->digest, data+length, zck->index.digest_size);
-        new->digest_size = zck->index.digest_size;
-        HASH_FIND(hh, zck->index.ht, new->digest, new->digest_size, tmp);
-        if(!tmp)
-            HASH_ADD_KEYPTR(hh, zck->index.ht, new->digest, new->digest_size,
-                            new);
-        length += zck->index.digest_size;
+        new->digest = data + length;
+        new->digest_size = index->digest_size;
+        length += index->digest_size;
 
         /* Read uncompressed entry digest, if any */
         if (zck->has_uncompressed_source) {
-            /* same size for digest as compressed */
-            new->digest_uncompressed = zmalloc(zck->index.digest_size);
-            if (!new->digest_uncompressed) {
-                free(new->digest);
-                free(new);
-                zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            if(length + index->digest_size > max_length) {
+                set_fatal_error(zck, "Read past end of header");
                 return false;
             }
-            memcpy(new->digest_uncompressed, data+length, zck->index.digest_size);
-            HASH_FIND(hhuncomp, zck->index.htuncomp, new->digest_uncompressed, new->digest_size, tmp);
-            if(!tmp)
-               HASH_ADD_KEYPTR(hhuncomp, zck->index.htuncomp, new->digest_uncompressed, new->digest_size,
-                               new);
-            length += zck->index.digest_size;
-	}
+            /* same size for digest as compressed */
+            new->digest_uncompressed = data + length;
+            length += index->digest_size;
+        }
         /* Read and store entry length */
         size_t chunk_length = 0;
         if(!compint_to_size(zck, &chunk_length, data+length, &length,
                             max_length)) {
-            set_fatal_error(zck, "Unable to read chunk %i compressed size",
-                            count);
+            set_fatal_error(zck, "Unable to read chunk %llu compressed size",
+                            (long long unsigned) count);
             return false;
         }
         new->start = idx_loc;
@@ -128,8 +148,8 @@ bool index_read(zckCtx *zck, char *data, size_t size, size_t max_length) {
         chunk_length = 0;
         if(!compint_to_size(zck, &chunk_length, data+length, &length,
                             max_length)) {
-            set_fatal_error(zck, "Unable to read chunk %i uncompressed size",
-                            count);
+            set_fatal_error(zck, "Unable to read chunk %llu uncompressed size",
+                            (long long unsigned) count);
             return false;
         }
         new->length = chunk_length;
@@ -138,19 +158,134 @@ bool index_read(zckCtx *zck, char *data, size_t size, size_t max_length) {
         new->number = count;
         idx_loc += new->comp_length;
         count++;
-        zck->index.length = idx_loc;
+        index->length = idx_loc;
 
-        if(prev)
-            prev->next = new;
+        new->next = NULL;
+        if(index->last)
+            index->last->next = new;
         else
-            zck->index.first = new;
-        prev = new;
+            index->first = new;
+        index->last = new;
+        index->chunks_count = count;
+    }
+    index_build_offsets(index);
+    return true;
+}
+
+/* Only read the hash type and the number of entries, leaving the entries
+ * themselves to be decoded by index_load() the first time they're needed.
+ * data has to stay around for as long as the index does */
+bool index_read(zckCtx *zck, char *data, size_t size, size_t max_length) {
+    VALIDATE_BOOL(zck);
+    size_t length = 0;
+
+    /* Read and configure hash type */
+    int hash_type = 0;
+    if(!compint_to_int(zck, &hash_type, data + length, &length, max_length)) {
+        set_fatal_error(zck, "Unable to read hash type");
+        return false;
+    }
+    if(!set_chunk_hash_type(zck, hash_type)) {
+        set_fatal_error(zck, "Unable to set chunk hash type");
+        return false;
     }
+    /* A tree data checksum is only as strong as the chunk checksums */
+    if(zck->has_tree_digest &&
+       (hash_type == ZCK_HASH_SHA1 || hash_type == ZCK_HASH_SHA512_128 ||
+        hash_type == ZCK_HASH_BLAKE3_128)) {
+        set_fatal_error(zck, "Invalid header: tree data checksum can't use "
+                             "%s chunk checksums",
+                        zck_hash_name_from_type(hash_type));
+        return false;
+    }
+
+    /* Read number of index entries */
+    size_t index_count;
+    if(!compint_to_size(zck, &index_count, data + length, &length,
+                        max_length)) {
+        set_fatal_error(zck, "Unable to read index count");
+        return false;
+    }
+    zck->index.count = index_count;
+
     free(zck->index_string);
     zck->index_string = NULL;
+    if(length >= size)
+        return true;
+    zck->index.pending = data + length;
+    zck->index.pending_size = size - length;
+    zck->index.pending_max = max_length - length;
+    return true;
+}
+
+/* Decode the index entries if index_read() left them for later.  This is
+ * cheap once the index has been loaded, so call it before touching the
+ * index's chunks on a read context */
+bool index_load(zckCtx *zck) {
+    VALIDATE_BOOL(zck);
+
+    char *data = zck->index.pending;
+    if(data == NULL)
+        return true;
+    zck->index.pending = NULL;
+    return index_decode(zck, data, zck->index.pending_size,
+                        zck->index.pending_max);
+}
+
+static void index_add_hashdb(zckCtx *zck) {
+    for(size_t i=0; i<zck->index.chunks_count; i++) {
+        zckChunk *idx = &(zck->index.chunks[i]);
+        zckChunk *tmp = NULL;
+        HASH_FIND(hh, zck->index.ht, idx->digest, idx->digest_size, tmp);
+        if(!tmp)
+            HASH_ADD_KEYPTR(hh, zck->index.ht, idx->digest, idx->digest_size,
+                            idx);
+        /*
+         * Do the same if there is uncompressed digest
+         */
+        if (zck->has_uncompressed_source && idx->digest_uncompressed) {
+            HASH_FIND(hhuncomp, zck->index.htuncomp, idx->digest_uncompressed, idx->digest_size, tmp);
+            if(!tmp)
+               HASH_ADD_KEYPTR(hhuncomp, zck->index.htuncomp, idx->digest_uncompressed, idx->digest_size,
+                               idx);
+        }
+    }
+}
+
+/* Build the digest hash tables, which are only needed to find matching
+ * chunks in another file, if they haven't been built yet */
+bool index_load_hashdb(zckCtx *zck) {
+    if(!index_load(zck))
+        return false;
+    if(zck->index.ht == NULL && zck->index.htuncomp == NULL)
+        index_add_hashdb(zck);
     return true;
 }
 
+/* Find the chunk containing the uncompressed offset using a binary search of
+ * the offset table.  Returns NULL if offset is past the end of the data */
+zckChunk *index_find_offset(zckIndex *index, size_t offset) {
+    if(index == NULL || index->dc_offset == NULL || index->chunks_count < 2)
+        return NULL;
+
+    size_t count = index->chunks_count;
+    if(offset >= index->dc_offset[count])
+        return NULL;
+
+    /* Find the last chunk that starts at or before offset, which skips any
+     * empty chunks sharing the same start */
+    size_t low = 1;
+    size_t high = count;
+    while(high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if(index->dc_offset[mid] <= offset)
+            low = mid;
+        else
+            high = mid;
+    }
+    return &(index->chunks[low]);
+}
+
 ssize_t ZCK_PUBLIC_API zck_get_chunk_count(zckCtx *zck) {
     VALIDATE_INT(zck);
 
@@ -159,11 +294,12 @@ ssize_t ZCK_PUBLIC_API zck_get_chunk_count(zckCtx *zck) {
 
 zckChunk ZCK_PUBLIC_API *zck_get_chunk(zckCtx *zck, size_t number) {
     VALIDATE_PTR(zck);
+    if(!index_load(zck))
+        return NULL;
+
+    if(number < zck->index.chunks_count)
+        return &(zck->index.chunks[number]);
 
-    for(zckChunk *idx=zck->index.first; idx!=NULL; idx=idx->next) {
-        if(idx->number == number)
-            return idx;
-    }
     zck_log(
         ZCK_LOG_WARNING,
         "Chunk %llu not found",
@@ -174,6 +310,8 @@ zckChunk ZCK_PUBLIC_API *zck_get_chunk(zckCtx *zck, size_t number) {
 
 zckChunk ZCK_PUBLIC_API *zck_get_first_chunk(zckCtx *zck) {
     VALIDATE_PTR(zck);
+    if(!index_load(zck))
+        return NULL;
 
     return zck->index.first;
 }
@@ -281,56 +419,46 @@ bool ZCK_PUBLIC_API zck_compare_chunk_digest(zckChunk *a, zckChunk *b) {
 
 int ZCK_PUBLIC_API zck_missing_chunks(zckCtx *zck) {
     VALIDATE_READ_INT(zck);
+    if(!index_load(zck))
+        return -1;
 
     int missing = 0;
-    for(zckChunk *idx = zck->index.first; idx; idx=idx->next)
-        if(idx->valid == 0)
+    for(size_t i=0; i<zck->index.chunks_count; i++)
+        if(zck->index.chunks[i].valid == 0)
             missing++;
     return missing;
 }
 
 int ZCK_PUBLIC_API zck_failed_chunks(zckCtx *zck) {
     VALIDATE_READ_INT(zck);
+    if(!index_load(zck))
+        return -1;
 
     int failed = 0;
-    for(zckChunk *idx = zck->index.first; idx; idx=idx->next)
-        if(idx->valid == -1)
+    for(size_t i=0; i<zck->index.chunks_count; i++)
+        if(zck->index.chunks[i].valid == -1)
             failed++;
     return failed;
 }
 
 void ZCK_PUBLIC_API zck_reset_failed_chunks(zckCtx *zck) {
-    if(!zck)
+    if(!zck || !index_load(zck))
         return;
 
-    for(zckChunk *idx = zck->index.first; idx; idx=idx->next)
-        if(idx->valid == -1)
-            idx->valid = 0;
+    for(size_t i=0; i<zck->index.chunks_count; i++)
+        if(zck->index.chunks[i].valid == -1)
+            zck->index.chunks[i].valid = 0;
     return;
 }
 
 bool ZCK_PUBLIC_API zck_generate_hashdb(zckCtx *zck) {
+    if(!index_load(zck))
+        return false;
     if (zck->index.ht || zck->index.htuncomp) {
         zck_log(ZCK_LOG_ERROR, "Hash DB already present, it could not be created");
         return false;
     }
 
-    for(zckChunk *idx = zck->index.first; idx; idx=idx->next) {
-        zckChunk *tmp = NULL;
-        HASH_FIND(hh, zck->index.ht, idx->digest, idx->digest_size, tmp);
-        if(!tmp)
-            HASH_ADD_KEYPTR(hh, zck->index.ht, idx->digest, idx->digest_size,
-                            idx);
-        /*
-         * Do the same if there is uncompressed digest
-         */
-        if (zck->has_uncompressed_source && idx->digest_uncompressed) {
-            HASH_FIND(hhuncomp, zck->index.htuncomp, idx->digest_uncompressed, idx->digest_size, tmp);
-            if(!tmp)
-               HASH_ADD_KEYPTR(hhuncomp, zck->index.htuncomp, idx->digest_uncompressed, idx->digest_size,
-                               idx);
-        }
-    }
-
+    index_add_hashdb(zck);
     return true;
 }
@@ -24,16 +24,105 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+/* For SEEK_DATA and SEEK_HOLE */
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include <zck.h>
 
 #include "zck_private.h"
 
+bool map_data(zckCtx *zck) {
+    VALIDATE_READ_BOOL(zck);
+
+    unmap_data(zck);
+
+#ifndef _WIN32
+    struct stat st;
+    if(fstat(zck->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        zck_log(ZCK_LOG_DEBUG, "Not a regular file, unable to map it");
+        return false;
+    }
+    off_t loc = lseek(zck->fd, 0, SEEK_CUR);
+    if(loc == -1)
+        return false;
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, zck->fd, 0);
+    if(map == MAP_FAILED) {
+        zck_log(ZCK_LOG_DEBUG, "Unable to map file: %s", strerror(errno));
+        return false;
+    }
+    zck_log(ZCK_LOG_DEBUG, "Mapped %llu bytes",
+            (long long unsigned) st.st_size);
+    zck->src_buf = map;
+    zck->src_buf_size = st.st_size;
+    zck->src_loc = loc;
+    zck->src_buf_mapped = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void unmap_data(zckCtx *zck) {
+    if(zck == NULL)
+        return;
+
+#ifndef _WIN32
+    if(zck->src_buf_mapped)
+        munmap((void *)zck->src_buf, zck->src_buf_size);
+#endif
+    zck->src_buf = NULL;
+    zck->src_buf_size = 0;
+    zck->src_loc = 0;
+    zck->src_buf_mapped = false;
+}
+
+/* Read from the context's own position in fd, leaving the shared file
+ * offset alone */
+static ssize_t read_positional(zckCtx *zck, char *data, size_t length) {
+#ifndef _WIN32
+    ssize_t read_bytes = pread(zck->fd, data, length, zck->src_loc);
+    if(read_bytes > 0)
+        zck->src_loc += read_bytes;
+    return read_bytes;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* When reading from memory, point *data at the next length bytes (or fewer
+ * at the end of the data) without copying them.  Otherwise read them into
+ * buf and point *data at buf */
+ssize_t read_data_ptr(zckCtx *zck, const char **data, char *buf,
+                      size_t length) {
+    VALIDATE_READ_INT(zck);
+    ALLOCD_INT(zck, data);
+
+    if(zck->src_buf == NULL) {
+        *data = buf;
+        return read_data(zck, buf, length);
+    }
+
+    *data = zck->src_buf + zck->src_loc;
+    if(zck->src_loc >= zck->src_buf_size)
+        return 0;
+    if(length > zck->src_buf_size - zck->src_loc)
+        length = zck->src_buf_size - zck->src_loc;
+    zck->src_loc += length;
+    return length;
+}
+
 ssize_t read_data(zckCtx *zck, char *data, size_t length) {
     VALIDATE_READ_INT(zck);
 
@@ -43,7 +132,18 @@ ssize_t read_data(zckCtx *zck, char *data, size_t length) {
         set_error(zck, "Unable to read to NULL data pointer");
         return -1;
     }
-    ssize_t read_bytes = read(zck->fd, data, length);
+    if(zck->src_buf) {
+        const char *src = NULL;
+        ssize_t read_bytes = read_data_ptr(zck, &src, NULL, length);
+        if(read_bytes > 0)
+            memcpy(data, src, read_bytes);
+        return read_bytes;
+    }
+    ssize_t read_bytes = 0;
+    if(zck->src_positional)
+        read_bytes = read_positional(zck, data, length);
+    else
+        read_bytes = read(zck->fd, data, length);
     if(read_bytes == -1) {
         set_error(zck, "Error reading data: %s", strerror(errno));
         return -1;
@@ -79,10 +179,38 @@ int write_data(zckCtx *zck, int fd, const char *data, size_t length) {
     return true;
 }
 
+/* Seek within an in-memory source or a context's own file position */
+static bool seek_loc(zckCtx *zck, off_t offset, int whence) {
+    off_t base = 0;
+    if(whence == SEEK_CUR) {
+        base = zck->src_loc;
+    } else if(whence == SEEK_END) {
+        if(zck->src_buf) {
+            base = zck->src_buf_size;
+        } else {
+            struct stat st;
+            if(fstat(zck->fd, &st) != 0)
+                return false;
+            base = st.st_size;
+        }
+    } else if(whence != SEEK_SET) {
+        errno = EINVAL;
+        return false;
+    }
+    if(base + offset < 0) {
+        errno = EINVAL;
+        return false;
+    }
+    zck->src_loc = base + offset;
+    return true;
+}
+
 int seek_data(zckCtx *zck, off_t offset, int whence) {
     VALIDATE_INT(zck);
 
-    if(lseek(zck->fd, offset, whence) == -1) {
+    bool own_loc = zck->src_buf || zck->src_positional;
+    if((own_loc && !seek_loc(zck, offset, whence)) ||
+       (!own_loc && lseek(zck->fd, offset, whence) == -1)) {
         char *wh_str = NULL;
 
         if(whence == SEEK_CUR) {
@@ -107,10 +235,71 @@ int seek_data(zckCtx *zck, off_t offset, int whence) {
 }
 
 ssize_t tell_data(zckCtx *zck) {
+    if(zck->src_buf || zck->src_positional)
+        return zck->src_loc;
     ssize_t loc = lseek(zck->fd, 0, SEEK_CUR);
     return loc;
 }
 
+/* Flag chunks that run past the end of the file or lie entirely in holes,
+ * since they can't have been written yet.  Returns how many were flagged */
+size_t find_unwritten_chunks(zckCtx *zck, bool *unwritten) {
+    off_t size = zck->src_buf_size;
+    if(zck->src_buf == NULL) {
+        struct stat st;
+        if(fstat(zck->fd, &st) != 0 || !S_ISREG(st.st_mode))
+            return 0;
+        size = st.st_size;
+    }
+
+    /* Data regions are looked up as needed, and the one found last is
+     * remembered, since chunks are in file order */
+    bool holes = false;
+    off_t loc = -1;
+    off_t data_start = 0;
+    off_t data_end = 0;
+#ifdef SEEK_DATA
+    if(zck->src_buf == NULL || zck->src_buf_mapped) {
+        loc = lseek(zck->fd, 0, SEEK_CUR);
+        holes = (loc != -1);
+    }
+#endif
+
+    size_t count = 0;
+    for(zckChunk *idx = zck->index.first; idx; idx = idx->next) {
+        if(idx->comp_length == 0)
+            continue;
+        off_t start = zck->data_offset + idx->start;
+        off_t end = start + idx->comp_length;
+        bool missing = (end > size);
+#ifdef SEEK_DATA
+        if(!missing && holes && start >= data_end) {
+            data_start = lseek(zck->fd, start, SEEK_DATA);
+            if(data_start != -1)
+                data_end = lseek(zck->fd, data_start, SEEK_HOLE);
+            if(data_start == -1 && errno == ENXIO) {
+                /* Nothing but holes from here to the end */
+                data_start = size;
+                data_end = size;
+            } else if(data_start == -1 || data_end == -1) {
+                zck_log(ZCK_LOG_DEBUG, "Unable to find holes: %s",
+                        strerror(errno));
+                holes = false;
+            }
+        }
+        if(!missing && holes && data_start >= end)
+            missing = true;
+#endif
+        if(missing) {
+            unwritten[idx->number] = true;
+            count++;
+        }
+    }
+    if(loc != -1)
+        lseek(zck->fd, loc, SEEK_SET);
+    return count;
+}
+
 int chunks_from_temp(zckCtx *zck) {
     int read_count;
 
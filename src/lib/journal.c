@@ -0,0 +1,285 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zck.h>
+
+#include "zck_private.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#if defined(__APPLE__)
+#define MTIME_NSEC(st)  ((st).st_mtimespec.tv_nsec)
+#elif defined(_WIN32)
+#define MTIME_NSEC(st)  0
+#else
+#define MTIME_NSEC(st)  ((st).st_mtim.tv_nsec)
+#endif
+
+#define JOURNAL_MAGIC   "\0ZCKVJ1\n"
+
+/* The journal is a local cache, so it's stored in host byte order.  A
+ * bitmap of verified chunks, indexed by chunk number, follows the header */
+typedef struct journalHeader {
+    char magic[8];
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t chunk_count;
+    uint64_t digest_size;
+    char header_digest[MAX_DIGEST_SIZE];
+} journalHeader;
+
+/* Sidecar record of which chunks in the file have already been verified.
+ * It's only trusted if the file's identity (inode, size and mtime) hasn't
+ * changed since the journal was last written and the header digest still
+ * matches, so anything else touching the file means a full rehash */
+struct zckJournal {
+    int fd;
+    /* The file was unchanged when the journal was opened */
+    bool matched;
+    journalHeader hdr;
+    char *bits;
+    size_t bits_size;
+};
+
+static bool get_identity(zckCtx *zck, journalHeader *hdr) {
+    struct stat st = {0};
+    if(fstat(zck->fd, &st) != 0) {
+        zck_log(ZCK_LOG_WARNING, "Unable to stat file: %s", strerror(errno));
+        return false;
+    }
+    hdr->inode = st.st_ino;
+    hdr->size = st.st_size;
+    hdr->mtime_sec = st.st_mtime;
+    hdr->mtime_nsec = MTIME_NSEC(st);
+    return true;
+}
+
+static bool write_at(int fd, size_t offset, const char *data, size_t length) {
+    if(lseek(fd, offset, SEEK_SET) == -1)
+        return false;
+    while(length > 0) {
+        ssize_t wb = write(fd, data, length);
+        if(wb < 0 && errno == EINTR)
+            continue;
+        if(wb < 1)
+            return false;
+        data += wb;
+        length -= wb;
+    }
+    return true;
+}
+
+static bool read_at(int fd, size_t offset, char *data, size_t length) {
+    if(lseek(fd, offset, SEEK_SET) == -1)
+        return false;
+    while(length > 0) {
+        ssize_t rb = read(fd, data, length);
+        if(rb < 0 && errno == EINTR)
+            continue;
+        if(rb < 1)
+            return false;
+        data += rb;
+        length -= rb;
+    }
+    return true;
+}
+
+/* Read the journal, and remember it if the file hasn't changed since it was
+ * written */
+static void journal_load(zckCtx *zck, zckJournal *j) {
+    journalHeader cur = {0};
+    if(!read_at(j->fd, 0, (char *)&(j->hdr), sizeof(journalHeader)) ||
+       memcmp(j->hdr.magic, JOURNAL_MAGIC, sizeof(j->hdr.magic)) != 0 ||
+       j->hdr.digest_size > MAX_DIGEST_SIZE ||
+       !get_identity(zck, &cur))
+        return;
+    if(cur.inode != j->hdr.inode || cur.size != j->hdr.size ||
+       cur.mtime_sec != j->hdr.mtime_sec ||
+       cur.mtime_nsec != j->hdr.mtime_nsec) {
+        zck_log(ZCK_LOG_DEBUG, "File has changed, ignoring validity journal");
+        return;
+    }
+    /* Each chunk is at least one byte of the file */
+    if(j->hdr.chunk_count > j->hdr.size)
+        return;
+    size_t bits_size = (j->hdr.chunk_count + 7) / 8;
+    char *bits = zmalloc(bits_size + 1);
+    if(!bits) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return;
+    }
+    if(!read_at(j->fd, sizeof(journalHeader), bits, bits_size)) {
+        free(bits);
+        return;
+    }
+    j->bits = bits;
+    j->bits_size = bits_size;
+    j->matched = true;
+}
+
+bool journal_open(zckCtx *zck, const char *path) {
+    VALIDATE_READ_BOOL(zck);
+
+    if(zck->fd < 0) {
+        set_error(zck, "The file descriptor must be set before the validity "
+                       "journal");
+        return false;
+    }
+    journal_close(zck);
+
+    zckJournal *j = zmalloc(sizeof(zckJournal));
+    if(!j) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    j->fd = open(path, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if(j->fd < 0) {
+        set_error(zck, "Unable to open validity journal %s: %s", path,
+                  strerror(errno));
+        free(j);
+        return false;
+    }
+    /* The file is about to be changed, so check it now */
+    journal_load(zck, j);
+    zck->journal = j;
+    return true;
+}
+
+/* Set chunks recorded as verified as valid.  Returns false if the journal
+ * can't be used for this file */
+bool journal_apply(zckCtx *zck) {
+    zckJournal *j = zck->journal;
+    if(j == NULL || !j->matched || zck->header_only ||
+       zck->header_digest == NULL)
+        return false;
+    /* The journal only describes the file as it was opened */
+    j->matched = false;
+
+    if(j->hdr.chunk_count != zck->index.count ||
+       j->hdr.digest_size != zck->hash_type.digest_size ||
+       memcmp(j->hdr.header_digest, zck->header_digest,
+              j->hdr.digest_size) != 0) {
+        zck_log(ZCK_LOG_DEBUG, "Header has changed, ignoring validity "
+                               "journal");
+        return false;
+    }
+    size_t count = 0;
+    for(zckChunk *idx = zck->index.first; idx; idx = idx->next) {
+        if(idx->number >= j->hdr.chunk_count)
+            return false;
+        if(j->bits[idx->number / 8] & (1 << (idx->number % 8))) {
+            idx->valid = 1;
+            count++;
+        }
+    }
+    zck_log(ZCK_LOG_DEBUG, "Validity journal has %llu verified chunks",
+            (long long unsigned) count);
+    return true;
+}
+
+/* Rewrite the journal from the current state of the chunks */
+void journal_save(zckCtx *zck) {
+    zckJournal *j = zck->journal;
+    if(j == NULL || zck->header_digest == NULL || zck->header_only ||
+       zck->fd < 0 || zck->index.pending)
+        return;
+
+    size_t bits_size = (zck->index.count + 7) / 8;
+    if(j->bits_size != bits_size) {
+        j->bits = zrealloc(j->bits, bits_size + 1);
+        j->bits_size = 0;
+        if(!j->bits) {
+            zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            return;
+        }
+        j->bits_size = bits_size;
+    }
+    memset(j->bits, 0, bits_size);
+    for(zckChunk *idx = zck->index.first; idx; idx = idx->next)
+        if(idx->valid == 1 && idx->number < zck->index.count)
+            j->bits[idx->number / 8] |= 1 << (idx->number % 8);
+
+    memset(&(j->hdr), 0, sizeof(journalHeader));
+    memcpy(j->hdr.magic, JOURNAL_MAGIC, sizeof(j->hdr.magic));
+    j->hdr.chunk_count = zck->index.count;
+    j->hdr.digest_size = zck->hash_type.digest_size;
+    memcpy(j->hdr.header_digest, zck->header_digest, j->hdr.digest_size);
+    j->matched = false;
+    if(!get_identity(zck, &(j->hdr)) ||
+       !write_at(j->fd, 0, (char *)&(j->hdr), sizeof(journalHeader)) ||
+       !write_at(j->fd, sizeof(journalHeader), j->bits, bits_size))
+        zck_log(ZCK_LOG_WARNING, "Unable to write validity journal");
+}
+
+/* Record whether idx is verified.  The bit is written before the file's new
+ * identity, so if we're interrupted in between, the journal is ignored */
+void journal_mark(zckCtx *zck, zckChunk *idx) {
+    zckJournal *j = zck->journal;
+    if(j == NULL || idx == NULL)
+        return;
+    if(j->bits == NULL || j->hdr.chunk_count != zck->index.count) {
+        journal_save(zck);
+        return;
+    }
+    if(idx->number >= j->hdr.chunk_count)
+        return;
+
+    char *byte = j->bits + idx->number / 8;
+    char old = *byte;
+    if(idx->valid == 1)
+        *byte |= 1 << (idx->number % 8);
+    else
+        *byte &= ~(1 << (idx->number % 8));
+    if((*byte != old &&
+        !write_at(j->fd, sizeof(journalHeader) + idx->number / 8, byte, 1)) ||
+       !get_identity(zck, &(j->hdr)) ||
+       !write_at(j->fd, 0, (char *)&(j->hdr), sizeof(journalHeader)))
+        zck_log(ZCK_LOG_WARNING, "Unable to write validity journal");
+}
+
+void journal_close(zckCtx *zck) {
+    zckJournal *j = zck->journal;
+    if(j == NULL)
+        return;
+    journal_save(zck);
+    close(j->fd);
+    free(j->bits);
+    free(j);
+    zck->journal = NULL;
+}
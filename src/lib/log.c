@@ -56,9 +56,15 @@ void ZCK_PUBLIC_API zck_set_log_callback(logcallback function) {
     callback = function;
 }
 
+/* Whether a message of type lt would go anywhere, so callers can skip
+ * building expensive ones */
+bool zck_log_enabled(zck_log_type lt) {
+    return lt >= log_level && log_level != ZCK_LOG_ERROR;
+}
+
 void zck_log_v(const char *function, zck_log_type lt, const char *format,
      va_list args) {
-    if(lt < log_level || log_level == ZCK_LOG_ERROR)
+    if(!zck_log_enabled(lt))
         return;
 
     if (callback) {
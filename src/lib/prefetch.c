@@ -0,0 +1,448 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <zck.h>
+#ifdef ZCHUNK_THREADS
+#include <pthread.h>
+#endif
+
+#include "zck_private.h"
+
+#ifdef ZCHUNK_THREADS
+/* A chunk read and decompressed by a background worker */
+typedef struct prefetchSlot {
+    zckChunk *chunk;
+    const char *src;
+    char *comp;
+    size_t comp_size;
+    char *data;
+    size_t data_size;
+    bool ready;
+    bool failed;
+    int worker;
+} prefetchSlot;
+
+typedef struct prefetchWorker {
+    zckPrefetch *p;
+    int id;
+    zckReader *reader;
+    pthread_t thread;
+} prefetchWorker;
+#endif
+
+/* Read-ahead state for sequential reads.  Upcoming chunks are always
+ * advised to the kernel.  When more than one thread is allowed, background
+ * workers also read and decompress them into a ring of slots that zck_read()
+ * copies from.  The slot at head is the one zck_read() is working on, and
+ * the next claimed - 1 slots are being filled or are ready */
+struct zckPrefetch {
+    int fd;
+    size_t data_offset;
+    int depth;
+    size_t advised;
+#ifdef ZCHUNK_THREADS
+    prefetchWorker *workers;
+    int worker_count;
+    int active;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    prefetchSlot *slots;
+    int slot_count;
+    int head;
+    int claimed;
+    bool held;
+    zckChunk *next;
+    bool stop;
+
+    /* Only used by the thread calling zck_read() */
+    prefetchSlot *cur;
+    size_t cur_loc;
+    bool eof;
+    bool failed;
+#endif
+};
+
+/* Tell the kernel we'll soon need the compressed data from idx up to depth
+ * chunks past it, skipping anything we've already asked for */
+static void prefetch_advise(zckPrefetch *p, zckChunk *idx) {
+#ifdef POSIX_FADV_WILLNEED
+    if(p->fd < 0)
+        return;
+    zckChunk *last = idx;
+    for(int i=0; i<p->depth && last->next; i++)
+        last = last->next;
+    size_t start = idx->start;
+    size_t end = last->start + last->comp_length;
+    if(start < p->advised)
+        start = p->advised;
+    if(end <= start)
+        return;
+    /* This is only a hint, so failure doesn't matter */
+    (void)posix_fadvise(p->fd, p->data_offset + start, end - start,
+                        POSIX_FADV_WILLNEED);
+    p->advised = end;
+#endif
+}
+
+#ifdef ZCHUNK_THREADS
+/* Read slot's chunk using the worker's reader and, unless it's the
+ * dictionary, decompress it */
+static bool fill_slot(zckCtx *zck, prefetchSlot *slot) {
+    zckChunk *chunk = slot->chunk;
+
+    if(!seek_data(zck, zck_get_chunk_start(chunk), SEEK_SET))
+        return false;
+    if(zck->src_buf == NULL && slot->comp_size < chunk->comp_length) {
+        slot->comp = zrealloc(slot->comp, chunk->comp_length);
+        slot->comp_size = 0;
+        if(!slot->comp) {
+            zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            return false;
+        }
+        slot->comp_size = chunk->comp_length;
+    }
+    size_t rb = 0;
+    while(rb < chunk->comp_length) {
+        const char *data = NULL;
+        ssize_t r = read_data_ptr(zck, &data, slot->comp + rb,
+                                  chunk->comp_length - rb);
+        if(r < 0)
+            return false;
+        if(r == 0) {
+            set_error(zck, "Unexpected end of file reading chunk %llu",
+                      (long long unsigned) chunk->number);
+            return false;
+        }
+        /* In memory, the whole chunk comes back in one go */
+        if(rb == 0)
+            slot->src = data;
+        rb += r;
+    }
+
+    if(chunk == zck->index.first)
+        return true;
+    if(slot->data_size < chunk->length) {
+        slot->data = zrealloc(slot->data, chunk->length);
+        slot->data_size = 0;
+        if(!slot->data) {
+            zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            return false;
+        }
+        slot->data_size = chunk->length;
+    }
+    return comp_decompress_chunk(zck, chunk, slot->src, slot->data,
+                                 VERIFY_CHUNKS(zck)) >= 0;
+}
+
+static void *prefetch_run(void *data) {
+    prefetchWorker *worker = data;
+    zckPrefetch *p = worker->p;
+
+    pthread_mutex_lock(&(p->lock));
+    while(!p->stop) {
+        /* Chunks without compressed data have nothing to read */
+        while(p->next && p->next->comp_length == 0)
+            p->next = p->next->next;
+        if(p->next == NULL)
+            break;
+        if(p->claimed == p->slot_count) {
+            pthread_cond_wait(&(p->cond), &(p->lock));
+            continue;
+        }
+        prefetchSlot *slot = &(p->slots[(p->head + p->claimed) %
+                                        p->slot_count]);
+        p->claimed++;
+        slot->chunk = p->next;
+        slot->ready = false;
+        p->next = p->next->next;
+        prefetch_advise(p, slot->chunk);
+        pthread_mutex_unlock(&(p->lock));
+
+        bool filled = fill_slot(&(worker->reader->zck), slot);
+
+        pthread_mutex_lock(&(p->lock));
+        slot->ready = true;
+        if(!filled) {
+            /* Leave the reader alone so the error can be picked up */
+            slot->failed = true;
+            slot->worker = worker->id;
+            p->stop = true;
+        }
+        pthread_cond_broadcast(&(p->cond));
+    }
+    p->active--;
+    pthread_cond_broadcast(&(p->cond));
+    pthread_mutex_unlock(&(p->lock));
+    return NULL;
+}
+
+static void prefetch_stop_workers(zckPrefetch *p) {
+    pthread_mutex_lock(&(p->lock));
+    p->stop = true;
+    pthread_cond_broadcast(&(p->cond));
+    pthread_mutex_unlock(&(p->lock));
+    for(int i=0; i<p->worker_count; i++)
+        pthread_join(p->workers[i].thread, NULL);
+    pthread_mutex_destroy(&(p->lock));
+    pthread_cond_destroy(&(p->cond));
+}
+
+static void prefetch_free_workers(zckPrefetch *p) {
+    if(p->workers)
+        for(int i=0; i<p->worker_count; i++)
+            zck_reader_free(&(p->workers[i].reader));
+    free(p->workers);
+    p->workers = NULL;
+    if(p->slots) {
+        for(int i=0; i<p->slot_count; i++) {
+            free(p->slots[i].comp);
+            free(p->slots[i].data);
+        }
+    }
+    free(p->slots);
+    p->slots = NULL;
+}
+
+/* Start worker_count workers decompressing from the first chunk */
+static bool prefetch_start_workers(zckCtx *zck, zckPrefetch *p,
+                                   int worker_count) {
+    /* The dictionary has to be loaded before readers copy it, and loading
+     * it adds it to the data checksum, so restart that afterwards */
+    if(!comp_load_dict(zck) ||
+       !hash_init(zck, &(zck->check_full_hash), &(zck->hash_type)))
+        return false;
+
+    /* Each worker can have a chunk in progress, plus the read-ahead */
+    p->slot_count = p->depth + worker_count;
+    p->slots = zmalloc(p->slot_count * sizeof(prefetchSlot));
+    p->workers = zmalloc(worker_count * sizeof(prefetchWorker));
+    if(!p->slots || !p->workers) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        goto error;
+    }
+    p->worker_count = worker_count;
+    for(int i=0; i<worker_count; i++) {
+        p->workers[i].reader = zck_reader_create(zck);
+        if(p->workers[i].reader == NULL)
+            goto error;
+        p->workers[i].p = p;
+        p->workers[i].id = i;
+    }
+
+    p->next = zck->index.first;
+    pthread_mutex_init(&(p->lock), NULL);
+    pthread_cond_init(&(p->cond), NULL);
+    /* If a thread can't be started, carry on with the ones we have.  Hold
+     * the lock so workers don't finish before they've all been counted */
+    pthread_mutex_lock(&(p->lock));
+    int started = 0;
+    for(; started < worker_count; started++) {
+        if(pthread_create(&(p->workers[started].thread), NULL,
+                          prefetch_run, &(p->workers[started])) != 0) {
+            zck_log(ZCK_LOG_DEBUG, "Unable to start thread %i", started);
+            break;
+        }
+    }
+    p->worker_count = started;
+    p->active = started;
+    pthread_mutex_unlock(&(p->lock));
+    if(started == 0) {
+        set_error(zck, "Unable to start any read-ahead threads");
+        pthread_mutex_destroy(&(p->lock));
+        pthread_cond_destroy(&(p->cond));
+        goto error;
+    }
+    return true;
+error:
+    prefetch_free_workers(p);
+    return false;
+}
+#endif
+
+bool prefetch_start(zckCtx *zck) {
+    VALIDATE_READ_BOOL(zck);
+
+    if(zck->read_ahead == 0 || zck->prefetch || zck->index.first == NULL)
+        return true;
+
+    zckPrefetch *p = zmalloc(sizeof(zckPrefetch));
+    if(!p) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return false;
+    }
+    p->fd = zck->src_buf ? -1 : zck->fd;
+    p->data_offset = zck_get_header_length(zck);
+    /* There's no point reading further ahead, or having more workers,
+     * than there are chunks */
+    p->depth = zck->read_ahead;
+    if(p->depth > zck->index.chunks_count)
+        p->depth = zck->index.chunks_count;
+
+#ifdef ZCHUNK_THREADS
+    /* Workers can only take over before zck_read() has started.  They read
+     * from the file using their own position, so it has to be seekable */
+    bool can_seek = (zck->src_buf != NULL);
+#ifndef _WIN32
+    can_seek = can_seek || lseek(zck->fd, 0, SEEK_CUR) != -1;
+#endif
+    int threads = get_thread_count(zck);
+    if(threads > zck->index.chunks_count)
+        threads = zck->index.chunks_count;
+    if(threads > 1 && can_seek && zck->comp.data_idx == NULL &&
+       zck->comp.data_loc == 0 && zck->comp.dc_data_size == 0 &&
+       !prefetch_start_workers(zck, p, threads)) {
+        free(p);
+        return false;
+    }
+#endif
+    zck->prefetch = p;
+    return true;
+}
+
+/* Whether zck_read() should get its data from prefetch_read() rather than
+ * comp_read() */
+bool prefetch_decompressing(zckCtx *zck) {
+#ifdef ZCHUNK_THREADS
+    return zck && zck->prefetch && zck->prefetch->workers;
+#else
+    return false;
+#endif
+}
+
+/* Called by comp_read() when it starts reading a new chunk */
+void prefetch_chunk(zckCtx *zck, zckChunk *idx) {
+    if(zck == NULL || zck->prefetch == NULL || idx == NULL)
+        return;
+    prefetch_advise(zck->prefetch, idx);
+}
+
+#ifdef ZCHUNK_THREADS
+/* Move on to the next decompressed chunk.  Returns 1 if there is one, 0 at
+ * the end of the data and -1 on error */
+static int prefetch_next(zckCtx *zck, zckPrefetch *p) {
+    while(true) {
+        pthread_mutex_lock(&(p->lock));
+        if(p->held) {
+            p->head = (p->head + 1) % p->slot_count;
+            p->claimed--;
+            p->held = false;
+            pthread_cond_broadcast(&(p->cond));
+        }
+        while(!(p->claimed > 0 && p->slots[p->head].ready) &&
+              !(p->claimed == 0 && p->active == 0))
+            pthread_cond_wait(&(p->cond), &(p->lock));
+        prefetchSlot *slot = NULL;
+        if(p->claimed > 0) {
+            slot = &(p->slots[p->head]);
+            p->held = true;
+        }
+        pthread_mutex_unlock(&(p->lock));
+
+        p->cur = slot;
+        p->cur_loc = 0;
+        if(slot == NULL) {
+            p->eof = true;
+            return 0;
+        }
+        if(slot->failed) {
+            zckCtx *rzck = &(p->workers[slot->worker].reader->zck);
+            if(zck_is_error(rzck))
+                copy_error(zck, rzck);
+            else
+                set_error(zck, "Unable to read ahead chunk %llu",
+                          (long long unsigned) slot->chunk->number);
+            p->failed = true;
+            return -1;
+        }
+        if(HASH_DATA(zck) &&
+           !hash_update(zck, &(zck->check_full_hash), slot->src,
+                        slot->chunk->comp_length)) {
+            p->failed = true;
+            return -1;
+        }
+        /* The dictionary is only part of the data checksum */
+        if(slot->chunk == zck->index.first)
+            continue;
+        if(VERIFY_CHUNKS(zck))
+            slot->chunk->valid = 1;
+        return 1;
+    }
+}
+#endif
+
+/* Copy up to dst_size bytes of decompressed data from the workers */
+ssize_t prefetch_read(zckCtx *zck, char *dst, size_t dst_size) {
+    VALIDATE_READ_INT(zck);
+    ALLOCD_INT(zck, dst);
+
+#ifdef ZCHUNK_THREADS
+    zckPrefetch *p = zck->prefetch;
+    if(p->failed) {
+        set_error(zck, "Read-ahead has already failed");
+        return -1;
+    }
+    size_t dc = 0;
+    while(dc < dst_size && !p->eof) {
+        if(p->cur == NULL || p->cur_loc == p->cur->chunk->length) {
+            int ret = prefetch_next(zck, p);
+            if(ret < 0)
+                return -1;
+            continue;
+        }
+        size_t rs = p->cur->chunk->length - p->cur_loc;
+        if(rs > dst_size - dc)
+            rs = dst_size - dc;
+        memcpy(dst + dc, p->cur->data + p->cur_loc, rs);
+        p->cur_loc += rs;
+        dc += rs;
+    }
+    return dc;
+#else
+    set_error(zck, "Built without thread support");
+    return -1;
+#endif
+}
+
+void prefetch_stop(zckCtx *zck) {
+    if(zck == NULL || zck->prefetch == NULL)
+        return;
+
+    zckPrefetch *p = zck->prefetch;
+#ifdef ZCHUNK_THREADS
+    if(p->workers) {
+        prefetch_stop_workers(p);
+        prefetch_free_workers(p);
+    }
+#endif
+    free(p);
+    zck->prefetch = NULL;
+}
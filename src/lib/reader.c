@@ -0,0 +1,163 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zck.h>
+
+#include "zck_private.h"
+
+/* A reader is a private copy of its parent context.  The parsed header and
+ * index are shared with the parent and only ever read, while the compression
+ * state, checksums, file position and error message belong to the reader */
+static void reader_clean(zckReader *reader) {
+    zckCtx *zck = &(reader->zck);
+
+    if(!comp_close(zck))
+        zck_log(ZCK_LOG_WARNING, "Unable to close compression");
+    hash_close(&(zck->check_full_hash));
+    hash_close(&(zck->check_chunk_hash));
+    free(zck->msg);
+    zck->msg = NULL;
+}
+
+zckReader ZCK_PUBLIC_API *zck_reader_create(zckCtx *zck) {
+    VALIDATE_READ_PTR(zck);
+
+    if(zck->data_offset == 0) {
+        set_error(zck, "Header hasn't been read yet");
+        return NULL;
+    }
+    /* Readers share the index, so it has to be decoded before it's copied */
+    if(!index_load(zck))
+        return NULL;
+#ifdef _WIN32
+    if(zck->src_buf == NULL) {
+        set_error(zck, "Readers need the file to be mapped or in memory");
+        return NULL;
+    }
+#endif
+
+    zckReader *reader = zmalloc(sizeof(zckReader));
+    if(!reader) {
+        zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+        return NULL;
+    }
+    reader->parent = zck;
+
+    zckCtx *rzck = &(reader->zck);
+    memcpy(rzck, zck, sizeof(zckCtx));
+    rzck->msg = NULL;
+    rzck->error_state = 0;
+    memset(&(rzck->comp), 0, sizeof(zckComp));
+    memset(&(rzck->full_hash), 0, sizeof(zckHash));
+    memset(&(rzck->check_full_hash), 0, sizeof(zckHash));
+    memset(&(rzck->check_chunk_hash), 0, sizeof(zckHash));
+    memset(&(rzck->cache), 0, sizeof(zckCache));
+    rzck->prefetch = NULL;
+    rzck->journal = NULL;
+    rzck->hash_queue = NULL;
+    rzck->src_buf_mapped = false;
+    rzck->src_positional = (rzck->src_buf == NULL);
+    rzck->src_loc = 0;
+
+    if(!comp_ioption(rzck, ZCK_COMP_TYPE, zck->comp.type) ||
+       !hash_init(rzck, &(rzck->check_full_hash), &(rzck->hash_type)))
+        goto error;
+
+    /* Use our own copy of the dictionary if the parent has already read it */
+    if(zck->comp.dict) {
+        char *dict = zmalloc(zck->comp.dict_size);
+        if(!dict) {
+            zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            goto error;
+        }
+        memcpy(dict, zck->comp.dict, zck->comp.dict_size);
+        if(!comp_soption(rzck, ZCK_COMP_DICT, dict, zck->comp.dict_size)) {
+            free(dict);
+            goto error;
+        }
+    }
+    return reader;
+error:
+    set_error(zck, "Unable to create reader: %s", zck_get_error(rzck));
+    reader_clean(reader);
+    free(reader);
+    return NULL;
+}
+
+ssize_t ZCK_PUBLIC_API zck_reader_get_chunk_data(zckReader *reader,
+                                                 zckChunk *idx, char *dst,
+                                                 size_t dst_size) {
+    ALLOCD_INT(NULL, reader);
+    VALIDATE_INT(&(reader->zck));
+    ALLOCD_INT(&(reader->zck), idx);
+
+    if(idx->zck != reader->parent) {
+        set_error(&(reader->zck), "Chunk doesn't belong to reader's context");
+        return -1;
+    }
+    return comp_get_chunk_data(&(reader->zck), idx, dst, dst_size);
+}
+
+ssize_t ZCK_PUBLIC_API zck_reader_get_chunk_comp_data(zckReader *reader,
+                                                      zckChunk *idx,
+                                                      char *dst,
+                                                      size_t dst_size) {
+    ALLOCD_INT(NULL, reader);
+    VALIDATE_INT(&(reader->zck));
+    ALLOCD_INT(&(reader->zck), idx);
+
+    if(idx->zck != reader->parent) {
+        set_error(&(reader->zck), "Chunk doesn't belong to reader's context");
+        return -1;
+    }
+    return comp_get_chunk_comp_data(&(reader->zck), idx, dst, dst_size);
+}
+
+const char ZCK_PUBLIC_API *zck_reader_get_error(zckReader *reader) {
+    if(reader == NULL)
+        return zck_get_error(NULL);
+
+    return zck_get_error(&(reader->zck));
+}
+
+bool ZCK_PUBLIC_API zck_reader_clear_error(zckReader *reader) {
+    if(reader == NULL)
+        return true;
+
+    return zck_clear_error(&(reader->zck));
+}
+
+void ZCK_PUBLIC_API zck_reader_free(zckReader **reader) {
+    if(reader == NULL || *reader == NULL)
+        return;
+    reader_clean(*reader);
+    free(*reader);
+    *reader = NULL;
+}
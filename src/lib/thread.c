@@ -0,0 +1,134 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <zck.h>
+#ifdef ZCHUNK_THREADS
+#include <pthread.h>
+#endif
+
+#include "zck_private.h"
+
+#ifdef ZCHUNK_THREADS
+typedef struct parallelJob {
+    pthread_mutex_t lock;
+    size_t next;
+    size_t count;
+    bool failed;
+    parallel_fn fn;
+    void *arg;
+} parallelJob;
+
+typedef struct parallelWorker {
+    parallelJob *job;
+    int id;
+    pthread_t thread;
+} parallelWorker;
+
+static void *worker_run(void *data) {
+    parallelWorker *worker = data;
+    parallelJob *job = worker->job;
+
+    while(true) {
+        pthread_mutex_lock(&(job->lock));
+        if(job->failed || job->next >= job->count) {
+            pthread_mutex_unlock(&(job->lock));
+            break;
+        }
+        size_t item = job->next++;
+        pthread_mutex_unlock(&(job->lock));
+
+        if(!job->fn(job->arg, item, worker->id)) {
+            pthread_mutex_lock(&(job->lock));
+            job->failed = true;
+            pthread_mutex_unlock(&(job->lock));
+        }
+    }
+    return NULL;
+}
+#endif
+
+/* Run fn on every item from 0 to count-1, spread over up to threads workers
+ * with the calling thread as worker 0.  Each worker id is only ever used by
+ * one thread at a time, so fn can use it to pick per-thread state.  Stops
+ * handing out items once fn fails */
+bool parallel_for(size_t count, int threads, parallel_fn fn, void *arg) {
+#ifdef ZCHUNK_THREADS
+    if(threads > 1 && count > 1) {
+        if(threads > count)
+            threads = count;
+        parallelWorker *workers = zmalloc(threads * sizeof(parallelWorker));
+        if(!workers) {
+            zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            return false;
+        }
+
+        parallelJob job = {0};
+        job.count = count;
+        job.fn = fn;
+        job.arg = arg;
+        pthread_mutex_init(&(job.lock), NULL);
+
+        /* If a thread can't be started, carry on with the ones we have */
+        int started = 1;
+        for(; started < threads; started++) {
+            workers[started].job = &job;
+            workers[started].id = started;
+            if(pthread_create(&(workers[started].thread), NULL, worker_run,
+                              &(workers[started])) != 0) {
+                zck_log(ZCK_LOG_DEBUG, "Unable to start thread %i", started);
+                break;
+            }
+        }
+        workers[0].job = &job;
+        workers[0].id = 0;
+        worker_run(&(workers[0]));
+        for(int i=1; i<started; i++)
+            pthread_join(workers[i].thread, NULL);
+
+        pthread_mutex_destroy(&(job.lock));
+        free(workers);
+        return !job.failed;
+    }
+#endif
+
+    for(size_t i=0; i<count; i++)
+        if(!fn(arg, i, 0))
+            return false;
+    return true;
+}
+
+/* Number of threads zck should use, taking into account whether we were built
+ * with thread support */
+int get_thread_count(zckCtx *zck) {
+#ifdef ZCHUNK_THREADS
+    if(zck && zck->threads > 1)
+        return zck->threads;
+#endif
+    return 1;
+}
@@ -30,6 +30,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -54,16 +55,23 @@ int ZCK_PUBLIC_API zck_get_min_download_size() {
 static void zck_clear(zckCtx *zck) {
     if(zck == NULL)
         return;
+    journal_close(zck);
+    hash_queue_stop(zck);
     index_free(zck);
-    if(zck->header)
+    if(zck->header && !zck->header_borrowed)
         free(zck->header);
     zck->header = NULL;
+    zck->header_borrowed = false;
     zck->header_size = 0;
     if(!comp_close(zck))
         zck_log(ZCK_LOG_WARNING, "Unable to close compression");
+    cache_clear(zck);
+    unmap_data(zck);
     hash_close(&(zck->full_hash));
     hash_close(&(zck->check_full_hash));
     hash_close(&(zck->check_chunk_hash));
+    hash_close(&(zck->work_index_hash));
+    hash_close(&(zck->work_index_hash_uncomp));
     clear_work_index(zck);
     if(zck->full_hash_digest) {
         free(zck->full_hash_digest);
@@ -296,6 +304,17 @@ bool ZCK_PUBLIC_API zck_set_soption(zckCtx *zck, zck_soption option, const char
             set_fatal_error(zck, "Non-hex character found in supplied digest");
             return false;
         }
+    } else if(option == ZCK_VALIDITY_JOURNAL) {
+        VALIDATE_READ_BOOL(zck);
+        char *path = zrealloc(data, length + 1);
+        if(!path) {
+            zck_log(ZCK_LOG_ERROR, "OOM in %s", __func__);
+            return false;
+        }
+        path[length] = '\0';
+        bool ret = journal_open(zck, path);
+        free(path);
+        return ret;
 
     /* Compression options */
     } else if(option < 2000) {
@@ -311,6 +330,16 @@ bool ZCK_PUBLIC_API zck_set_soption(zckCtx *zck, zck_soption option, const char
     return true;
 }
 
+/* Make sure chunk checksums are at least as strong as SHA-256 */
+static bool set_full_chunk_hash(zckCtx *zck) {
+    if(zck->chunk_hash_type.type == ZCK_HASH_SHA1 ||
+       zck->chunk_hash_type.type == ZCK_HASH_SHA512_128)
+        return set_chunk_hash_type(zck, ZCK_HASH_SHA256);
+    if(zck->chunk_hash_type.type == ZCK_HASH_BLAKE3_128)
+        return set_chunk_hash_type(zck, ZCK_HASH_BLAKE3);
+    return true;
+}
+
 bool ZCK_PUBLIC_API zck_set_ioption(zckCtx *zck, zck_ioption option, ssize_t value) {
     VALIDATE_BOOL(zck);
 
@@ -320,7 +349,14 @@ bool ZCK_PUBLIC_API zck_set_ioption(zckCtx *zck, zck_ioption option, ssize_t val
         return set_full_hash_type(zck, value);
     } else if(option == ZCK_HASH_CHUNK_TYPE) {
         VALIDATE_WRITE_BOOL(zck);
-        return set_chunk_hash_type(zck, value);
+        if(!set_chunk_hash_type(zck, value))
+            return false;
+        /* Keep chunk checksums strong enough for an uncompressed source or
+         * tree data checksum, whichever option was set first */
+        if((zck->has_uncompressed_source || zck->has_tree_digest) &&
+           !set_full_chunk_hash(zck))
+            return false;
+        return true;
 
     /* Validation options */
     } else if(option == ZCK_VAL_HEADER_HASH_TYPE) {
@@ -351,11 +387,14 @@ bool ZCK_PUBLIC_API zck_set_ioption(zckCtx *zck, zck_ioption option, ssize_t val
     } else if(option == ZCK_UNCOMP_HEADER) {
         zck->has_uncompressed_source = 1;
         /* Uncompressed source requires chunk checksums to be a minimum of SHA-256 */
-        if(zck->chunk_hash_type.type == ZCK_HASH_SHA1 ||
-           zck->chunk_hash_type.type == ZCK_HASH_SHA512_128) {
-            if(!set_chunk_hash_type(zck, ZCK_HASH_SHA256))
-                return false;
-        }
+        if(!set_full_chunk_hash(zck))
+            return false;
+    } else if(option == ZCK_TREE_DIGEST) {
+        VALIDATE_WRITE_BOOL(zck);
+        zck->has_tree_digest = (value != 0);
+        /* The data checksum is only as strong as the chunk checksums */
+        if(zck->has_tree_digest && !set_full_chunk_hash(zck))
+            return false;
     } else if(option == ZCK_NO_WRITE) {
         if(value == 0) {
             if(zck->no_write == 1) {
@@ -373,6 +412,56 @@ bool ZCK_PUBLIC_API zck_set_ioption(zckCtx *zck, zck_ioption option, ssize_t val
             set_error(zck, "Unknown value %lli for ZCK_NO_WRITE", (long long) value);
             return false;
         }
+    } else if(option == ZCK_CHUNK_CACHE_SIZE) {
+        VALIDATE_READ_BOOL(zck);
+        if(value < 0) {
+            set_error(zck, "Chunk cache size can't be less than zero: %lli",
+                      (long long) value);
+            return false;
+        }
+        return cache_set_size(zck, value);
+    } else if(option == ZCK_THREADS) {
+        if(value < 1) {
+            set_error(zck, "Number of threads must be at least one: %lli",
+                      (long long) value);
+            return false;
+        }
+        if(value > INT_MAX) {
+            set_error(zck, "Number of threads too large: %lli",
+                      (long long) value);
+            return false;
+        }
+        if(value > MAX_THREADS) {
+            zck_log(ZCK_LOG_WARNING, "Only using %i of %lli threads",
+                    MAX_THREADS, (long long) value);
+            value = MAX_THREADS;
+        }
+#ifndef ZCHUNK_THREADS
+        if(value > 1)
+            zck_log(ZCK_LOG_WARNING,
+                    "Built without thread support, only using one thread");
+#endif
+        zck->threads = value;
+    } else if(option == ZCK_READ_AHEAD) {
+        VALIDATE_READ_BOOL(zck);
+        if(value < 0) {
+            set_error(zck, "Read-ahead can't be less than zero: %lli",
+                      (long long) value);
+            return false;
+        }
+        if(value > INT_MAX - MAX_THREADS) {
+            set_error(zck, "Read-ahead too large: %lli", (long long) value);
+            return false;
+        }
+        zck->read_ahead = value;
+    } else if(option == ZCK_VERIFY) {
+        VALIDATE_READ_BOOL(zck);
+        if(value < ZCK_VERIFY_ALL || value > ZCK_VERIFY_NONE) {
+            set_error(zck, "Unknown verification level: %lli",
+                      (long long) value);
+            return false;
+        }
+        zck->verify = value;
 
     /* Hash options */
     } else if(option < 100) {
@@ -417,7 +506,7 @@ bool ZCK_PUBLIC_API zck_close(zckCtx *zck) {
             close(zck->temp_fd);
             zck->temp_fd = 0;
         }
-    } else {
+    } else if(VERIFY_DATA(zck)) {
         if(validate_file(zck, ZCK_LOG_WARNING) < 1)
             return false;
     }
@@ -452,14 +541,20 @@ bool ZCK_PUBLIC_API zck_init_adv_read (zckCtx *zck, int src_fd) {
     return true;
 }
 
-bool ZCK_PUBLIC_API zck_init_read (zckCtx *zck, int src_fd) {
+bool ZCK_PUBLIC_API zck_init_adv_read_buffer (zckCtx *zck, const void *src,
+                                              size_t src_size) {
     VALIDATE_BOOL(zck);
+    ALLOCD_BOOL(zck, src);
 
-    if(!zck_init_adv_read(zck, src_fd)) {
-        set_fatal_error(zck, "Unable to read file");
+    if(!zck_init_adv_read(zck, -1))
         return false;
-    }
+    unmap_data(zck);
+    zck->src_buf = src;
+    zck->src_buf_size = src_size;
+    return true;
+}
 
+static bool read_lead_and_header(zckCtx *zck) {
     if(!zck_read_lead(zck)) {
         set_fatal_error(zck, "Unable to read lead");
         return false;
@@ -473,6 +568,44 @@ bool ZCK_PUBLIC_API zck_init_read (zckCtx *zck, int src_fd) {
     return true;
 }
 
+bool ZCK_PUBLIC_API zck_init_read (zckCtx *zck, int src_fd) {
+    VALIDATE_BOOL(zck);
+
+    if(!zck_init_adv_read(zck, src_fd)) {
+        set_fatal_error(zck, "Unable to read file");
+        return false;
+    }
+
+    return read_lead_and_header(zck);
+}
+
+bool ZCK_PUBLIC_API zck_init_read_buffer (zckCtx *zck, const void *src,
+                                          size_t src_size) {
+    VALIDATE_BOOL(zck);
+
+    if(!zck_init_adv_read_buffer(zck, src, src_size)) {
+        set_fatal_error(zck, "Unable to read buffer");
+        return false;
+    }
+
+    return read_lead_and_header(zck);
+}
+
+bool ZCK_PUBLIC_API zck_init_read_mmap (zckCtx *zck, int src_fd) {
+    VALIDATE_BOOL(zck);
+
+    if(!zck_init_adv_read(zck, src_fd)) {
+        set_fatal_error(zck, "Unable to read file");
+        return false;
+    }
+
+    /* Fall back to reading from the file descriptor if it can't be mapped */
+    if(!map_data(zck))
+        zck_log(ZCK_LOG_DEBUG, "Unable to map file, reading it instead");
+
+    return read_lead_and_header(zck);
+}
+
 bool ZCK_PUBLIC_API zck_init_write (zckCtx *zck, int dst_fd) {
     VALIDATE_BOOL(zck);
 
@@ -7,6 +7,7 @@
 #include <stddef.h>
 #include <regex.h>
 #include "buzhash/buzhash.h"
+#include "hash/blake3/blake3.h"
 #include "uthash.h"
 #include "zck.h"
 
@@ -25,6 +26,8 @@
 #define DEFAULT_BUZHASH_BITS 15
 #define CHUNK_DEFAULT_MIN 1
 #define CHUNK_DEFAULT_MAX 10485760 // 10MB
+/* Each thread gets its own reader, so don't let ZCK_THREADS run away */
+#define MAX_THREADS 256
 
 #define zck_log(...) zck_log_wf(__func__, __VA_ARGS__)
 
@@ -91,7 +94,18 @@
                                     return NULL; \
                                 }
 
+/* Whether reading should check chunk checksums and the data checksum */
+#define VERIFY_CHUNKS(f)        (f->verify != ZCK_VERIFY_NONE)
+#define VERIFY_DATA(f)          (f->verify == ZCK_VERIFY_ALL && \
+                                 !f->has_uncompressed_source)
+/* Whether the data checksum is built from the data as it's read, rather than
+ * from the chunk checksums */
+#define HASH_DATA(f)            (VERIFY_DATA(f) && !f->has_tree_digest)
+
 typedef struct zckComp zckComp;
+typedef struct zckPrefetch zckPrefetch;
+typedef struct zckJournal zckJournal;
+typedef struct zckHashQueue zckHashQueue;
 
 typedef bool (*finit)(zckCtx *zck, zckComp *comp);
 typedef bool (*fparam)(zckCtx *zck,zckComp *comp, int option, const void *value);
@@ -103,6 +117,9 @@ typedef ssize_t (*fcomp)(zckCtx *zck, zckComp *comp, const char *src,
 typedef bool (*fdecomp)(zckCtx *zck, zckComp *comp, const bool use_dict);
 typedef bool (*fdcompend)(zckCtx *zck, zckComp *comp, const bool use_dict,
                           const size_t fd_size);
+typedef bool (*fdcompchunk)(zckCtx *zck, zckComp *comp, const char *src,
+                            size_t src_size, char *dst, size_t dst_size,
+                            const bool use_dict);
 typedef bool (*fcclose)(zckCtx *zck, zckComp *comp);
 
 typedef struct zckHashType {
@@ -110,13 +127,31 @@ typedef struct zckHashType {
     int digest_size;
 } zckHashType;
 
+/* This needs to be updated to the largest hash size every time a new hash type
+ * is added */
+#define MAX_DIGEST_SIZE 64
+/* Room for the SHA library's context, checked when it's initialized */
+#define HASH_SHA_CTX_SIZE 384
+
+typedef bool (*fhupdate)(zckCtx *zck, zckHash *hash, const char *message,
+                         size_t size);
+typedef bool (*fhfinal)(zckCtx *zck, zckHash *hash, char *digest);
+
 struct zckHash {
+    /* Only set while a digest is in progress */
     zckHashType *type;
+    /* Bound by hash_init(), so updates don't have to look at the type, which
+     * may change under us.  final writes the algorithm's full digest */
+    fhupdate update;
+    fhfinal final;
 #if defined(ZCHUNK_OPENSSL) && !defined(ZCHUNK_OPENSSL_DEPRECATED)
-    EVP_MD_CTX *ctx;
-#else
-    void *ctx;
+    /* Reused for each digest, and only freed by hash_close() */
+    EVP_MD_CTX *evp;
 #endif
+    union {
+        uint64_t sha[HASH_SHA_CTX_SIZE / sizeof(uint64_t)];
+        blake3_hasher blake3;
+    } ctx;
 };
 
 #ifndef CURLINC_CURL_H
@@ -171,7 +206,12 @@ struct zckChunk {
     UT_hash_handle hhuncomp;
 };
 
-/* Contains everything about an index and a pointer to the first index item */
+/* Contains everything about an index.  The index items are kept in one
+ * array, with their digests in parallel arrays, and each item's next points
+ * at the one after it so the index can still be walked like a list.  A read
+ * index can't grow, so its items and offset table share one allocation in
+ * arena, and its digests point into the header.  A read index's entries
+ * aren't decoded until index_load(), and pending points at them until then */
 struct zckIndex {
     size_t count;
     size_t length;
@@ -182,8 +222,37 @@ struct zckIndex {
     zckChunk *current;
     zckChunk *ht;
     zckChunk *htuncomp;
+    zckChunk *chunks;
+    size_t chunks_count;
+    size_t chunks_alloc;
+    char *digests;
+    char *digests_uncompressed;
+    size_t *dc_offset;
+    void *arena;
+    char *pending;
+    size_t pending_size;
+    size_t pending_max;
 };
 
+/* Contains a decompressed chunk held in the chunk cache */
+typedef struct zckCacheItem {
+    size_t number;
+    char *data;
+    size_t length;
+    UT_hash_handle hh;
+} zckCacheItem;
+
+/* Size-bounded LRU cache of decompressed chunks.  Items are kept in the hash
+ * table's insertion order, so the first item is always the least recently
+ * used */
+typedef struct zckCache {
+    zckCacheItem *ht;
+    size_t max_size;
+    size_t size;
+    size_t hits;
+    size_t misses;
+} zckCache;
+
 /* Contains a single range */
 typedef struct zckRangeItem {
     size_t start;
@@ -215,11 +284,13 @@ struct zckComp {
 
     char *data;
     size_t data_size;
+    size_t data_alloc;
     size_t data_loc;
     zckChunk *data_idx;
     int data_eof;
     char *dc_data;
     size_t dc_data_size;
+    size_t dc_data_alloc;
     size_t dc_data_loc;
 
     finit init;
@@ -228,6 +299,7 @@ struct zckComp {
     fccompend end_cchunk;
     fdecomp decompress;
     fdcompend end_dchunk;
+    fdcompchunk decompress_chunk;
     fcclose close;
 };
 
@@ -254,7 +326,10 @@ struct zckCtx {
     size_t header_length;
 
     bool header_only;
+    /* When reading from memory, header points into src_buf rather than at
+     * its own copy, and header_borrowed is set */
     char *header;
+    bool header_borrowed;
     size_t header_size;
     size_t hdr_digest_loc;
     char *lead_string;
@@ -279,11 +354,30 @@ struct zckCtx {
     int has_streams;
     int has_optional_elems;
     int has_uncompressed_source;
+    int has_tree_digest;
     int no_write;
 
     char *read_buf;
     size_t read_buf_size;
 
+    /* Data to read from instead of fd, either mapped or caller-owned */
+    const char *src_buf;
+    size_t src_buf_size;
+    bool src_buf_mapped;
+    /* Readers share fd with their parent, so they keep their own position
+     * and use pread() */
+    bool src_positional;
+    /* Position in src_buf, or in fd if src_positional is set */
+    size_t src_loc;
+
+    zckCache cache;
+    int threads;
+    int read_ahead;
+    zckPrefetch *prefetch;
+    zck_verify verify;
+    zckJournal *journal;
+    zckHashQueue *hash_queue;
+
     zckHash full_hash;
     zckHash check_full_hash;
     zckHash check_chunk_hash;
@@ -309,6 +403,12 @@ struct zckCtx {
     int error_state;
 };
 
+/* Private read state for one thread, sharing its parent's header and index */
+struct zckReader {
+    zckCtx *parent;
+    zckCtx zck;
+};
+
 int get_tmp_fd()
     ZCK_WARN_UNUSED;
 bool import_dict(zckCtx *zck)
@@ -327,14 +427,21 @@ bool hash_init(zckCtx *zck, zckHash *hash, zckHashType *hash_type)
 bool hash_update(zckCtx *zck, zckHash *hash, const char *message,
                  const size_t size)
     ZCK_WARN_UNUSED;
+bool hash_final(zckCtx *zck, zckHash *hash, char *digest)
+    ZCK_WARN_UNUSED;
 char *hash_finalize(zckCtx *zck, zckHash *hash)
     ZCK_WARN_UNUSED;
 void hash_close(zckHash *hash);
 void hash_reset(zckHashType *ht);
-int validate_chunk(zckChunk *idx, zck_log_type bad_checksum)
+int validate_chunk(zckCtx *zck, zckChunk *idx, zck_log_type bad_checksum)
+    ZCK_WARN_UNUSED;
+int validate_chunk_digest(zckCtx *zck, zckChunk *idx, char *digest,
+                          zck_log_type bad_checksum)
     ZCK_WARN_UNUSED;
 int validate_file(zckCtx *zck, zck_log_type bad_checksums)
     ZCK_WARN_UNUSED;
+bool hash_tree(zckCtx *zck, zckHash *hash)
+    ZCK_WARN_UNUSED;
 int validate_current_chunk(zckCtx *zck)
     ZCK_WARN_UNUSED;
 int validate_header(zckCtx *zck)
@@ -348,20 +455,46 @@ int get_max_hash_size()
 char *get_digest_string(const char *digest, int size)
     ZCK_WARN_UNUSED;
 
+/* hash/multi.c */
+bool hash_many(zckCtx *zck, zckHashType *hash_type, const char **data,
+               const size_t *size, size_t count, char *digests)
+    ZCK_WARN_UNUSED;
+bool hash_many_set_lanes(int hash_type, int lanes)
+    ZCK_WARN_UNUSED;
+
+/* hash/cpu.c */
+#define CPU_SSSE3   (1 << 0)
+#define CPU_SSE41   (1 << 1)
+#define CPU_SHA     (1 << 2)
+#define CPU_BMI2    (1 << 3)
+#define CPU_AVX2    (1 << 4)
+#define CPU_AVX512  (1 << 5)
+int cpu_features()
+    ZCK_WARN_UNUSED;
+
 
 /* index/index.c */
 bool index_read(zckCtx *zck, char *data, size_t size, size_t max_length)
     ZCK_WARN_UNUSED;
+bool index_load(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+bool index_load_hashdb(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+zckChunk *index_find_offset(zckIndex *index, size_t offset);
 bool index_create(zckCtx *zck)
     ZCK_WARN_UNUSED;
 bool index_new_chunk(zckCtx *zck, zckIndex *index, char *digest, int digest_size,
                      char* digest_uncompressed, size_t comp_size, size_t orig_size, zckChunk *src, bool valid)
     ZCK_WARN_UNUSED;
-bool index_add_to_chunk(zckCtx *zck, char *data, size_t comp_size,
+bool index_add_to_chunk(zckCtx *zck, char **data, size_t comp_size,
                         size_t orig_size)
     ZCK_WARN_UNUSED;
+bool index_add_uncompressed(zckCtx *zck, const char *data, size_t size)
+    ZCK_WARN_UNUSED;
 bool index_finish_chunk(zckCtx *zck)
     ZCK_WARN_UNUSED;
+bool index_grow(zckCtx *zck, zckIndex *index, size_t count, bool uncomp)
+    ZCK_WARN_UNUSED;
 void index_clean(zckIndex *index);
 void index_free(zckCtx *zck);
 void clear_work_index(zckCtx *zck);
@@ -370,6 +503,12 @@ bool write_index(zckCtx *zck)
 
 
 /* io.c */
+bool map_data(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+void unmap_data(zckCtx *zck);
+ssize_t read_data_ptr(zckCtx *zck, const char **data, char *buf,
+                      size_t length)
+    ZCK_WARN_UNUSED;
 int seek_data(zckCtx *zck, off_t offset, int whence)
     ZCK_WARN_UNUSED;
 ssize_t tell_data(zckCtx *zck)
@@ -380,6 +519,7 @@ int write_data(zckCtx *zck, int fd, const char *data, size_t length)
     ZCK_WARN_UNUSED;
 int chunks_from_temp(zckCtx *zck)
     ZCK_WARN_UNUSED;
+size_t find_unwritten_chunks(zckCtx *zck, bool *unwritten);
 
 /* header.c */
 bool header_create(zckCtx *zck)
@@ -396,14 +536,73 @@ bool comp_reset(zckCtx *zck)
     ZCK_WARN_UNUSED;
 bool comp_add_to_dc(zckCtx *zck, zckComp *comp, const char *src, size_t src_size)
     ZCK_WARN_UNUSED;
+char *comp_reserve_dc(zckCtx *zck, zckComp *comp, size_t size)
+    ZCK_WARN_UNUSED;
 ssize_t comp_read(zckCtx *zck, char *dst, size_t dst_size, bool use_dict)
     ZCK_WARN_UNUSED;
+bool comp_load_dict(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+ssize_t comp_decompress_chunk(zckCtx *zck, zckChunk *idx, const char *src,
+                              char *dst, bool verify)
+    ZCK_WARN_UNUSED;
+ssize_t comp_get_chunk_data(zckCtx *zck, zckChunk *idx, char *dst,
+                            size_t dst_size)
+    ZCK_WARN_UNUSED;
+ssize_t comp_get_chunk_comp_data(zckCtx *zck, zckChunk *idx, char *dst,
+                                 size_t dst_size)
+    ZCK_WARN_UNUSED;
 bool comp_ioption(zckCtx *zck, zck_ioption option, ssize_t value)
     ZCK_WARN_UNUSED;
 bool comp_soption(zckCtx *zck, zck_soption option, const void *value,
                   size_t length)
     ZCK_WARN_UNUSED;
 
+/* cache.c */
+bool cache_set_size(zckCtx *zck, size_t max_size)
+    ZCK_WARN_UNUSED;
+ssize_t cache_get(zckCtx *zck, zckChunk *idx, char *dst, size_t dst_size)
+    ZCK_WARN_UNUSED;
+bool cache_add(zckCtx *zck, zckChunk *idx, const char *data)
+    ZCK_WARN_UNUSED;
+void cache_clear(zckCtx *zck);
+
+/* prefetch.c */
+bool prefetch_start(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+bool prefetch_decompressing(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+void prefetch_chunk(zckCtx *zck, zckChunk *idx);
+ssize_t prefetch_read(zckCtx *zck, char *dst, size_t dst_size)
+    ZCK_WARN_UNUSED;
+void prefetch_stop(zckCtx *zck);
+
+/* journal.c */
+bool journal_open(zckCtx *zck, const char *path)
+    ZCK_WARN_UNUSED;
+bool journal_apply(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+void journal_save(zckCtx *zck);
+void journal_mark(zckCtx *zck, zckChunk *idx);
+void journal_close(zckCtx *zck);
+
+/* hash_queue.c */
+bool hash_queue_start(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+bool hash_queue_add(zckCtx *zck, char *data, size_t size, bool uncomp)
+    ZCK_WARN_UNUSED;
+bool hash_queue_end_chunk(zckCtx *zck, zckChunk *chunk)
+    ZCK_WARN_UNUSED;
+bool hash_queue_finish(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+void hash_queue_stop(zckCtx *zck);
+
+/* thread.c */
+typedef bool (*parallel_fn)(void *arg, size_t item, int worker);
+bool parallel_for(size_t count, int threads, parallel_fn fn, void *arg)
+    ZCK_WARN_UNUSED;
+int get_thread_count(zckCtx *zck)
+    ZCK_WARN_UNUSED;
+
 /* dl/range.c */
 char *range_get_char(zckRangeItem **range, int max_ranges)
     ZCK_WARN_UNUSED;
@@ -431,6 +630,7 @@ int compint_to_size(zckCtx *zck, size_t *val, const char *compint,
     ZCK_WARN_UNUSED;
 
 /* log.c */
+bool zck_log_enabled(zck_log_type lt);
 void zck_log_v(const char *function, zck_log_type lt, const char *format,
      va_list args);
 void zck_log_wf(const char *function, zck_log_type lt, const char *format, ...);
@@ -438,5 +638,6 @@ void zck_log_wf(const char *function, zck_log_type lt, const char *format, ...);
 /* error.c */
 void set_error_wf(zckCtx *zck, int fatal, const char *function,
                   const char *format, ...);
+void copy_error(zckCtx *zck, zckCtx *src);
 
 #endif
@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/types.h>
@@ -55,6 +56,7 @@ static struct argp_option options[] = {
     {"stdout",  'c', 0,        0, "Direct output to stdout"},
     {"dict",   1000, 0,        0, "Only extract the dictionary (can't be run with --header)"},
     {"header", 1001, 0,        0, "Only extract the header (can't be run with --dict)"},
+    {"threads", 't', "N",      0, "Decompress using N threads (default: 1)"},
     {"version", 'V', 0,        0, "Show program version"},
     { 0 }
 };
@@ -65,6 +67,7 @@ struct arguments {
   bool dict;
   bool header;
   bool std_out;
+  int threads;
   bool exit;
 };
 
@@ -83,6 +86,16 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         case 'c':
             arguments->std_out = true;
             break;
+        case 't': {
+            char *end = NULL;
+            long threads = strtol(arg, &end, 10);
+            if(*arg == '\0' || *end != '\0' || threads < 1 || threads > 1024) {
+                LOG_ERROR("Number of threads must be between 1 and 1024\n");
+                return -EINVAL;
+            }
+            arguments->threads = threads;
+            break;
+        }
         case 'V':
             version();
             arguments->exit = true;
@@ -119,11 +132,38 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
 
 static struct argp argp = {options, parse_opt, args_doc, doc};
 
+struct output {
+    int fd;
+    size_t total;
+    bool write_failed;
+};
+
+/* Write each decompressed chunk straight from the library's buffer */
+static bool write_chunk(zckChunk *chunk, const char *data, size_t size,
+                        void *cb_data) {
+    struct output *output = cb_data;
+
+    while(size > 0) {
+        ssize_t wb = write(output->fd, data, size);
+        if(wb < 0) {
+            if(errno == EINTR)
+                continue;
+            output->write_failed = true;
+            return false;
+        }
+        data += wb;
+        size -= wb;
+        output->total += wb;
+    }
+    return true;
+}
+
 int main (int argc, char *argv[]) {
     struct arguments arguments = {0};
 
     /* Defaults */
     arguments.log_level = ZCK_LOG_ERROR;
+    arguments.threads = 1;
 
     int retval = argp_parse (&argp, argc, argv, 0, 0, &arguments);
     if(retval || arguments.exit)
@@ -161,7 +201,30 @@ int main (int argc, char *argv[]) {
 #else
     int dst_fd = STDOUT_FILENO;
 #endif
-    if(!arguments.std_out) {
+    char *tmp_name = NULL;
+#ifndef _WIN32
+    /* Extract the data to a temporary file, which is only renamed once the
+     * data checksum has been verified, so the data only needs to be read
+     * once */
+    if(!arguments.std_out && !arguments.dict && !arguments.header) {
+        tmp_name = calloc(strlen(out_name) + 8, 1);
+        assert(tmp_name);
+        snprintf(tmp_name, strlen(out_name) + 8, "%s.XXXXXX", out_name);
+        dst_fd = mkstemp(tmp_name);
+        if(dst_fd < 0) {
+            LOG_ERROR("Unable to open %s", tmp_name);
+            perror("");
+            free(tmp_name);
+            free(out_name);
+            exit(1);
+        }
+        /* mkstemp() only gives the owner access */
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(dst_fd, 0666 & ~mask);
+    }
+#endif
+    if(!arguments.std_out && tmp_name == NULL) {
         dst_fd = open(out_name, O_TRUNC | O_WRONLY | O_CREAT | O_BINARY, 0666);
         if(dst_fd < 0) {
             LOG_ERROR("Unable to open %s", out_name);
@@ -179,6 +242,10 @@ int main (int argc, char *argv[]) {
         LOG_ERROR("%s", zck_get_error(zck));
         goto error2;
     }
+    if(!zck_set_ioption(zck, ZCK_THREADS, arguments.threads)) {
+        LOG_ERROR("%s", zck_get_error(zck));
+        goto error2;
+    }
 
     /* Only write dictionary */
     if(arguments.dict) {
@@ -271,33 +338,48 @@ int main (int argc, char *argv[]) {
         goto error2;
     }
 
-    int ret = zck_validate_data_checksum(zck);
-    if(ret < 1) {
-        if(ret == -1)
-            LOG_ERROR("Data checksum failed verification\n");
-        goto error2;
+    /* Anything written to a temporary file is thrown away if the data
+     * checksum fails, but data written to anywhere else can't be taken back,
+     * so check the data first */
+    if(tmp_name == NULL) {
+        int ret = zck_validate_data_checksum(zck);
+        if(ret < 1) {
+            if(ret == -1)
+                LOG_ERROR("Data checksum failed verification\n");
+            goto error2;
+        }
     }
 
-    data = calloc(BUF_SIZE, 1);
-    assert(data);
-    size_t total = 0;
-    while(true) {
-        ssize_t read_size = zck_read(zck, data, BUF_SIZE);
-        if(read_size < 0) {
+    struct output output = {dst_fd, 0, false};
+    if(!zck_foreach_chunk(zck, write_chunk, &output)) {
+        if(output.write_failed)
+            LOG_ERROR("Error writing to %s\n", out_name);
+        else
             LOG_ERROR("%s", zck_get_error(zck));
+        goto error2;
+    }
+    size_t total = output.total;
+    if(!zck_close(zck)) {
+        if(zck_is_error(zck))
+            LOG_ERROR("%s", zck_get_error(zck));
+        else
+            LOG_ERROR("Data checksum failed verification\n");
+        goto error2;
+    }
+    if(tmp_name) {
+        if(close(dst_fd) != 0) {
+            dst_fd = -1;
+            LOG_ERROR("Error writing to %s\n", out_name);
             goto error2;
         }
-        if(read_size == 0)
-            break;
-        if(write(dst_fd, data, read_size) != read_size) {
-            LOG_ERROR("Error writing to %s\n", out_name);
+        dst_fd = -1;
+        if(rename(tmp_name, out_name) != 0) {
+            LOG_ERROR("Unable to rename %s to %s", tmp_name, out_name);
+            perror("");
             goto error2;
         }
-        total += read_size;
-    }
-    if(!zck_close(zck)) {
-        LOG_ERROR("%s", zck_get_error(zck));
-        goto error2;
+        free(tmp_name);
+        tmp_name = NULL;
     }
     if(arguments.log_level <= ZCK_LOG_INFO)
         LOG_ERROR(
@@ -308,11 +390,16 @@ int main (int argc, char *argv[]) {
 error2:
     free(data);
     zck_free(&zck);
-    if(!good_exit)
+    if(tmp_name) {
+        unlink(tmp_name);
+        free(tmp_name);
+    } else if(!good_exit) {
         unlink(out_name);
+    }
     free(out_name);
     close(src_fd);
-    close(dst_fd);
+    if(dst_fd >= 0)
+        close(dst_fd);
     if(!good_exit)
         exit(1);
     exit(0);
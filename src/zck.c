@@ -58,12 +58,15 @@ static struct argp_option options[] = {
     {"manual-chunk",       'm', 0,           0,
      "Don't do any automatic chunking (implies -s)"},
     {"chunk-hash-type",     'h', "HASH",     0,
-     "Set hash type to one of sha256, sha512, sha512_128"},
+     "Set hash type to one of sha256, sha512, sha512_128, blake3, blake3_128"},
     {"uncompressed",       'u', 0,           0,
      "Add extension in header for uncompressed data"},
     {"version",            'V', 0,           0, "Show program version"},
     {"compression-format", 200,   "none/zstd", 0,
      "Set compression format for file (none/zstd) (default: zstd)", 1},
+    {"tree-digest",        201, 0,           0,
+     "Make the data checksum a checksum of the chunk checksums "
+     "(EXPERIMENTAL)", 1},
     {"verbose",            'v', 0,           0,
      "Increase verbosity (can be specified more than once for debugging)", 1},
     { 0 }
@@ -79,6 +82,7 @@ struct arguments {
   char *compression_format;
   bool exit;
   bool uncompressed;
+  bool tree_digest;
   zck_hash chunk_hashtype;
 };
 
@@ -111,9 +115,13 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
                 arguments->chunk_hashtype = ZCK_HASH_SHA512;
             else if (!strcmp(arg, "sha512_128"))
                 arguments->chunk_hashtype = ZCK_HASH_SHA512_128;
+            else if (!strcmp(arg, "blake3"))
+                arguments->chunk_hashtype = ZCK_HASH_BLAKE3;
+            else if (!strcmp(arg, "blake3_128"))
+                arguments->chunk_hashtype = ZCK_HASH_BLAKE3_128;
             else {
                 LOG_ERROR("Wrong value for chunk hashtype. \n "
-                        "It should be one of sha1|sha256|sha512|sha512_128 instead of %s\n", arg);
+                        "It should be one of sha1|sha256|sha512|sha512_128|blake3|blake3_128 instead of %s\n", arg);
                 return -EINVAL;
             }
 
@@ -130,6 +138,9 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         case 200:
             arguments->compression_format = arg;
             break;
+        case 201:
+            arguments->tree_digest = true;
+            break;
         case 'V':
             version();
             arguments->exit = true;
@@ -282,6 +293,12 @@ int main (int argc, char *argv[]) {
             exit(1);
         }
     }
+    if(arguments.tree_digest) {
+        if(!zck_set_ioption(zck, ZCK_TREE_DIGEST, 1)) {
+            LOG_ERROR("%s\n", zck_get_error(zck));
+            exit(1);
+        }
+    }
     if (arguments.chunk_hashtype != ZCK_HASH_UNKNOWN) {
         if(!zck_set_ioption(zck, ZCK_HASH_CHUNK_TYPE, arguments.chunk_hashtype)) {
             LOG_ERROR("Unable to set hash type %s\n", zck_get_error(zck));
@@ -56,6 +56,8 @@ static struct argp_option options[] = {
     {"source",         's', "FILE",    0, "File to use as delta source"},
     {"fail-no-ranges", 1000, 0,        0,
      "If server doesn't support ranges, fail instead of downloading full file"},
+    {"threads",        't', "N",       0,
+     "Check existing chunks using N threads (default: 1)"},
     {"version",        'V',  0,        0, "Show program version"},
     { 0 }
 };
@@ -73,6 +75,7 @@ struct arguments {
   zck_log_type log_level;
   char *source;
   int fail_no_ranges;
+  int threads;
   bool exit;
 };
 
@@ -100,6 +103,16 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state) {
         case 's':
             arguments->source = arg;
             break;
+        case 't': {
+            char *end = NULL;
+            long threads = strtol(arg, &end, 10);
+            if(*arg == '\0' || *end != '\0' || threads < 1 || threads > 1024) {
+                LOG_ERROR("Number of threads must be between 1 and 1024\n");
+                return -EINVAL;
+            }
+            arguments->threads = threads;
+            break;
+        }
         case 'V':
             version();
             arguments->exit = true;
@@ -311,6 +324,7 @@ int main (int argc, char *argv[]) {
 
     /* Defaults */
     arguments.log_level = ZCK_LOG_INFO;
+    arguments.threads = 1;
 
     int retval = argp_parse (&argp, argc, argv, 0, 0, &arguments);
     if(retval || arguments.exit)
@@ -363,6 +377,24 @@ int main (int argc, char *argv[]) {
         LOG_ERROR("%s", zck_get_error(zck_tgt));
         exit(10);
     }
+    if(!zck_set_ioption(zck_tgt, ZCK_THREADS, arguments.threads)) {
+        LOG_ERROR("%s", zck_get_error(zck_tgt));
+        exit(10);
+    }
+    /* Remember which chunks have been checked, so they needn't be checked
+     * again if we're interrupted */
+    char *journal_name = malloc(strlen(outname) + 6);
+    if(journal_name == NULL) {
+        LOG_ERROR("Unable to allocate journal name\n");
+        exit(10);
+    }
+    snprintf(journal_name, strlen(outname) + 6, "%s.zckv", outname);
+    if(!zck_set_soption(zck_tgt, ZCK_VALIDITY_JOURNAL, journal_name,
+                        strlen(journal_name))) {
+        LOG_ERROR("%s", zck_get_error(zck_tgt));
+        if(!zck_clear_error(zck_tgt))
+            exit(10);
+    }
 
     zckDL *dl = zck_dl_init(zck_tgt);
     if(dl == NULL) {
@@ -503,6 +535,9 @@ out:
     zck_dl_free(&dl);
     zck_free(&zck_tgt);
     zck_free(&zck_src);
+    if(exit_val == 0)
+        unlink(journal_name);
+    free(journal_name);
     curl_easy_cleanup(curl_ctx);
     curl_global_cleanup();
     exit(exit_val);
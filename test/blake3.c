@@ -0,0 +1,179 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+#define TEST_FILE "blake3.zck"
+
+/* Official BLAKE3 test vectors, where the input is i % 251 for each byte */
+static struct {
+    size_t length;
+    const char *digest;
+} vectors[] = {
+    {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+    {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+    {1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+    {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+    {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+    {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+    {2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"},
+    {3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2"},
+    {8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+    {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+    {0, NULL}
+};
+
+/* Hash data in pieces of step bytes, returning the digest as a string */
+static char *hash_steps(const char *data, size_t length, size_t step,
+                        int type) {
+    zckHashType hash_type = {0};
+    zckHash hash = {0};
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !hash_setup(zck, &hash_type, type) ||
+       !hash_init(zck, &hash, &hash_type)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    for(size_t i=0; i<length; i+=step) {
+        size_t size = length - i < step ? length - i : step;
+        if(!hash_update(zck, &hash, data + i, size)) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+    }
+    char *digest = hash_finalize(zck, &hash);
+    if(digest == NULL) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    char *digest_string = get_digest_string(digest, hash_type.digest_size);
+    free(digest);
+    zck_free(&zck);
+    return digest_string;
+}
+
+int main (int argc, char *argv[]) {
+    char *data = calloc(102400, 1);
+    for(size_t i=0; i<102400; i++)
+        data[i] = i % 251;
+
+    for(int i=0; vectors[i].digest; i++) {
+        size_t length = vectors[i].length;
+        size_t steps[] = {length ? length : 1, 1, 63, 1000, 4096};
+        for(int j=0; j<5; j++) {
+            char *digest = hash_steps(data, length, steps[j], ZCK_HASH_BLAKE3);
+            if(strcmp(digest, vectors[i].digest) != 0) {
+                printf("BLAKE3 of %llu bytes in steps of %llu: %s, expected "
+                       "%s\n", (long long unsigned) length,
+                       (long long unsigned) steps[j], digest,
+                       vectors[i].digest);
+                exit(1);
+            }
+            free(digest);
+        }
+        char *digest = hash_steps(data, length, 1024, ZCK_HASH_BLAKE3_128);
+        if(strlen(digest) != 32 ||
+           strncmp(digest, vectors[i].digest, 32) != 0) {
+            printf("BLAKE3/128 of %llu bytes: %s, expected %.32s\n",
+                   (long long unsigned) length, digest, vectors[i].digest);
+            exit(1);
+        }
+        free(digest);
+    }
+
+    /* Write a file using BLAKE3 for both checksums and read it back */
+    int out = open(TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(out < 0) {
+        perror("Unable to open " TEST_FILE " for writing");
+        exit(1);
+    }
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_write(zck, out) ||
+       !zck_set_ioption(zck, ZCK_HASH_FULL_TYPE, ZCK_HASH_BLAKE3) ||
+       !zck_set_ioption(zck, ZCK_HASH_CHUNK_TYPE, ZCK_HASH_BLAKE3_128) ||
+       !zck_set_ioption(zck, ZCK_MANUAL_CHUNK, 1)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    for(size_t i=0; i<102400; i+=10000) {
+        size_t size = 102400 - i < 10000 ? 102400 - i : 10000;
+        if(zck_write(zck, data + i, size) != size || zck_end_chunk(zck) < 0) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+    }
+    if(!zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+    close(out);
+
+    int in = open(TEST_FILE, O_RDONLY | O_BINARY);
+    if(in < 0) {
+        perror("Unable to open " TEST_FILE " for reading");
+        exit(1);
+    }
+    zck = zck_create();
+    if(zck == NULL || !zck_init_read(zck, in)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(zck_get_full_hash_type(zck) != ZCK_HASH_BLAKE3 ||
+       zck_get_chunk_hash_type(zck) != ZCK_HASH_BLAKE3_128) {
+        printf("Hash types not preserved: %s, %s\n",
+               zck_hash_name_from_type(zck_get_full_hash_type(zck)),
+               zck_hash_name_from_type(zck_get_chunk_hash_type(zck)));
+        exit(1);
+    }
+    if(zck_validate_checksums(zck) != 1) {
+        printf("Checksums failed to validate\n");
+        exit(1);
+    }
+    char *read_data = calloc(102400, 1);
+    if(zck_read(zck, read_data, 102400) != 102400 ||
+       memcmp(read_data, data, 102400) != 0 || !zck_close(zck)) {
+        printf("Unable to read back data: %s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+    close(in);
+    unlink(TEST_FILE);
+
+    free(read_data);
+    free(data);
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+static char *read_chunk(zckCtx *zck, size_t number) {
+    zckChunk *chunk = zck_get_chunk(zck, number);
+    if(chunk == NULL) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    size_t size = zck_get_chunk_size(chunk);
+    char *data = calloc(size, 1);
+    if(zck_get_chunk_data(chunk, data, size) != size) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    return data;
+}
+
+static void check_chunk(zckCtx *zck, size_t number, char *expected) {
+    char *data = read_chunk(zck, number);
+    if(memcmp(data, expected,
+              zck_get_chunk_size(zck_get_chunk(zck, number))) != 0) {
+        printf("Data in chunk %llu doesn't match\n",
+               (long long unsigned) number);
+        exit(1);
+    }
+    free(data);
+}
+
+static void check_stats(zckCtx *zck, ssize_t hits, ssize_t misses) {
+    if(zck_get_cache_hits(zck) != hits ||
+       zck_get_cache_misses(zck) != misses) {
+        printf("Expected %lli hits and %lli misses, got %lli and %lli\n",
+               (long long) hits, (long long) misses,
+               (long long) zck_get_cache_hits(zck),
+               (long long) zck_get_cache_misses(zck));
+        exit(1);
+    }
+}
+
+int main (int argc, char *argv[]) {
+    /* Open zchunk file */
+    int in = open(argv[1], O_RDONLY | O_BINARY);
+    if(in < 0) {
+        perror("Unable to open zchunk file for reading");
+        exit(1);
+    }
+
+    zckCtx *zck = zck_create();
+    if(zck == NULL)
+        exit(1);
+    if(!zck_init_read(zck, in)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+
+    /* Only leave enough room in the cache for the first two chunks */
+    size_t cache_size = zck_get_chunk_size(zck_get_chunk(zck, 1)) +
+                        zck_get_chunk_size(zck_get_chunk(zck, 2));
+    if(!zck_set_ioption(zck, ZCK_CHUNK_CACHE_SIZE, cache_size)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+
+    char *first = read_chunk(zck, 1);
+    char *second = read_chunk(zck, 2);
+    check_stats(zck, 0, 2);
+    check_chunk(zck, 1, first);
+    check_stats(zck, 1, 2);
+
+    /* Reading the third chunk should evict the second as it's the least
+     * recently used */
+    char *third = read_chunk(zck, 3);
+    check_stats(zck, 1, 3);
+    check_chunk(zck, 1, first);
+    check_chunk(zck, 3, third);
+    check_stats(zck, 3, 3);
+    check_chunk(zck, 2, second);
+    check_stats(zck, 3, 4);
+
+    free(first);
+    free(second);
+    free(third);
+    zck_free(&zck);
+    close(in);
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "util.h"
+
+#define TEST_FILE "chunk_index.zck"
+#define CHUNK_SIZE 16
+/* Enough chunks for the index to grow a few times while writing */
+#define CHUNKS 5000
+
+static void write_file(const char *data, int threads) {
+    int out = open(TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(out < 0) {
+        perror("Unable to open " TEST_FILE " for writing");
+        exit(1);
+    }
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_write(zck, out) ||
+       !zck_set_ioption(zck, ZCK_COMP_TYPE, ZCK_COMP_NONE) ||
+       !zck_set_ioption(zck, ZCK_MANUAL_CHUNK, 1) ||
+       !zck_set_ioption(zck, ZCK_THREADS, threads)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    for(int i=0; i<CHUNKS; i++) {
+        if(zck_write(zck, data + i * CHUNK_SIZE, CHUNK_SIZE) != CHUNK_SIZE ||
+           zck_end_chunk(zck) < 0) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+    }
+    if(!zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+    close(out);
+}
+
+/* Check that looking chunks up by number matches walking the index, and
+ * return the digest of every chunk */
+static char **check_index(void) {
+    int in = open(TEST_FILE, O_RDONLY | O_BINARY);
+    zckCtx *zck = zck_create();
+    if(in < 0 || zck == NULL || !zck_init_read(zck, in)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    /* The dictionary chunk comes first */
+    if(zck_get_chunk_count(zck) != CHUNKS + 1) {
+        printf("Expected %i chunks, got %li\n", CHUNKS + 1,
+               (long) zck_get_chunk_count(zck));
+        exit(1);
+    }
+    if(zck_missing_chunks(zck) != CHUNKS + 1) {
+        printf("All chunks should be missing before validation\n");
+        exit(1);
+    }
+
+    char **digests = calloc(CHUNKS + 1, sizeof(char *));
+    size_t start = zck_get_header_length(zck);
+    zckChunk *chk = zck_get_first_chunk(zck);
+    for(int i=0; i<=CHUNKS; i++, chk = zck_get_next_chunk(chk)) {
+        if(chk == NULL || zck_get_chunk(zck, i) != chk ||
+           zck_get_chunk_number(chk) != i) {
+            printf("Chunk %i doesn't match walking the index\n", i);
+            exit(1);
+        }
+        if(zck_get_chunk_start(chk) != start ||
+           zck_get_chunk_size(chk) != (i ? CHUNK_SIZE : 0)) {
+            printf("Chunk %i has the wrong position or size\n", i);
+            exit(1);
+        }
+        start += zck_get_chunk_comp_size(chk);
+        digests[i] = zck_get_chunk_digest(chk);
+    }
+    if(chk != NULL || zck_get_chunk(zck, CHUNKS + 1) != NULL) {
+        printf("Found chunks past the end of the index\n");
+        exit(1);
+    }
+    if(zck_get_header_length(zck) + zck_get_data_length(zck) != start) {
+        printf("Data length doesn't match the chunks\n");
+        exit(1);
+    }
+
+    if(zck_validate_checksums(zck) != 1 || zck_missing_chunks(zck) != 0 ||
+       zck_failed_chunks(zck) != 0) {
+        printf("Checksums failed to validate\n");
+        exit(1);
+    }
+    zck_free(&zck);
+    close(in);
+    return digests;
+}
+
+/* The digest lookup table is only built once something needs to match
+ * chunks against the index */
+static void check_matching(void) {
+    int src_fd = open(TEST_FILE, O_RDONLY | O_BINARY);
+    int tgt_fd = open(TEST_FILE, O_RDONLY | O_BINARY);
+    zckCtx *src = zck_create();
+    zckCtx *tgt = zck_create();
+    if(src_fd < 0 || tgt_fd < 0 || src == NULL || tgt == NULL ||
+       !zck_init_read(src, src_fd) || !zck_init_read(tgt, tgt_fd)) {
+        printf("Unable to read " TEST_FILE "\n");
+        exit(1);
+    }
+    if(zck_get_chunk_count(src) != CHUNKS + 1 ||
+       zck_get_data_length(src) != CHUNK_SIZE * CHUNKS) {
+        printf("Wrong chunk count or data length before looking at chunks\n");
+        exit(1);
+    }
+    if(!zck_find_matching_chunks(src, tgt) || zck_missing_chunks(tgt) != 0) {
+        printf("All chunks should match themselves\n");
+        exit(1);
+    }
+    if(zck_generate_hashdb(src)) {
+        printf("Hash DB should already be present\n");
+        exit(1);
+    }
+    zck_free(&src);
+    zck_free(&tgt);
+    close(src_fd);
+    close(tgt_fd);
+}
+
+int main (int argc, char *argv[]) {
+    char *data = calloc(CHUNK_SIZE * CHUNKS, 1);
+    for(size_t i=0; i<CHUNK_SIZE * CHUNKS; i++)
+        data[i] = (i * 7 + i / CHUNK_SIZE) % 251 + 1;
+
+    write_file(data, 1);
+    char **expected = check_index();
+    check_matching();
+
+    /* Chunk digests come from the hashing threads when there's more than
+     * one thread, and must land on the right chunks */
+    write_file(data, 4);
+    char **actual = check_index();
+    for(int i=0; i<=CHUNKS; i++) {
+        if(strcmp(actual[i], expected[i]) != 0) {
+            printf("Chunk %i digest differs when written with threads\n", i);
+            exit(1);
+        }
+        free(actual[i]);
+        free(expected[i]);
+    }
+    free(actual);
+    free(expected);
+
+    unlink(TEST_FILE);
+    free(data);
+    return 0;
+}
@@ -123,6 +123,65 @@ int main (int argc, char *argv[]) {
 
     zck_free(&tgt_zck);
     zck_free(&src_zck);
+
+    /* Cut the source short partway through its chunks.  The chunks that are
+     * still there should be copied, even though the batch they're read in
+     * runs past the end of the file */
+    if(lseek(tgt, 0, SEEK_SET) == -1 || lseek(in, 0, SEEK_SET) == -1 ||
+       ftruncate(tgt, 0) != 0) {
+        perror("Unable to reset target");
+        exit(1);
+    }
+    while((len=read(in, buffer, 4096)) > 0) {
+        if(write(tgt, buffer, len) < len) {
+            perror("Unable to write to target");
+            exit(1);
+        }
+    }
+    lseek(tgt, 0, SEEK_SET);
+    int short_src = open("copy_chunks_short.zck",
+                         O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(short_src < 0 || lseek(src, 0, SEEK_SET) == -1) {
+        perror("Unable to open copy_chunks_short.zck for writing");
+        exit(1);
+    }
+    while((len=read(src, buffer, 4096)) > 0) {
+        if(write(short_src, buffer, len) < len) {
+            perror("Unable to write to copy_chunks_short.zck");
+            exit(1);
+        }
+    }
+    lseek(short_src, 0, SEEK_SET);
+    src_zck = zck_create();
+    tgt_zck = zck_create();
+    if(src_zck == NULL || tgt_zck == NULL ||
+       !zck_init_read(src_zck, short_src) ||
+       !zck_init_adv_read(tgt_zck, tgt) ||
+       !zck_read_lead(tgt_zck) || !zck_read_header(tgt_zck)) {
+        printf("%s%s", zck_get_error(src_zck), zck_get_error(tgt_zck));
+        exit(1);
+    }
+    zckChunk *cut = zck_get_chunk(src_zck,
+                                  zck_get_chunk_count(src_zck) / 2);
+    if(ftruncate(short_src, zck_get_chunk_start(cut) + 1) != 0) {
+        perror("Unable to truncate copy_chunks_short.zck");
+        exit(1);
+    }
+    if(!zck_copy_chunks(src_zck, tgt_zck)) {
+        printf("%s%s\n", zck_get_error(src_zck), zck_get_error(tgt_zck));
+        exit(1);
+    }
+    zck_reset_failed_chunks(tgt_zck);
+    int missing = zck_missing_chunks(tgt_zck);
+    printf("Missing chunks with short source: %i\n", missing);
+    if(missing <= 1 || missing >= zck_get_chunk_count(tgt_zck) - 1) {
+        printf("Should have copied the chunks before the cut\n");
+        exit(1);
+    }
+    zck_free(&tgt_zck);
+    zck_free(&src_zck);
+    close(short_src);
+    unlink("copy_chunks_short.zck");
     free(path);
     return 0;
 }
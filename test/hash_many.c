@@ -0,0 +1,125 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+#define MESSAGES 100
+#define DATA_SIZE 1000000
+
+/* Compare hash_many() against hashing each message on its own, with message
+ * sizes around the padding boundaries and a few large ones */
+static void check(zckCtx *zck, int type, const char *data, const char **ptrs,
+                  const size_t *sizes, const char *lanes) {
+    zckHashType hash_type = {0};
+    if(!hash_setup(zck, &hash_type, type)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    char *digests = calloc(MESSAGES, hash_type.digest_size);
+    if(digests == NULL) {
+        printf("Unable to allocate digests\n");
+        exit(1);
+    }
+    if(!hash_many(zck, &hash_type, ptrs, sizes, MESSAGES, digests)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    for(int i=0; i<MESSAGES; i++) {
+        zckHash hash = {0};
+        if(!hash_init(zck, &hash, &hash_type) ||
+           (sizes[i] > 0 && !hash_update(zck, &hash, ptrs[i], sizes[i]))) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        char *digest = hash_finalize(zck, &hash);
+        if(digest == NULL) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        if(memcmp(digest, digests + i * hash_type.digest_size,
+                  hash_type.digest_size) != 0) {
+            char *a = get_digest_string(digest, hash_type.digest_size);
+            char *b = get_digest_string(digests + i * hash_type.digest_size,
+                                        hash_type.digest_size);
+            printf("%s with %s lanes, message %i of %llu bytes: %s, "
+                   "expected %s\n", zck_hash_name_from_type(type), lanes, i,
+                   (long long unsigned) sizes[i], b, a);
+            exit(1);
+        }
+        free(digest);
+    }
+    free(digests);
+}
+
+int main (int argc, char *argv[]) {
+    int types[] = {ZCK_HASH_SHA256, ZCK_HASH_SHA512, ZCK_HASH_SHA512_128};
+    int lanes[] = {0, 4, 8, 16};
+    const char *ptrs[MESSAGES];
+    size_t sizes[MESSAGES];
+    char *data = calloc(DATA_SIZE, 1);
+    zckCtx *zck = zck_create();
+    if(data == NULL || zck == NULL) {
+        printf("Unable to allocate %i bytes\n", DATA_SIZE);
+        exit(1);
+    }
+    srand(1);
+    for(size_t i=0; i<DATA_SIZE; i++)
+        data[i] = rand() % 256;
+    for(int i=0; i<MESSAGES; i++) {
+        if(i < 60)
+            sizes[i] = i + 80;
+        else if(i < 95)
+            sizes[i] = rand() % 20000;
+        else
+            sizes[i] = rand() % (DATA_SIZE / 2);
+        ptrs[i] = data + rand() % (DATA_SIZE - sizes[i] + 1);
+    }
+
+    for(int t=0; t<3; t++) {
+        for(int l=0; l<4; l++) {
+            char name[16];
+            snprintf(name, sizeof(name), "%i", lanes[l]);
+            if(!hash_many_set_lanes(types[t], lanes[l])) {
+                printf("Skipping %s with %s lanes, which isn't supported "
+                       "here\n", zck_hash_name_from_type(types[t]), name);
+                continue;
+            }
+            printf("Testing %s with %s lanes\n",
+                   zck_hash_name_from_type(types[t]), name);
+            check(zck, types[t], data, ptrs, sizes, name);
+        }
+    }
+
+    zck_free(&zck);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "util.h"
+
+#define TEST_FILE "hash_queue.zck"
+#define DATA_SIZE 4194304
+
+/* Write data using threads threads and return the resulting file */
+static char *write_file(const char *data, int option, int threads,
+                        size_t *size) {
+    int out = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(out < 0) {
+        perror("Unable to open " TEST_FILE " for writing");
+        exit(1);
+    }
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_write(zck, out) ||
+       !zck_set_ioption(zck, ZCK_THREADS, threads) ||
+       (option >= 0 && !zck_set_ioption(zck, option, 1))) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    /* Write in uneven pieces so chunk boundaries land inside them */
+    size_t loc = 0;
+    for(size_t piece=1; loc < DATA_SIZE; piece++) {
+        size_t len = (piece * 37813) % 200000;
+        if(len > DATA_SIZE - loc)
+            len = DATA_SIZE - loc;
+        if(zck_write(zck, data + loc, len) != len) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        loc += len;
+    }
+    if(!zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+
+    *size = lseek(out, 0, SEEK_END);
+    char *buf = malloc(*size);
+    if(buf == NULL || pread(out, buf, *size, 0) != *size) {
+        perror("Unable to read back " TEST_FILE);
+        exit(1);
+    }
+    close(out);
+    return buf;
+}
+
+int main (int argc, char *argv[]) {
+    /* Repeated blocks with some noise, so there's something to compress and
+     * chunk boundaries to find */
+    char *data = malloc(DATA_SIZE);
+    unsigned int seed = 1;
+    for(size_t i=0; i<DATA_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (i % 65536 < 32768) ? (seed >> 16) & 0xff : (i * 13) % 97;
+    }
+
+    int options[] = {-1, ZCK_UNCOMP_HEADER, ZCK_TREE_DIGEST};
+    for(int o=0; o<3; o++) {
+        size_t expected_size = 0;
+        char *expected = write_file(data, options[o], 1, &expected_size);
+        for(int threads=2; threads<=4; threads++) {
+            size_t size = 0;
+            char *actual = write_file(data, options[o], threads, &size);
+            if(size != expected_size ||
+               memcmp(actual, expected, size) != 0) {
+                printf("File written with %i threads and option %i doesn't "
+                       "match file written with one thread\n", threads,
+                       options[o]);
+                exit(1);
+            }
+            free(actual);
+        }
+        free(expected);
+
+        /* Make sure what we wrote is actually valid */
+        int in = open(TEST_FILE, O_RDONLY | O_BINARY);
+        zckCtx *zck = zck_create();
+        if(in < 0 || zck == NULL || !zck_init_read(zck, in)) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        if(zck_validate_checksums(zck) != 1) {
+            printf("Checksums failed to validate with option %i\n",
+                   options[o]);
+            exit(1);
+        }
+        zck_free(&zck);
+        close(in);
+    }
+
+    unlink(TEST_FILE);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2018, 2020 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+#define TARGET "journal.fodt.zck"
+#define JOURNAL "journal.fodt.zck.zckv"
+
+/* Open the target with the validity journal and count its failed chunks */
+static int failed_chunks(int fd, size_t *starts, size_t count) {
+    lseek(fd, 0, SEEK_SET);
+    zckCtx *zck = zck_create();
+    if(zck == NULL)
+        exit(1);
+    if(!zck_init_adv_read(zck, fd) ||
+       !zck_set_soption(zck, ZCK_VALIDITY_JOURNAL, JOURNAL, strlen(JOURNAL)) ||
+       !zck_read_lead(zck) || !zck_read_header(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(starts) {
+        if(zck_get_chunk_count(zck) < count) {
+            printf("Test file doesn't have enough chunks\n");
+            exit(1);
+        }
+        for(size_t i=0; i<count; i++)
+            starts[i] = zck_get_chunk_start(zck_get_chunk(zck, i+1));
+    }
+    if(!zck_find_valid_chunks(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    int failed = zck_failed_chunks(zck);
+    zck_free(&zck);
+    return failed;
+}
+
+/* Flip a byte in the target, optionally hiding the change by putting its
+ * mtime back */
+static void corrupt(int fd, size_t loc, bool keep_mtime) {
+    struct stat st = {0};
+    if(fstat(fd, &st) != 0) {
+        perror("Unable to stat " TARGET);
+        exit(1);
+    }
+    char c = 0;
+    if(pread(fd, &c, 1, loc) != 1) {
+        perror("Unable to read from " TARGET);
+        exit(1);
+    }
+    c = ~c;
+    if(pwrite(fd, &c, 1, loc) != 1) {
+        perror("Unable to write to " TARGET);
+        exit(1);
+    }
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    if(!keep_mtime) {
+        times[1].tv_sec += 1;
+    }
+    if(futimens(fd, times) != 0) {
+        perror("Unable to set times on " TARGET);
+        exit(1);
+    }
+}
+
+int main (int argc, char *argv[]) {
+    zck_set_log_level(ZCK_LOG_DEBUG);
+
+    int in = open(argv[1], O_RDONLY | O_BINARY);
+    if(in < 0) {
+        perror("Unable to open LICENSE.nodict.fodt.zck for reading");
+        exit(1);
+    }
+    unlink(JOURNAL);
+    int tgt = open(TARGET, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(tgt < 0) {
+        perror("Unable to open " TARGET " for writing");
+        exit(1);
+    }
+    char buffer[4096] = {0};
+    int len = 0;
+    while((len=read(in, buffer, 4096)) > 0) {
+        if(write(tgt, buffer, len) < len) {
+            perror("Unable to write to " TARGET);
+            exit(1);
+        }
+    }
+    close(in);
+
+    /* Without a journal, everything is checked */
+    size_t starts[3] = {0};
+    int failed = failed_chunks(tgt, starts, 3);
+    if(failed != 0) {
+        printf("Expected no failed chunks, got %i\n", failed);
+        exit(1);
+    }
+    corrupt(tgt, starts[0], false);
+    failed = failed_chunks(tgt, NULL, 0);
+    if(failed != 1) {
+        printf("Expected one failed chunk, got %i\n", failed);
+        exit(1);
+    }
+
+    /* A chunk the journal has as verified isn't checked again if the file
+     * looks unchanged */
+    corrupt(tgt, starts[1], true);
+    failed = failed_chunks(tgt, NULL, 0);
+    if(failed != 1) {
+        printf("Journal wasn't used, expected one failed chunk, got %i\n",
+               failed);
+        exit(1);
+    }
+
+    /* Once the mtime changes, the journal is ignored */
+    corrupt(tgt, starts[2], false);
+    failed = failed_chunks(tgt, NULL, 0);
+    if(failed != 3) {
+        printf("Journal wasn't ignored, expected three failed chunks, "
+               "got %i\n", failed);
+        exit(1);
+    }
+
+    close(tgt);
+    unlink(TARGET);
+    unlink(JOURNAL);
+    return 0;
+}
@@ -25,9 +25,12 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdbool.h>
+#include <fcntl.h>
 #include <zck.h>
 #include "../../src/lib/zck_private.h"
+#include "util.h"
 
 char *get_hash(char *data, size_t length, int type) {
     zckHashType hash_type = {0};
@@ -49,3 +52,24 @@ char *get_hash(char *data, size_t length, int type) {
     free(digest);
     return digest_string;
 }
+
+/* Open path and read its header with the given number of threads, exiting on
+ * failure.  If fd isn't NULL, it's set to the file descriptor so the caller
+ * can close it */
+zckCtx *open_zck(const char *path, int threads, int *fd) {
+    int in = open(path, O_RDONLY | O_BINARY);
+    if(in < 0) {
+        perror("Unable to open zchunk file for reading");
+        exit(1);
+    }
+
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_read(zck, in) ||
+       !zck_set_ioption(zck, ZCK_THREADS, threads)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(fd)
+        *fd = in;
+    return zck;
+}
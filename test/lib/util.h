@@ -43,3 +43,5 @@
 
 char *get_hash(char *data, size_t length, int type)
     ZCK_WARN_UNUSED;
+zckCtx *open_zck(const char *path, int threads, int *fd)
+    ZCK_WARN_UNUSED;
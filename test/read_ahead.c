@@ -0,0 +1,111 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+#define READ_SIZE 1000
+
+/* Read the whole file with zck_read() using the given read-ahead settings */
+static char *read_all(char *path, int read_ahead, int threads, bool mapped,
+                      size_t *size) {
+    int in = open(path, O_RDONLY | O_BINARY);
+    if(in < 0) {
+        perror("Unable to open zchunk file for reading");
+        exit(1);
+    }
+
+    zckCtx *zck = zck_create();
+    if(zck == NULL ||
+       !(mapped ? zck_init_read_mmap(zck, in) : zck_init_read(zck, in))) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(!zck_set_ioption(zck, ZCK_THREADS, threads) ||
+       !zck_set_ioption(zck, ZCK_READ_AHEAD, read_ahead)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+
+    size_t data_size = READ_SIZE;
+    char *data = calloc(data_size, 1);
+    size_t loc = 0;
+    while(true) {
+        if(loc + READ_SIZE > data_size) {
+            data_size *= 2;
+            data = realloc(data, data_size);
+        }
+        /* Use a small buffer so chunks are read in several pieces */
+        ssize_t rb = zck_read(zck, data + loc, READ_SIZE);
+        if(rb < 0) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        if(rb == 0)
+            break;
+        loc += rb;
+    }
+    if(!zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+    close(in);
+    *size = loc;
+    return data;
+}
+
+int main (int argc, char *argv[]) {
+    size_t expected_size = 0;
+    char *expected = read_all(argv[1], 0, 1, false, &expected_size);
+
+    /* Read-ahead, threads, and whether to map the file.  The last is far
+     * more of both than there are chunks */
+    int settings[][3] = {{1, 1, 0}, {4, 1, 0}, {1, 2, 0}, {4, 2, 0},
+                         {64, 4, 0}, {4, 3, 1}, {1000000000, 1000000, 0}};
+    for(int i=0; i<sizeof(settings)/sizeof(settings[0]); i++) {
+        size_t size = 0;
+        char *data = read_all(argv[1], settings[i][0], settings[i][1],
+                              settings[i][2], &size);
+        if(size != expected_size || memcmp(data, expected, size) != 0) {
+            printf("Data read with read-ahead %i and %i threads doesn't "
+                   "match\n", settings[i][0], settings[i][1]);
+            exit(1);
+        }
+        free(data);
+    }
+    free(expected);
+}
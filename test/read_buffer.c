@@ -0,0 +1,132 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+int main (int argc, char *argv[]) {
+    /* Read zchunk file into memory */
+    int in = open(argv[1], O_RDONLY | O_BINARY);
+    if(in < 0) {
+        perror("Unable to open zchunk file for reading");
+        exit(1);
+    }
+    struct stat st;
+    if(fstat(in, &st) != 0) {
+        perror("Unable to stat zchunk file");
+        exit(1);
+    }
+    char *buf = calloc(st.st_size, 1);
+    size_t buf_size = 0;
+    while(buf_size < st.st_size) {
+        ssize_t rb = read(in, buf + buf_size, st.st_size - buf_size);
+        if(rb < 1) {
+            perror("Unable to read zchunk file");
+            exit(1);
+        }
+        buf_size += rb;
+    }
+
+    /* Read file normally to compare against */
+    if(lseek(in, 0, SEEK_SET) == -1) {
+        perror("Unable to seek to beginning of file");
+        exit(1);
+    }
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_read(zck, in)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    size_t size = 0;
+    for(zckChunk *idx = zck_get_chunk(zck, 1); idx;
+        idx = zck_get_next_chunk(idx))
+        size += zck_get_chunk_size(idx);
+    char *expected = calloc(size, 1);
+    if(zck_read(zck, expected, size) != size) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    ssize_t header_length = zck_get_header_length(zck);
+    zck_free(&zck);
+    close(in);
+
+    /* Read file from memory */
+    zck = zck_create();
+    if(zck == NULL || !zck_init_read_buffer(zck, buf, buf_size)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(zck->header != buf) {
+        printf("Header copied out of buffer\n");
+        exit(1);
+    }
+    if(zck_validate_checksums(zck) != 1) {
+        printf("Checksums failed to validate: %s", zck_get_error(zck));
+        exit(1);
+    }
+    char *data = calloc(size, 1);
+    if(zck_read(zck, data, size) != size) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(memcmp(data, expected, size) != 0) {
+        printf("Data read from memory doesn't match\n");
+        exit(1);
+    }
+    if(!zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+
+    /* Read just the header from memory */
+    zck = zck_create();
+    if(zck == NULL ||
+       !zck_init_adv_read_buffer(zck, buf, header_length) ||
+       !zck_read_lead(zck) || !zck_read_header(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(zck_get_header_length(zck) != header_length) {
+        printf("Header length doesn't match\n");
+        exit(1);
+    }
+    zck_free(&zck);
+
+    free(data);
+    free(expected);
+    free(buf);
+}
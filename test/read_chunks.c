@@ -0,0 +1,178 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+typedef struct checkData {
+    char **expected;
+    ssize_t last;
+    size_t calls;
+} checkData;
+
+static bool check_chunk(zckChunk *chunk, const char *data, size_t size,
+                        void *cb_data) {
+    checkData *cd = cb_data;
+    ssize_t number = zck_get_chunk_number(chunk);
+
+    if(number <= cd->last) {
+        printf("Chunk %lli returned after chunk %lli\n", (long long) number,
+               (long long) cd->last);
+        return false;
+    }
+    if(size != zck_get_chunk_size(chunk) ||
+       (size > 0 && memcmp(data, cd->expected[number], size) != 0)) {
+        printf("Data for chunk %lli doesn't match\n", (long long) number);
+        return false;
+    }
+    cd->last = number;
+    cd->calls++;
+    return true;
+}
+
+static bool stop_early(zckChunk *chunk, const char *data, size_t size,
+                       void *cb_data) {
+    return false;
+}
+
+int main (int argc, char *argv[]) {
+    /* Read all chunks through a separate context to compare against */
+    int ref_in = -1;
+    zckCtx *ref = open_zck(argv[1], 1, &ref_in);
+    ssize_t count = zck_get_chunk_count(ref);
+    char **expected = calloc(count, sizeof(char *));
+    for(size_t i=0; i<count; i++) {
+        zckChunk *chunk = zck_get_chunk(ref, i);
+        expected[i] = calloc(zck_get_chunk_size(chunk) + 1, 1);
+        if(zck_get_chunk_data(chunk, expected[i],
+                              zck_get_chunk_size(chunk)) < 0) {
+            printf("%s", zck_get_error(ref));
+            exit(1);
+        }
+    }
+    zck_free(&ref);
+    close(ref_in);
+
+    /* A huge thread count should be capped rather than creating a reader
+     * per thread */
+    int thread_counts[] = {1, 4, 1000000};
+    for(int t=0; t<3; t++) {
+        int threads = thread_counts[t];
+        int in = -1;
+        zckCtx *zck = open_zck(argv[1], 1, &in);
+        if(!zck_set_ioption(zck, ZCK_THREADS, threads)) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+
+        /* Request every other chunk in reverse, then all chunks shuffled */
+        zckChunk **chunks = calloc(count, sizeof(zckChunk *));
+        size_t n = 0;
+        for(ssize_t i=count-1; i>=0; i-=2)
+            chunks[n++] = zck_get_chunk(zck, i);
+        checkData cd = {expected, -1, 0};
+        if(!zck_get_chunks_data(zck, chunks, n, check_chunk, &cd)) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        if(cd.calls != n) {
+            printf("Expected %lu callbacks, got %lu\n", (unsigned long) n,
+                   (unsigned long) cd.calls);
+            exit(1);
+        }
+
+        for(size_t i=0; i<count; i++)
+            chunks[i] = zck_get_chunk(zck, (i * 7) % count);
+        if(count % 7 == 0)
+            for(size_t i=0; i<count; i++)
+                chunks[i] = zck_get_chunk(zck, count - i - 1);
+        cd.last = -1;
+        cd.calls = 0;
+        if(!zck_get_chunks_data(zck, chunks, count, check_chunk, &cd)) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        if(cd.calls != count) {
+            printf("Expected %lu callbacks, got %lu\n", (unsigned long) count,
+                   (unsigned long) cd.calls);
+            exit(1);
+        }
+
+        /* Every chunk but the dictionary should be passed in order */
+        cd.last = 0;
+        cd.calls = 0;
+        if(!zck_foreach_chunk(zck, check_chunk, &cd)) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        if(cd.calls != count - 1 || cd.last != count - 1) {
+            printf("Expected %lu chunks from zck_foreach_chunk(), got %lu\n",
+                   (unsigned long) count - 1, (unsigned long) cd.calls);
+            exit(1);
+        }
+        /* zck_close() checks the data checksum built along the way */
+        if(!zck_close(zck)) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+
+        /* A failing callback should stop extraction with an error */
+        if(zck_get_chunks_data(zck, chunks, count, stop_early, NULL) ||
+           !zck_is_error(zck)) {
+            printf("Failing callback didn't set an error\n");
+            exit(1);
+        }
+        zck_clear_error(zck);
+
+        free(chunks);
+        zck_free(&zck);
+        close(in);
+    }
+
+    int in = -1;
+    zckCtx *zck = open_zck(argv[1], 1, &in);
+    if(zck_set_ioption(zck, ZCK_THREADS, (ssize_t)INT_MAX + 1)) {
+        printf("Thread count past INT_MAX accepted\n");
+        exit(1);
+    }
+    zck_free(&zck);
+    close(in);
+
+    for(size_t i=0; i<count; i++)
+        free(expected[i]);
+    free(expected);
+}
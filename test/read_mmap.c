@@ -0,0 +1,109 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+static char *read_all(zckCtx *zck, size_t *size) {
+    *size = 0;
+    for(zckChunk *idx = zck_get_chunk(zck, 1); idx;
+        idx = zck_get_next_chunk(idx))
+        *size += zck_get_chunk_size(idx);
+    char *data = calloc(*size + 1, 1);
+    if(zck_read(zck, data, *size) != *size) {
+        printf("Unable to read file: %s", zck_get_error(zck));
+        exit(1);
+    }
+    if(!zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    return data;
+}
+
+int main (int argc, char *argv[]) {
+    int in = open(argv[1], O_RDONLY | O_BINARY);
+    if(in < 0) {
+        perror("Unable to open zchunk file for reading");
+        exit(1);
+    }
+
+    /* Read file normally to compare against */
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_read(zck, in)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    size_t size = 0;
+    char *expected = read_all(zck, &size);
+    zck_free(&zck);
+
+    /* Read mapped file */
+    if(lseek(in, 0, SEEK_SET) == -1) {
+        perror("Unable to seek to beginning of file");
+        exit(1);
+    }
+    zck = zck_create();
+    if(zck == NULL || !zck_init_read_mmap(zck, in)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(zck_validate_checksums(zck) != 1) {
+        printf("Checksums failed to validate: %s", zck_get_error(zck));
+        exit(1);
+    }
+    size_t mapped_size = 0;
+    char *mapped = read_all(zck, &mapped_size);
+    if(mapped_size != size || memcmp(mapped, expected, size) != 0) {
+        printf("Mapped data doesn't match\n");
+        exit(1);
+    }
+
+    /* Random access within the mapping */
+    char *data = calloc(size, 1);
+    if(zck_pread(zck, data, size / 2, size / 4) != size / 2 ||
+       memcmp(data, expected + size / 4, size / 2) != 0) {
+        printf("Mapped data at offset %llu doesn't match\n",
+               (long long unsigned) size / 4);
+        exit(1);
+    }
+
+    free(data);
+    free(mapped);
+    free(expected);
+    zck_free(&zck);
+    close(in);
+}
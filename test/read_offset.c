@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+int main (int argc, char *argv[]) {
+    /* Read the whole file sequentially to compare against */
+    zckCtx *zck = open_zck(argv[1], 1, NULL);
+    size_t size = 0;
+    for(zckChunk *idx = zck_get_chunk(zck, 1); idx;
+        idx = zck_get_next_chunk(idx))
+        size += zck_get_chunk_size(idx);
+    char *full = calloc(size + 1, 1);
+    if(zck_read(zck, full, size) != size) {
+        printf("Unable to read full file: %s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+
+    zck = open_zck(argv[1], 1, NULL);
+    zckChunk *second = zck_get_chunk(zck, 2);
+    if(second == NULL) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    size_t first_len = zck_get_chunk_size(zck_get_chunk(zck, 1));
+    size_t second_len = zck_get_chunk_size(second);
+
+    /* Start of data, a whole chunk, a range spanning a chunk boundary,
+     * a range inside a chunk and the end of the data */
+    size_t offsets[] = {0, first_len, first_len - 10, first_len + 5,
+                        size - 100};
+    size_t lengths[] = {100, second_len, 20, second_len - 10, 100};
+    char *data = calloc(size + 1, 1);
+    for(int i=0; i<5; i++) {
+        ssize_t read_size = zck_pread(zck, data, lengths[i], offsets[i]);
+        if(read_size != lengths[i]) {
+            if(read_size < 0)
+                printf("%s", zck_get_error(zck));
+            else
+                printf("Read %lli bytes at %llu, expected %llu\n",
+                       (long long) read_size,
+                       (long long unsigned) offsets[i],
+                       (long long unsigned) lengths[i]);
+            exit(1);
+        }
+        if(memcmp(data, full + offsets[i], lengths[i]) != 0) {
+            printf("Data at %llu doesn't match\n",
+                   (long long unsigned) offsets[i]);
+            exit(1);
+        }
+    }
+
+    /* Reads past the end should be truncated */
+    if(zck_pread(zck, data, 200, size - 100) != 100) {
+        printf("Read past end of data wasn't truncated\n");
+        exit(1);
+    }
+    if(zck_pread(zck, data, 200, size) != 0) {
+        printf("Read at end of data didn't return 0\n");
+        exit(1);
+    }
+    free(data);
+    free(full);
+    zck_free(&zck);
+}
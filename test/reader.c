@@ -0,0 +1,123 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+int main (int argc, char *argv[]) {
+    /* Read all chunks through a separate context to compare against */
+    int ref_in = -1;
+    zckCtx *ref = open_zck(argv[1], 1, &ref_in);
+    ssize_t count = zck_get_chunk_count(ref);
+    char **expected = calloc(count, sizeof(char *));
+    for(size_t i=1; i<count; i++) {
+        zckChunk *chunk = zck_get_chunk(ref, i);
+        expected[i] = calloc(zck_get_chunk_size(chunk) + 1, 1);
+        if(zck_get_chunk_data(chunk, expected[i],
+                              zck_get_chunk_size(chunk)) < 0) {
+            printf("%s", zck_get_error(ref));
+            exit(1);
+        }
+    }
+    zck_free(&ref);
+    close(ref_in);
+
+    int in = -1;
+    zckCtx *zck = open_zck(argv[1], 1, &in);
+
+    zckReader *forward = zck_reader_create(zck);
+    zckReader *backward = zck_reader_create(zck);
+    if(forward == NULL || backward == NULL) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+
+    /* Interleave two readers going in opposite directions with a sequential
+     * read on the parent context, making sure none of them interfere */
+    size_t data_size = 0;
+    for(size_t i=1; i<count; i++)
+        data_size += zck_get_chunk_size(zck_get_chunk(zck, i));
+    char *seq = calloc(data_size, 1);
+    size_t seq_loc = 0;
+    for(size_t i=1; i<count; i++) {
+        zckChunk *chunks[2] = {zck_get_chunk(zck, i),
+                               zck_get_chunk(zck, count - i)};
+        zckReader *readers[2] = {forward, backward};
+        for(int r=0; r<2; r++) {
+            size_t size = zck_get_chunk_size(chunks[r]);
+            char *data = calloc(size + 1, 1);
+            if(zck_reader_get_chunk_data(readers[r], chunks[r], data,
+                                         size) != size) {
+                printf("%s", zck_reader_get_error(readers[r]));
+                exit(1);
+            }
+            if(memcmp(data, expected[chunks[r]->number], size) != 0) {
+                printf("Reader data for chunk %llu doesn't match\n",
+                       (long long unsigned) chunks[r]->number);
+                exit(1);
+            }
+            free(data);
+        }
+        size_t size = zck_get_chunk_size(chunks[0]);
+        if(zck_read(zck, seq + seq_loc, size) != size) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        seq_loc += size;
+    }
+    for(size_t i=1, loc=0; i<count; i++) {
+        size_t size = zck_get_chunk_size(zck_get_chunk(zck, i));
+        if(memcmp(seq + loc, expected[i], size) != 0) {
+            printf("Sequential data for chunk %llu doesn't match\n",
+                   (long long unsigned) i);
+            exit(1);
+        }
+        loc += size;
+    }
+
+    zck_reader_free(&forward);
+    zck_reader_free(&backward);
+    if(forward != NULL || backward != NULL) {
+        printf("Readers weren't cleared when freed\n");
+        exit(1);
+    }
+    for(size_t i=1; i<count; i++)
+        free(expected[i]);
+    free(expected);
+    free(seq);
+    zck_free(&zck);
+    close(in);
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "hash/bundled/sha2/sha2.h"
+#include "util.h"
+
+#define DATA_SIZE 1000000
+
+/* FIPS 180-2 test vectors */
+static struct {
+    int type;
+    const char *message;
+    const char *digest;
+} vectors[] = {
+    {ZCK_HASH_SHA256, "abc",
+     "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {ZCK_HASH_SHA256,
+     "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {ZCK_HASH_SHA256, NULL,
+     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    {ZCK_HASH_SHA512, "abc",
+     "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+     "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f"},
+    {ZCK_HASH_SHA512,
+     "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno"
+     "ijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+     "8e959b75dae313da8cf4f72814fc143f8f7779c6eb9f7fa17299aeadb6889018"
+     "501d289e4900f7e4331b99dec4b5433ac7d329eeb6dd26545e96e55b874be909"},
+    {ZCK_HASH_SHA512, NULL,
+     "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+     "de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b"},
+    {0, NULL, NULL}
+};
+
+/* Hash data in pieces of step bytes, returning the digest as a string */
+static char *hash_steps(const char *data, size_t length, size_t step,
+                        int type) {
+    zckHashType hash_type = {0};
+    zckHash hash = {0};
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !hash_setup(zck, &hash_type, type) ||
+       !hash_init(zck, &hash, &hash_type)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    for(size_t i=0; i<length; i+=step) {
+        size_t size = length - i < step ? length - i : step;
+        if(!hash_update(zck, &hash, data + i, size)) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+    }
+    char *digest = hash_finalize(zck, &hash);
+    if(digest == NULL) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    char *digest_string = get_digest_string(digest, hash_type.digest_size);
+    free(digest);
+    zck_free(&zck);
+    return digest_string;
+}
+
+int main (int argc, char *argv[]) {
+    int types[] = {ZCK_HASH_SHA256, ZCK_HASH_SHA512, ZCK_HASH_SHA512_128};
+    size_t lengths[] = {0, 1, 55, 56, 63, 64, 65, 111, 112, 127, 128, 129,
+                        1000, 4096, 65537};
+    size_t steps[] = {1, 13, 64, 128, 1000, 65536};
+    char *expected[3][15] = {{0}};
+    char *data = calloc(DATA_SIZE, 1);
+    char *a = calloc(DATA_SIZE, 1);
+    if(data == NULL || a == NULL) {
+        printf("Unable to allocate %i bytes\n", DATA_SIZE);
+        exit(1);
+    }
+    srand(1);
+    for(size_t i=0; i<DATA_SIZE; i++)
+        data[i] = rand() % 256;
+    memset(a, 'a', DATA_SIZE);
+
+    /* Each implementation must agree with the test vectors, and with the
+     * portable code on odd lengths and update sizes */
+    for(int impl=0; impl<SHA2_IMPL_COUNT; impl++) {
+        if(!sha2_use_impl(impl)) {
+            printf("Skipping %s, which isn't supported here\n",
+                   sha2_impl_name(impl));
+            continue;
+        }
+        printf("Testing %s\n", sha2_impl_name(impl));
+
+        for(int i=0; vectors[i].digest; i++) {
+            const char *message = vectors[i].message ? vectors[i].message
+                                                     : a;
+            size_t length = vectors[i].message ? strlen(message)
+                                               : DATA_SIZE;
+            char *digest = hash_steps(message, length, 4096,
+                                      vectors[i].type);
+            if(strcmp(digest, vectors[i].digest) != 0) {
+                printf("%s %s of %llu bytes: %s, expected %s\n",
+                       sha2_impl_name(impl),
+                       zck_hash_name_from_type(vectors[i].type),
+                       (long long unsigned) length, digest,
+                       vectors[i].digest);
+                exit(1);
+            }
+            free(digest);
+        }
+
+        for(int t=0; t<3; t++) {
+            for(int l=0; l<15; l++) {
+                for(int s=0; s<6; s++) {
+                    char *digest = hash_steps(data, lengths[l], steps[s],
+                                              types[t]);
+                    if(expected[t][l] == NULL) {
+                        expected[t][l] = digest;
+                        continue;
+                    }
+                    if(strcmp(digest, expected[t][l]) != 0) {
+                        printf("%s %s of %llu bytes in steps of %llu: %s, "
+                               "expected %s\n", sha2_impl_name(impl),
+                               zck_hash_name_from_type(types[t]),
+                               (long long unsigned) lengths[l],
+                               (long long unsigned) steps[s], digest,
+                               expected[t][l]);
+                        exit(1);
+                    }
+                    free(digest);
+                }
+            }
+        }
+    }
+
+    for(int t=0; t<3; t++)
+        for(int l=0; l<15; l++)
+            free(expected[t][l]);
+    free(data);
+    free(a);
+    return 0;
+}
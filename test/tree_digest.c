@@ -0,0 +1,238 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+#define TEST_FILE "tree_digest.zck"
+#define DATA_SIZE 102400
+
+/* Write a file asking for SHA-1 chunk checksums, after asking for a tree
+ * data checksum if tree is set */
+static void write_weak_file(const char *data, bool tree) {
+    int out = open(TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(out < 0) {
+        perror("Unable to open " TEST_FILE " for writing");
+        exit(1);
+    }
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_write(zck, out) ||
+       (tree && !zck_set_ioption(zck, ZCK_TREE_DIGEST, 1)) ||
+       !zck_set_ioption(zck, ZCK_HASH_CHUNK_TYPE, ZCK_HASH_SHA1) ||
+       zck_write(zck, data, DATA_SIZE) != DATA_SIZE || !zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+    close(out);
+}
+
+int main (int argc, char *argv[]) {
+    char *data = calloc(DATA_SIZE, 1);
+    for(size_t i=0; i<DATA_SIZE; i++)
+        data[i] = (i * 7) % 251;
+
+    /* Write a file with a tree data checksum */
+    int out = open(TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(out < 0) {
+        perror("Unable to open " TEST_FILE " for writing");
+        exit(1);
+    }
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_write(zck, out) ||
+       !zck_set_ioption(zck, ZCK_TREE_DIGEST, 1) ||
+       !zck_set_ioption(zck, ZCK_MANUAL_CHUNK, 1)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    for(size_t i=0; i<DATA_SIZE; i+=10000) {
+        size_t size = DATA_SIZE - i < 10000 ? DATA_SIZE - i : 10000;
+        if(zck_write(zck, data + i, size) != size || zck_end_chunk(zck) < 0) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+    }
+    if(!zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+    close(out);
+
+    /* The data checksum should be the checksum of the chunk checksums */
+    zck = open_zck(TEST_FILE, 1, NULL);
+    if(!(zck_get_flags(zck) & 8)) {
+        printf("Tree digest flag not set\n");
+        exit(1);
+    }
+    zckHash hash = {0};
+    for(zckChunk *idx = zck_get_first_chunk(zck); idx;
+        idx = zck_get_next_chunk(idx)) {
+        if((idx == zck_get_first_chunk(zck) &&
+            !hash_init(zck, &hash, &(zck->hash_type))) ||
+           !hash_update(zck, &hash, idx->digest, idx->digest_size)) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+    }
+    char *digest = hash_finalize(zck, &hash);
+    char *expected = get_digest_string(digest, zck_get_full_digest_size(zck));
+    char *actual = zck_get_data_digest(zck);
+    if(strcmp(expected, actual) != 0) {
+        printf("Data checksum %s, expected %s\n", actual, expected);
+        exit(1);
+    }
+    free(digest);
+    free(expected);
+    free(actual);
+
+    if(zck_validate_checksums(zck) != 1 ||
+       zck_validate_data_checksum(zck) != 1) {
+        printf("Checksums failed to validate\n");
+        exit(1);
+    }
+    char *read_data = calloc(DATA_SIZE, 1);
+    if(zck_read(zck, read_data, DATA_SIZE) != DATA_SIZE ||
+       memcmp(read_data, data, DATA_SIZE) != 0 || !zck_close(zck)) {
+        printf("Unable to read back data: %s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+
+    /* Damage a chunk, which the data checksum should catch */
+    zck = open_zck(TEST_FILE, 1, NULL);
+    size_t loc = zck_get_chunk_start(zck_get_chunk(zck, 3)) + 10;
+    zck_free(&zck);
+    int fd = open(TEST_FILE, O_RDWR | O_BINARY);
+    char c = 0;
+    if(fd < 0 || pread(fd, &c, 1, loc) != 1) {
+        perror("Unable to read from " TEST_FILE);
+        exit(1);
+    }
+    c = ~c;
+    if(pwrite(fd, &c, 1, loc) != 1) {
+        perror("Unable to write to " TEST_FILE);
+        exit(1);
+    }
+    close(fd);
+    for(int threads=1; threads<=4; threads+=3) {
+        zck = open_zck(TEST_FILE, threads, NULL);
+        if(zck_validate_data_checksum(zck) != -1) {
+            printf("Damaged chunk not caught with %i threads\n", threads);
+            exit(1);
+        }
+        zck_free(&zck);
+    }
+
+    /* The damaged chunk is never read, so closing mustn't vouch for it */
+    zck = open_zck(TEST_FILE, 1, NULL);
+    if(zck_read(zck, read_data, 4096) != 4096) {
+        printf("Unable to read start of data: %s", zck_get_error(zck));
+        exit(1);
+    }
+    if(zck_close(zck)) {
+        printf("Data checksum passed without reading damaged chunk\n");
+        exit(1);
+    }
+    zck_free(&zck);
+
+    /* Asking for a weak chunk checksum after the tree data checksum should
+     * still get a strong one */
+    write_weak_file(data, true);
+    zck = open_zck(TEST_FILE, 1, NULL);
+    if(zck_get_chunk_hash_type(zck) != ZCK_HASH_SHA256) {
+        printf("Tree data checksum written with %s chunk checksums\n",
+               zck_hash_name_from_type(zck_get_chunk_hash_type(zck)));
+        exit(1);
+    }
+    zck_free(&zck);
+
+    /* Set the tree digest flag on a file with SHA-1 chunk checksums, fixing
+     * up the header checksum, and make sure the reader rejects it */
+    write_weak_file(data, false);
+    zck = open_zck(TEST_FILE, 1, NULL);
+    size_t digest_loc = zck->hdr_digest_loc;
+    size_t digest_size = zck->hash_type.digest_size;
+    size_t header_size = zck_get_header_length(zck);
+    size_t flags_loc = zck_get_lead_length(zck) + digest_size;
+    char *header = calloc(header_size, 1);
+    fd = open(TEST_FILE, O_RDWR | O_BINARY);
+    if(fd < 0 || pread(fd, header, header_size, 0) != header_size) {
+        perror("Unable to read from " TEST_FILE);
+        exit(1);
+    }
+    if((unsigned char)header[flags_loc] != 128) {
+        printf("Unexpected flags in header\n");
+        exit(1);
+    }
+    header[flags_loc] += 8;
+    char *header_digest = NULL;
+    if(!hash_init(zck, &hash, &(zck->hash_type)) ||
+       !hash_update(zck, &hash, header, digest_loc) ||
+       !hash_update(zck, &hash, header + digest_loc + digest_size,
+                    header_size - digest_loc - digest_size) ||
+       (header_digest = hash_finalize(zck, &hash)) == NULL) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    memcpy(header + digest_loc, header_digest, digest_size);
+    if(pwrite(fd, header, header_size, 0) != header_size) {
+        perror("Unable to write to " TEST_FILE);
+        exit(1);
+    }
+    close(fd);
+    free(header_digest);
+    free(header);
+    zck_free(&zck);
+
+    int in = open(TEST_FILE, O_RDONLY | O_BINARY);
+    zck = zck_create();
+    if(in < 0 || zck == NULL) {
+        perror("Unable to open " TEST_FILE " for reading");
+        exit(1);
+    }
+    if(zck_init_read(zck, in)) {
+        printf("Tree data checksum with SHA-1 chunk checksums accepted\n");
+        exit(1);
+    }
+    zck_free(&zck);
+    close(in);
+
+    unlink(TEST_FILE);
+    free(read_data);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* For SEEK_DATA */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+#define SOURCE_FILE "unwritten.src.zck"
+#define TARGET_FILE "unwritten.zck"
+#define CHUNK_SIZE 8192
+#define CHUNKS 32
+#define WRITTEN 10
+#define END 20
+
+int main (int argc, char *argv[]) {
+    /* Write an uncompressed file, so chunks are exactly CHUNK_SIZE bytes */
+    char *data = calloc(CHUNK_SIZE * CHUNKS, 1);
+    for(size_t i=0; i<CHUNK_SIZE * CHUNKS; i++)
+        data[i] = (i * 7 + i / CHUNK_SIZE) % 251 + 1;
+    int out = open(SOURCE_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(out < 0) {
+        perror("Unable to open " SOURCE_FILE " for writing");
+        exit(1);
+    }
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_write(zck, out) ||
+       !zck_set_ioption(zck, ZCK_COMP_TYPE, ZCK_COMP_NONE) ||
+       !zck_set_ioption(zck, ZCK_MANUAL_CHUNK, 1)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    for(int i=0; i<CHUNKS; i++) {
+        if(zck_write(zck, data + i * CHUNK_SIZE, CHUNK_SIZE) != CHUNK_SIZE ||
+           zck_end_chunk(zck) < 0) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+    }
+    if(!zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+    close(out);
+
+    /* Build a target with just the header and one chunk, like an unfinished
+     * download, leaving a hole before and after the chunk */
+    zck = open_zck(SOURCE_FILE, 1, NULL);
+    int src = zck_get_fd(zck);
+    size_t header_length = zck_get_header_length(zck);
+    size_t start = zck_get_chunk_start(zck_get_chunk(zck, WRITTEN + 1));
+    size_t end = zck_get_chunk_start(zck_get_chunk(zck, END + 1));
+    char *buf = calloc(header_length + CHUNK_SIZE, 1);
+    int tgt = open(TARGET_FILE, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(tgt < 0 ||
+       pread(src, buf, header_length, 0) != header_length ||
+       pwrite(tgt, buf, header_length, 0) != header_length ||
+       pread(src, buf, CHUNK_SIZE, start) != CHUNK_SIZE ||
+       pwrite(tgt, buf, CHUNK_SIZE, start) != CHUNK_SIZE ||
+       ftruncate(tgt, end) != 0) {
+        perror("Unable to create " TARGET_FILE);
+        exit(1);
+    }
+    zck_free(&zck);
+    close(src);
+
+    /* Holes are only found if the filesystem can report them */
+    bool holes = false;
+#ifdef SEEK_DATA
+    off_t first_data = lseek(tgt, header_length + CHUNK_SIZE, SEEK_DATA);
+    holes = (first_data != -1 && first_data > header_length + CHUNK_SIZE);
+#endif
+    close(tgt);
+    printf("Filesystem %s holes\n", holes ? "reports" : "doesn't report");
+
+    for(int threads=1; threads<=4; threads+=3) {
+        zck = open_zck(TARGET_FILE, threads, NULL);
+        if(zck_find_valid_chunks(zck) != -1) {
+            printf("Target should have invalid chunks\n");
+            exit(1);
+        }
+        for(int i=1; i<=CHUNKS; i++) {
+            int valid = zck_get_chunk(zck, i)->valid;
+            int expected = -1;
+            if(i == WRITTEN + 1)
+                expected = 1;
+            else if(i > END)
+                expected = 0;
+            else if(holes)
+                expected = 0;
+            /* Chunks sharing a block with written data may be either */
+            if(valid != expected &&
+               !(valid == -1 && expected == 0 &&
+                 (i == 1 || i == WRITTEN || i == WRITTEN + 2))) {
+                printf("Chunk %i with %i threads: %i, expected %i\n", i,
+                       threads, valid, expected);
+                exit(1);
+            }
+        }
+        zck_free(&zck);
+    }
+
+    /* Full validation still reads everything, failing missing chunks */
+    zck = open_zck(TARGET_FILE, 1, NULL);
+    if(zck_validate_checksums(zck) != -1 ||
+       zck_failed_chunks(zck) != CHUNKS - 1) {
+        printf("Expected %i failed chunks, got %i\n", CHUNKS - 1,
+               zck_failed_chunks(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+
+    unlink(SOURCE_FILE);
+    unlink(TARGET_FILE);
+    free(buf);
+    free(data);
+    return 0;
+}
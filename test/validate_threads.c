@@ -0,0 +1,203 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+#define TEST_FILE "validate_threads.zck"
+
+/* Write buf out to TEST_FILE and check it with the given number of threads,
+ * storing each chunk's validity in valid */
+static int find_valid(const char *buf, size_t buf_size, int threads,
+                      int *valid, size_t count) {
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(fd < 0) {
+        perror("Unable to open " TEST_FILE);
+        exit(1);
+    }
+    if(write(fd, buf, buf_size) != buf_size) {
+        perror("Unable to write " TEST_FILE);
+        exit(1);
+    }
+    lseek(fd, 0, SEEK_SET);
+
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_read(zck, fd)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(!zck_set_ioption(zck, ZCK_THREADS, threads)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    int retval = zck_find_valid_chunks(zck);
+    if(retval == 0) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    size_t i = 0;
+    for(zckChunk *idx = zck_get_first_chunk(zck); idx;
+        idx = zck_get_next_chunk(idx)) {
+        if(i == count) {
+            printf("Too many chunks\n");
+            exit(1);
+        }
+        valid[i++] = zck_get_chunk_valid(idx);
+    }
+    zck_free(&zck);
+    close(fd);
+    return retval;
+}
+
+/* Check that using threads finds the same chunks as not using them */
+static void compare(const char *buf, size_t buf_size, size_t count,
+                    int expected, const char *desc) {
+    int *valid = calloc(count, sizeof(int));
+    int *valid_threads = calloc(count, sizeof(int));
+
+    int retval = find_valid(buf, buf_size, 1, valid, count);
+    if(retval != expected) {
+        printf("%s: expected %i, got %i\n", desc, expected, retval);
+        exit(1);
+    }
+    /* Far more threads than slices shouldn't mean far more readers */
+    int thread_counts[] = {2, 4, 8, 1000000};
+    for(int t=0; t<4; t++) {
+        int threads = thread_counts[t];
+        retval = find_valid(buf, buf_size, threads, valid_threads, count);
+        if(retval != expected) {
+            printf("%s: expected %i with %i threads, got %i\n", desc,
+                   expected, threads, retval);
+            exit(1);
+        }
+        for(size_t i=0; i<count; i++) {
+            if(valid[i] != valid_threads[i]) {
+                printf("%s: chunk %llu is %i with %i threads, expected %i\n",
+                       desc, (long long unsigned) i, valid_threads[i], threads,
+                       valid[i]);
+                exit(1);
+            }
+        }
+    }
+    free(valid_threads);
+    free(valid);
+}
+
+/* Write a file large enough to need several batches, with chunks of very
+ * different sizes, some larger than a worker's slice */
+static void write_file(void) {
+    int out = open(TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if(out < 0) {
+        perror("Unable to open " TEST_FILE " for writing");
+        exit(1);
+    }
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_write(zck, out) ||
+       !zck_set_ioption(zck, ZCK_COMP_TYPE, ZCK_COMP_NONE) ||
+       !zck_set_ioption(zck, ZCK_MANUAL_CHUNK, 1)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    char *data = calloc(1572864, 1);
+    unsigned int seed = 1;
+    size_t total = 0;
+    while(total < 12582912) {
+        seed = seed * 1103515245 + 12345;
+        size_t size = 1024 + (seed >> 8) % 1572864;
+        for(size_t i=0; i<size; i++) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = seed >> 16;
+        }
+        if(zck_write(zck, data, size) != size || zck_end_chunk(zck) < 0) {
+            printf("%s", zck_get_error(zck));
+            exit(1);
+        }
+        total += size;
+    }
+    if(!zck_close(zck)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    zck_free(&zck);
+    close(out);
+    free(data);
+}
+
+int main (int argc, char *argv[]) {
+    write_file();
+
+    /* Read zchunk file into memory */
+    int in = open(TEST_FILE, O_RDONLY | O_BINARY);
+    if(in < 0) {
+        perror("Unable to open " TEST_FILE " for reading");
+        exit(1);
+    }
+    struct stat st;
+    if(fstat(in, &st) != 0) {
+        perror("Unable to stat zchunk file");
+        exit(1);
+    }
+    char *buf = calloc(st.st_size, 1);
+    size_t buf_size = 0;
+    while(buf_size < st.st_size) {
+        ssize_t rb = read(in, buf + buf_size, st.st_size - buf_size);
+        if(rb < 1) {
+            perror("Unable to read zchunk file");
+            exit(1);
+        }
+        buf_size += rb;
+    }
+    close(in);
+
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_read_buffer(zck, buf, buf_size)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    size_t count = zck_get_chunk_count(zck);
+    size_t corrupt = zck_get_chunk_start(zck_get_chunk(zck, count - 2));
+    size_t truncate = zck_get_chunk_start(zck_get_chunk(zck, count / 2)) + 1;
+    zck_free(&zck);
+
+    compare(buf, buf_size, count, 1, "Intact file");
+    buf[corrupt] ^= 0xff;
+    compare(buf, buf_size, count, -1, "Corrupted chunk");
+    buf[corrupt] ^= 0xff;
+    compare(buf, truncate, count, -1, "Truncated file");
+
+    unlink(TEST_FILE);
+    free(buf);
+}
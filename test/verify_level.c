@@ -0,0 +1,139 @@
+/*
+ * Copyright 2018 Jonathan Dieter <jdieter@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *
+ *  2. Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zck.h>
+#include "zck_private.h"
+#include "util.h"
+
+/* Read all the data in buf at the given verification level, returning the
+ * number of bytes read or -1 if reading or closing failed */
+static ssize_t read_all(const char *buf, size_t buf_size, int level,
+                        char *data, size_t data_size) {
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_read_buffer(zck, buf, buf_size)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(!zck_set_ioption(zck, ZCK_VERIFY, level)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    ssize_t rb = zck_read(zck, data, data_size);
+    if(rb >= 0 && !zck_close(zck))
+        rb = -1;
+    zck_free(&zck);
+    return rb;
+}
+
+int main (int argc, char *argv[]) {
+    /* Read zchunk file into memory */
+    int in = open(argv[1], O_RDONLY | O_BINARY);
+    if(in < 0) {
+        perror("Unable to open zchunk file for reading");
+        exit(1);
+    }
+    struct stat st;
+    if(fstat(in, &st) != 0) {
+        perror("Unable to stat zchunk file");
+        exit(1);
+    }
+    char *buf = calloc(st.st_size, 1);
+    size_t buf_size = 0;
+    while(buf_size < st.st_size) {
+        ssize_t rb = read(in, buf + buf_size, st.st_size - buf_size);
+        if(rb < 1) {
+            perror("Unable to read zchunk file");
+            exit(1);
+        }
+        buf_size += rb;
+    }
+    close(in);
+
+    zckCtx *zck = zck_create();
+    if(zck == NULL || !zck_init_read_buffer(zck, buf, buf_size)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    size_t size = 0;
+    for(zckChunk *idx = zck_get_chunk(zck, 1); idx;
+        idx = zck_get_next_chunk(idx))
+        size += zck_get_chunk_size(idx);
+    size_t corrupt = zck_get_chunk_start(zck_get_chunk(zck, 2));
+    zck_free(&zck);
+
+    /* Every level should read an intact file */
+    char *expected = calloc(size, 1);
+    char *data = calloc(size, 1);
+    if(read_all(buf, buf_size, ZCK_VERIFY_ALL, expected, size) != size) {
+        printf("Unable to read intact file\n");
+        exit(1);
+    }
+    for(int level=ZCK_VERIFY_CHUNKS; level<=ZCK_VERIFY_NONE; level++) {
+        if(read_all(buf, buf_size, level, data, size) != size ||
+           memcmp(data, expected, size) != 0) {
+            printf("Unable to read intact file at level %i\n", level);
+            exit(1);
+        }
+    }
+
+    /* Only trusting the data should let a corrupted chunk through */
+    buf[corrupt] ^= 0xff;
+    for(int level=ZCK_VERIFY_ALL; level<=ZCK_VERIFY_CHUNKS; level++) {
+        if(read_all(buf, buf_size, level, data, size) >= 0) {
+            printf("Corrupted chunk not detected at level %i\n", level);
+            exit(1);
+        }
+    }
+    if(read_all(buf, buf_size, ZCK_VERIFY_NONE, data, size) != size ||
+       memcmp(data, expected, size) == 0) {
+        printf("Corrupted chunk not read when trusting data\n");
+        exit(1);
+    }
+
+    zck = zck_create();
+    if(zck == NULL || !zck_init_read_buffer(zck, buf, buf_size)) {
+        printf("%s", zck_get_error(zck));
+        exit(1);
+    }
+    if(zck_set_ioption(zck, ZCK_VERIFY, ZCK_VERIFY_NONE + 1)) {
+        printf("Invalid verification level accepted\n");
+        exit(1);
+    }
+    zck_free(&zck);
+
+    free(data);
+    free(expected);
+    free(buf);
+}